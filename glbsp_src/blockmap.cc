@@ -149,11 +149,27 @@ int CheckLinedefInsideBox(int xmin, int ymin, int xmax, int ymax,
 #define BK_XOR    2
 #define BK_FIRST  3
 
-#define BK_QUANTUM  32
+// number of strips rasterised in parallel for each thread
+#define BK_STRIPS_PER_THREAD  4
+
+// -AJA- The blockmap is built in two passes.  The first pass counts
+//       the lines in each block, then all the block lists are laid
+//       out in a single pool, and the second pass fills them in.
+//
+//       Each pass is split into horizontal strips of blocks, which
+//       are independent (a strip only touches its own blocks), hence
+//       they can be done in parallel.  Every strip visits the lines
+//       in order, so each block list is sorted exactly like before.
+
+static uint16_g *block_pool;
+static int *block_counts;
+
+static int block_strip_rows;
+static int block_filling;
 
 static void BlockAdd(int blk_num, int line_index)
 {
-  uint16_g *cur = block_lines[blk_num];
+  uint16_g *cur;
 
 # if DEBUG_BLOCKMAP
   PrintDebug("Block %d has line %d\n", blk_num, line_index);
@@ -161,23 +177,17 @@ static void BlockAdd(int blk_num, int line_index)
 
   if (blk_num < 0 || blk_num >= block_count)
     InternalError("BlockAdd: bad block number %d", blk_num);
-    
-  if (! cur)
+
+  if (! block_filling)
   {
-    // create empty block
-    block_lines[blk_num] = cur = (uint16_g *)UtilCalloc(BK_QUANTUM * sizeof(uint16_g));
-    cur[BK_NUM] = 0;
-    cur[BK_MAX] = BK_QUANTUM;
-    cur[BK_XOR] = 0x1234;
+    block_counts[blk_num] += 1;
+    return;
   }
 
-  if (BK_FIRST + cur[BK_NUM] == cur[BK_MAX])
-  {
-    // no more room, so allocate some more...
-    cur[BK_MAX] += BK_QUANTUM;
+  cur = block_lines[blk_num];
 
-    block_lines[blk_num] = cur = (uint16_g *)UtilRealloc(cur, cur[BK_MAX] * sizeof(uint16_g));
-  }
+  if (BK_FIRST + cur[BK_NUM] == cur[BK_MAX])
+    InternalError("BlockAdd: block %d overflowed", blk_num);
 
   // compute new checksum
   cur[BK_XOR] = ((cur[BK_XOR] << 4) | (cur[BK_XOR] >> 12)) ^ line_index;
@@ -186,7 +196,7 @@ static void BlockAdd(int blk_num, int line_index)
   cur[BK_NUM]++;
 }
 
-static void BlockAddLine(linedef_t *L)
+static void BlockAddLine(linedef_t *L, int row_lo, int row_hi)
 {
   int x1 = (int) L->start->x;
   int y1 = (int) L->start->y;
@@ -218,6 +228,9 @@ static void BlockAddLine(linedef_t *L)
   // handle simple case #1: completely horizontal
   if (by1 == by2)
   {
+    if (by1 < row_lo || by1 > row_hi)
+      return;
+
     for (bx=bx1; bx <= bx2; bx++)
     {
       int blk_num = by1 * block_w + bx;
@@ -226,6 +239,11 @@ static void BlockAddLine(linedef_t *L)
     return;
   }
 
+  // only visit the rows of the current strip.  Note that this must
+  // happen _after_ the above check (which uses the full range).
+  by1 = MAX(by1, row_lo);
+  by2 = MIN(by2, row_hi);
+
   // handle simple case #2: completely vertical
   if (bx1 == bx2)
   {
@@ -256,13 +274,12 @@ static void BlockAddLine(linedef_t *L)
   }
 }
 
-static void CreateBlockmap(void)
+static void BlockStripJob(int index, void *)
 {
-  int i;
-
-  block_lines = (uint16_g **) UtilCalloc(block_count * sizeof(uint16_g *));
+  int row_lo = index * block_strip_rows;
+  int row_hi = MIN(row_lo + block_strip_rows, block_h) - 1;
 
-  DisplayTicker();
+  int i;
 
   for (i=0; i < num_linedefs; i++)
   {
@@ -272,8 +289,84 @@ static void CreateBlockmap(void)
     if (L->zero_len)
       continue;
 
-    BlockAddLine(L);
+    BlockAddLine(L, row_lo, row_hi);
+  }
+}
+
+static void BlockRasterise(void)
+{
+  int num_strips = 1;
+  int i;
+
+  // every strip visits all the lines, so only use a few per thread
+  if (cur_funcs->parallel_for && cur_funcs->parallel_threads > 1)
+    num_strips = MIN(block_h, cur_funcs->parallel_threads * BK_STRIPS_PER_THREAD);
+
+  block_strip_rows = (block_h + num_strips - 1) / num_strips;
+  num_strips = (block_h + block_strip_rows - 1) / block_strip_rows;
+
+  if (num_strips > 1)
+  {
+    (* cur_funcs->parallel_for)(num_strips, BlockStripJob, NULL);
+    return;
   }
+
+  for (i=0; i < num_strips; i++)
+    BlockStripJob(i, NULL);
+}
+
+static void CreateBlockmap(void)
+{
+  int i;
+  int total = 0;
+
+  block_lines  = (uint16_g **) UtilCalloc(block_count * sizeof(uint16_g *));
+  block_counts = (int *) UtilCalloc(block_count * sizeof(int));
+
+  DisplayTicker();
+
+  // first pass: count the lines in each block
+
+  block_filling = FALSE;
+
+  BlockRasterise();
+
+  for (i=0; i < block_count; i++)
+  {
+    if (block_counts[i] > 0)
+      total += BK_FIRST + block_counts[i];
+  }
+
+  block_pool = (uint16_g *) UtilCalloc((total + 1) * sizeof(uint16_g));
+
+  total = 0;
+
+  for (i=0; i < block_count; i++)
+  {
+    uint16_g *cur;
+
+    if (block_counts[i] == 0)
+      continue;
+
+    block_lines[i] = cur = block_pool + total;
+
+    cur[BK_NUM] = 0;
+    cur[BK_MAX] = BK_FIRST + block_counts[i];
+    cur[BK_XOR] = 0x1234;
+
+    total += BK_FIRST + block_counts[i];
+  }
+
+  DisplayTicker();
+
+  // second pass: fill in the block lists
+
+  block_filling = TRUE;
+
+  BlockRasterise();
+
+  UtilFree(block_counts);
+  block_counts = NULL;
 }
 
 
@@ -304,29 +397,118 @@ static int BlockCompare(const void *p1, const void *p2)
   return memcmp(A+BK_FIRST, B+BK_FIRST, A[BK_NUM] * sizeof(uint16_g));
 }
 
+static uint32_g BlockHash(const uint16_g *blk)
+{
+  // FNV-1a over the line list
+  uint32_g hash = 2166136261U;
+  int i;
+
+  for (i=0; i < blk[BK_NUM]; i++)
+  {
+    hash = (hash ^ (blk[BK_FIRST + i] & 0xFF)) * 16777619U;
+    hash = (hash ^ (blk[BK_FIRST + i] >> 8))  * 16777619U;
+  }
+
+  return hash;
+}
+
+//
+// FindUniqueBlocks
+//
+// Uses a hash table to find the first block of each distinct line
+// list.  The unique[] array receives those blocks (in block order),
+// and first[] maps every non-empty block to its unique block.
+// Returns the number of unique blocks.
+//
+static int FindUniqueBlocks(uint16_g *unique, int *first)
+{
+  int table_size = 256;
+  int *table;
+
+  int num_unique = 0;
+  int i;
+
+  while (table_size < block_count * 2)
+    table_size <<= 1;
+
+  table = (int *) UtilCalloc(table_size * sizeof(int));
+
+  for (i=0; i < table_size; i++)
+    table[i] = -1;
+
+  for (i=0; i < block_count; i++)
+  {
+    const uint16_g *blk = block_lines[i];
+    int pos;
+
+    first[i] = -1;
+
+    if (blk == NULL)
+      continue;
+
+    pos = (int) (BlockHash(blk) & (table_size - 1));
+
+    for (;;)
+    {
+      int other = table[pos];
+
+      if (other < 0)
+      {
+        table[pos] = i;
+        first[i]   = i;
+
+        unique[num_unique++] = i;
+        break;
+      }
+
+      if (blk[BK_NUM] == block_lines[other][BK_NUM] &&
+          memcmp(blk + BK_FIRST, block_lines[other] + BK_FIRST,
+                 blk[BK_NUM] * sizeof(uint16_g)) == 0)
+      {
+        first[i] = other;
+        break;
+      }
+
+      pos = (pos + 1) & (table_size - 1);
+    }
+  }
+
+  UtilFree(table);
+
+  return num_unique;
+}
+
 static void CompressBlockmap(void)
 {
   int i;
   int cur_offset;
   int dup_count=0;
+  int num_unique;
 
   int orig_size, new_size;
 
+  int *first;
+
   block_ptrs = (uint16_g *)UtilCalloc(block_count * sizeof(uint16_g));
   block_dups = (uint16_g *)UtilCalloc(block_count * sizeof(uint16_g));
 
+  first = (int *) UtilCalloc(block_count * sizeof(int));
+
   DisplayTicker();
 
-  // sort duplicate-detecting array.  After the sort, all duplicates
-  // will be next to each other.  The duplicate array gives the order
-  // of the blocklists in the BLOCKMAP lump.
-  
-  for (i=0; i < block_count; i++)
-    block_dups[i] = i;
+  // -AJA- find duplicates with a hash table, then sort the unique
+  //       blocks.  The duplicate array gives the order of the
+  //       blocklists in the BLOCKMAP lump (the same order as sorting
+  //       every block would give).
 
-  qsort(block_dups, block_count, sizeof(uint16_g), BlockCompare);
+  num_unique = FindUniqueBlocks(block_dups, first);
 
-  // scan duplicate array and build up offset array
+  qsort(block_dups, num_unique, sizeof(uint16_g), BlockCompare);
+
+  for (i=num_unique; i < block_count; i++)
+    block_dups[i] = DUMMY_DUP;
+
+  // scan unique blocks and build up offset array
 
   cur_offset = 4 + block_count + 2;
 
@@ -335,53 +517,40 @@ static void CompressBlockmap(void)
 
   DisplayTicker();
 
-  for (i=0; i < block_count; i++)
+  for (i=0; i < num_unique; i++)
   {
     int blk_num = block_dups[i];
-    int count;
+    int count = 2 + block_lines[blk_num][BK_NUM];
+
+    block_ptrs[blk_num] = cur_offset;
+
+    cur_offset += count;
+    new_size   += count;
+  }
 
+  for (i=0; i < block_count; i++)
+  {
     // empty block ?
-    if (block_lines[blk_num] == NULL)
+    if (first[i] < 0)
     {
-      block_ptrs[blk_num] = 4 + block_count;
-      block_dups[i] = DUMMY_DUP;
+      block_ptrs[i] = 4 + block_count;
 
       orig_size += 2;
       continue;
     }
 
-    count = 2 + block_lines[blk_num][BK_NUM];
+    orig_size += 2 + block_lines[i][BK_NUM];
 
-    // duplicate ?  Only the very last one of a sequence of duplicates
-    // will update the current offset value.
-
-    if (i+1 < block_count && 
-        BlockCompare(block_dups + i, block_dups + i+1) == 0)
+    // duplicate ?
+    if (first[i] != i)
     {
-      block_ptrs[blk_num] = cur_offset;
-      block_dups[i] = DUMMY_DUP;
-
-      // free the memory of the duplicated block
-      UtilFree(block_lines[blk_num]);
-      block_lines[blk_num] = NULL;
-      
+      block_ptrs[i] = block_ptrs[first[i]];
       dup_count++;
-
-      orig_size += count;
-      continue;
     }
-
-    // OK, this block is either the last of a series of duplicates, or
-    // just a singleton.
-
-    block_ptrs[blk_num] = cur_offset;
-
-    cur_offset += count;
-
-    orig_size += count;
-    new_size  += count;
   }
 
+  UtilFree(first);
+
   if (cur_offset > 65535)
   {
     MarkSoftFailure(LIMIT_BLOCKMAP);
@@ -464,14 +633,7 @@ static void WriteBlockmap(void)
 
 static void FreeBlockmap(void)
 {
-  int i;
-
-  for (i=0; i < block_count; i++)
-  {
-    if (block_lines[i])
-      UtilFree(block_lines[i]);
-  }
-
+  UtilFree(block_pool);
   UtilFree(block_lines);
   UtilFree(block_ptrs);
   UtilFree(block_dups);
@@ -596,9 +758,8 @@ void PutBlockmap(void)
   
   CreateBlockmap();
 
-  // -AJA- second phase: compress the blockmap.  We do this by sorting
-  //       the blocks, which is a typical way to detect duplicates in
-  //       a large list.
+  // -AJA- second phase: compress the blockmap.  We do this by finding
+  //       the duplicate blocks via a hash table.
 
   CompressBlockmap();
  
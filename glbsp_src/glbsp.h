@@ -202,6 +202,20 @@ typedef struct nodebuildfuncs_s
   // and should remove the progress indicator/window from the screen.
   //
   void (* display_close)(void);
+
+  // This optional routine (it can be NULL) must call func(i, priv)
+  // for every i from 0 to count-1, and return once they are all
+  // done.  The calls may happen on several threads at once, and the
+  // node builder uses it to evaluate partition lines in parallel.
+  // The result is the same whether this routine is given or not.
+  //
+  void (* parallel_for)(int count, void (* func)(int index, void *priv),
+      void *priv);
+
+  // Number of threads which parallel_for uses (ignored when it is
+  // NULL).  Work is only split into a few pieces per thread.
+  //
+  int parallel_threads;
 }
 nodebuildfuncs_t;
 
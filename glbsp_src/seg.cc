@@ -46,6 +46,8 @@
 #include <limits.h>
 #include <assert.h>
 
+#include <atomic>
+
 #include "analyze.h"
 #include "blockmap.h"
 #include "level.h"
@@ -330,20 +332,207 @@ static void AddIntersection(intersection_t ** cut_list,
 }
 
 
+//
+// -AJA- Before picking a node, the segs are copied into flat arrays
+//       (one array per field), which lets the compiler vectorise the
+//       distance computations in EvalPartitionWorker.  The superblock
+//       tree is mirrored by the eval_block_t structures, hence whole
+//       blocks can still be handled at once via BoxOnLineSide().
+//
+
+#define EVAL_REAL      1
+#define EVAL_PRECIOUS  2
+
+// number of partition candidates per parallel job
+#define PICK_JOB_SIZE  16
+
+// fewer candidates than this are always evaluated serially
+#define PICK_PARALLEL_MIN  64
+
+
+typedef struct eval_block_s
+{
+  superblock_t *block;
+
+  // range of segs (in the eval_list_t arrays) directly in this block
+  int first;
+  int count;
+
+  // sub-blocks (index into blocks[]), or -1 when empty
+  int subs[2];
+}
+eval_block_t;
+
+typedef struct eval_list_s
+{
+  // blocks[0] is the top level, followed by all the sub-blocks in
+  // depth-first order.  The segs are stored in the same order.
+  eval_block_t *blocks;
+  int num_blocks;
+
+  seg_t **segs;
+  int num_segs;
+
+  float_g *sx, *sy;
+  float_g *ex, *ey;
+  float_g *dx, *dy;
+
+  linedef_t **source;
+  unsigned char *flags;
+
+  // the largest 'count' of any block
+  int max_count;
+}
+eval_list_t;
+
+
+static void CountEvalWorker(superblock_t *block, int *num_blocks,
+    int *num_segs)
+{
+  seg_t *cur;
+  int num;
+
+  (*num_blocks) += 1;
+
+  for (cur=block->segs; cur; cur=cur->next)
+    (*num_segs) += 1;
+
+  for (num=0; num < 2; num++)
+  {
+    if (block->subs[num])
+      CountEvalWorker(block->subs[num], num_blocks, num_segs);
+  }
+}
+
+static int FillEvalWorker(eval_list_t *list, superblock_t *block)
+{
+  eval_block_t *E;
+  seg_t *cur;
+
+  int index = list->num_blocks;
+  int num;
+
+  list->num_blocks += 1;
+
+  E = &list->blocks[index];
+
+  E->block = block;
+  E->first = list->num_segs;
+  E->count = 0;
+
+  for (cur=block->segs; cur; cur=cur->next)
+  {
+    int k = list->num_segs;
+
+    list->segs[k] = cur;
+
+    list->sx[k] = cur->psx;
+    list->sy[k] = cur->psy;
+    list->ex[k] = cur->pex;
+    list->ey[k] = cur->pey;
+    list->dx[k] = cur->pdx;
+    list->dy[k] = cur->pdy;
+
+    list->source[k] = cur->source_line;
+    list->flags[k]  = 0;
+
+    if (cur->linedef)
+    {
+      list->flags[k] |= EVAL_REAL;
+
+      if (cur->linedef->is_precious)
+        list->flags[k] |= EVAL_PRECIOUS;
+    }
+
+    list->num_segs += 1;
+    E->count += 1;
+  }
+
+  list->max_count = MAX(list->max_count, E->count);
+
+  for (num=0; num < 2; num++)
+  {
+    E->subs[num] = -1;
+
+    if (block->subs[num])
+      E->subs[num] = FillEvalWorker(list, block->subs[num]);
+  }
+
+  return index;
+}
+
+//
+// CreateEvalList
+//
+static eval_list_t *CreateEvalList(superblock_t *seg_list)
+{
+  eval_list_t *list;
+
+  int num_blocks = 0;
+  int num_segs   = 0;
+
+  CountEvalWorker(seg_list, &num_blocks, &num_segs);
+
+  list = (eval_list_t *) UtilCalloc(sizeof(eval_list_t));
+
+  list->blocks = (eval_block_t *) UtilCalloc(num_blocks * sizeof(eval_block_t));
+  list->segs   = (seg_t **)       UtilCalloc((num_segs + 1) * sizeof(seg_t *));
+
+  list->sx = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+  list->sy = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+  list->ex = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+  list->ey = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+  list->dx = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+  list->dy = (float_g *) UtilCalloc((num_segs + 1) * sizeof(float_g));
+
+  list->source = (linedef_t **)     UtilCalloc((num_segs + 1) * sizeof(linedef_t *));
+  list->flags  = (unsigned char *) UtilCalloc(num_segs + 1);
+
+  FillEvalWorker(list, seg_list);
+
+  return list;
+}
+
+//
+// FreeEvalList
+//
+static void FreeEvalList(eval_list_t *list)
+{
+  UtilFree(list->blocks);
+  UtilFree(list->segs);
+
+  UtilFree(list->sx);
+  UtilFree(list->sy);
+  UtilFree(list->ex);
+  UtilFree(list->ey);
+  UtilFree(list->dx);
+  UtilFree(list->dy);
+
+  UtilFree(list->source);
+  UtilFree(list->flags);
+
+  UtilFree(list);
+}
+
+
 //
 // EvalPartitionWorker
 //
 // Returns TRUE if a "bad seg" was found early.
 //
-static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part, 
-    int best_cost, eval_info_t *info)
+// The dist_a[] and dist_b[] arrays are scratch space, they must be
+// large enough for the biggest block.
+//
+static int EvalPartitionWorker(const eval_list_t *list, int blk,
+    seg_t *part, int best_cost, eval_info_t *info,
+    float_g *dist_a, float_g *dist_b)
 {
-  seg_t *check;
+  const eval_block_t *E = &list->blocks[blk];
 
   float_g qnty;
   float_g a, b, fa, fb;
 
-  int num;
+  int i, num;
   int factor = cur_info->factor;
 
   // -AJA- this is the heart of my superblock idea, it tests the
@@ -351,14 +540,14 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
   //       all the segs within it at once.  Only when the partition
   //       line intercepts the box do we need to go deeper into it.
 
-  num = BoxOnLineSide(seg_list, part);
+  num = BoxOnLineSide(E->block, part);
 
   if (num < 0)
   {
     // LEFT
 
-    info->real_left += seg_list->real_num;
-    info->mini_left += seg_list->mini_num;
+    info->real_left += E->block->real_num;
+    info->mini_left += E->block->mini_num;
 
     return FALSE;
   }
@@ -366,28 +555,51 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
   {
     // RIGHT
 
-    info->real_right += seg_list->real_num;
-    info->mini_right += seg_list->mini_num;
+    info->real_right += E->block->real_num;
+    info->mini_right += E->block->mini_num;
     
     return FALSE;
   }
 
+  /* compute the distances of all the Segs in one go */
+  {
+    const float_g *sx = list->sx + E->first;
+    const float_g *sy = list->sy + E->first;
+    const float_g *ex = list->ex + E->first;
+    const float_g *ey = list->ey + E->first;
+
+    float_g p_dx   = part->pdx;
+    float_g p_dy   = part->pdy;
+    float_g p_perp = part->p_perp;
+    float_g p_len  = part->p_length;
+
+    // this is UtilPerpDist() for each start and end point
+    for (i=0; i < E->count; i++)
+    {
+      dist_a[i] = (sx[i] * p_dy - sy[i] * p_dx + p_perp) / p_len;
+      dist_b[i] = (ex[i] * p_dy - ey[i] * p_dx + p_perp) / p_len;
+    }
+  }
+
 # define ADD_LEFT()  \
       do {  \
-        if (check->linedef) info->real_left += 1;  \
-        else                info->mini_left += 1;  \
+        if (flags & EVAL_REAL) info->real_left += 1;  \
+        else                   info->mini_left += 1;  \
       } while (0)
 
 # define ADD_RIGHT()  \
       do {  \
-        if (check->linedef) info->real_right += 1;  \
-        else                info->mini_right += 1;  \
+        if (flags & EVAL_REAL) info->real_right += 1;  \
+        else                   info->mini_right += 1;  \
       } while (0)
 
   /* check partition against all Segs */
 
-  for (check=seg_list->segs; check; check=check->next)
+  for (i=0; i < E->count; i++)
   { 
+    int k = E->first + i;
+    int flags = list->flags[k];
+
     // This is the heart of my pruning idea - it catches
     // bad segs early on. Killough
 
@@ -395,14 +607,14 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
       return TRUE;
 
     /* get state of lines' relation to each other */
-    if (check->source_line == part->source_line)
+    if (list->source[k] == part->source_line)
     {
       a = b = fa = fb = 0;
     }
     else
     {
-      a = UtilPerpDist(part, check->psx, check->psy);
-      b = UtilPerpDist(part, check->pex, check->pey);
+      a = dist_a[i];
+      b = dist_b[i];
 
       fa = fabs(a);
       fb = fabs(b);
@@ -414,7 +626,7 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
       // this seg runs along the same line as the partition.  Check
       // whether it goes in the same direction or the opposite.
 
-      if (check->pdx*part->pdx + check->pdy*part->pdy < 0)
+      if (list->dx[k]*part->pdx + list->dy[k]*part->pdy < 0)
       {
         ADD_LEFT();
       }
@@ -434,7 +646,7 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
 
     if (fa <= DIST_EPSILON || fb <= DIST_EPSILON)
     {
-      if (check->linedef && check->linedef->is_precious)
+      if (flags & EVAL_PRECIOUS)
         info->cost += 40 * factor * PRECIOUS_MULTIPLY;
     }
 
@@ -502,7 +714,7 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
     // are exhausted. This is used to protect deep water and invisible
     // lifts/stairs from being messed up accidentally by splits.
 
-    if (check->linedef && check->linedef->is_precious)
+    if (flags & EVAL_PRECIOUS)
       info->cost += 100 * factor * PRECIOUS_MULTIPLY;
     else
       info->cost += 100 * factor;
@@ -523,14 +735,18 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
     }
   }
 
+# undef ADD_LEFT
+# undef ADD_RIGHT
+
   /* handle sub-blocks recursively */
 
   for (num=0; num < 2; num++)
   {
-    if (! seg_list->subs[num])
+    if (E->subs[num] < 0)
       continue;
 
-    if (EvalPartitionWorker(seg_list->subs[num], part, best_cost, info))
+    if (EvalPartitionWorker(list, E->subs[num], part, best_cost, info,
+        dist_a, dist_b))
       return TRUE;
   }
 
@@ -548,8 +764,8 @@ static int EvalPartitionWorker(superblock_t *seg_list, seg_t *part,
 // Returns the computed cost, or a negative value if the seg should be
 // skipped altogether.
 //
-static int EvalPartition(superblock_t *seg_list, seg_t *part, 
-    int best_cost)
+static int EvalPartition(const eval_list_t *list, seg_t *part, 
+    int best_cost, float_g *dist_a, float_g *dist_b)
 {
   eval_info_t info;
 
@@ -564,7 +780,7 @@ static int EvalPartition(superblock_t *seg_list, seg_t *part,
   info.mini_left  = 0;
   info.mini_right = 0;
   
-  if (EvalPartitionWorker(seg_list, part, best_cost, &info))
+  if (EvalPartitionWorker(list, 0, part, best_cost, &info, dist_a, dist_b))
     return -1;
   
   /* make sure there is at least one real seg on each side */
@@ -659,7 +875,8 @@ static void EvaluateFastWorker(superblock_t *seg_list,
 }
 
 
-static seg_t *FindFastSeg(superblock_t *seg_list, const bbox_t *bbox)
+static seg_t *FindFastSeg(superblock_t *seg_list, const eval_list_t *list,
+    const bbox_t *bbox, float_g *dist_a, float_g *dist_b)
 {
   seg_t *best_H = NULL;
   seg_t *best_V = NULL;
@@ -673,10 +890,10 @@ static seg_t *FindFastSeg(superblock_t *seg_list, const bbox_t *bbox)
   int V_cost = -1;
 
   if (best_H)
-    H_cost = EvalPartition(seg_list, best_H, 99999999);
+    H_cost = EvalPartition(list, best_H, 99999999, dist_a, dist_b);
 
   if (best_V)
-    V_cost = EvalPartition(seg_list, best_V, 99999999);
+    V_cost = EvalPartition(list, best_V, 99999999, dist_a, dist_b);
 
 # if DEBUG_PICKNODE
   PrintDebug("FindFastSeg: best_H=%p (cost %d) | best_V=%p (cost %d)\n",
@@ -694,66 +911,187 @@ static seg_t *FindFastSeg(superblock_t *seg_list, const bbox_t *bbox)
 
 
 /* returns FALSE if cancelled */
-static int PickNodeWorker(superblock_t *part_list, 
-    superblock_t *seg_list, seg_t ** best, int *best_cost,
-    int *progress, int prog_step)
+static int PickNodeWorker(const eval_list_t *list, seg_t ** best,
+    int *best_cost, int *progress, int prog_step,
+    float_g *dist_a, float_g *dist_b)
 {
   seg_t *part;
 
-  int num;
+  int blk, i;
   int cost;
 
-  /* use each Seg as partition */
-  for (part=part_list->segs; part; part = part->next)
+  for (blk=0; blk < list->num_blocks; blk++)
+  {
+    const eval_block_t *E = &list->blocks[blk];
+
+    /* use each Seg as partition */
+    for (i=0; i < E->count; i++)
+    {
+      part = list->segs[E->first + i];
+
+      if (cur_comms->cancelled)
+        return FALSE;
+
+#     if DEBUG_PICKNODE
+      PrintDebug("PickNode:   %sSEG %p  sector=%d  (%1.1f,%1.1f) -> (%1.1f,%1.1f)\n",
+        part->linedef ? "" : "MINI", part, 
+        part->sector ? part->sector->index : -1,
+        part->start->x, part->start->y, part->end->x, part->end->y);
+#     endif
+
+      /* something for the user to look at */
+      (*progress) += 1;
+
+      if ((*progress % prog_step) == 0)
+      {
+        cur_comms->build_pos++;
+        DisplaySetBar(1, cur_comms->build_pos);
+        DisplaySetBar(2, cur_comms->file_pos + cur_comms->build_pos / 100);
+      }
+
+      /* ignore minisegs as partition candidates */
+      if (! part->linedef)
+        continue;
+      
+      cost = EvalPartition(list, part, *best_cost, dist_a, dist_b);
+
+      /* seg unsuitable or too costly ? */
+      if (cost < 0 || cost >= *best_cost)
+        continue;
+
+      /* we have a new better choice */
+      (*best_cost) = cost;
+
+      /* remember which Seg */
+      (*best) = part;
+    }
+
+    DisplayTicker();
+  }
+
+  return TRUE;
+}
+
+
+//
+// -AJA- Parallel version of PickNodeWorker.  Each job evaluates a
+//       small range of candidates, and the lowest cost found so far
+//       is shared between all the jobs for pruning.
+//
+//       The serial code picks the _first_ candidate with the lowest
+//       cost, and pruning only ever rejects candidates which cost
+//       more than some other candidate, so by choosing the lowest
+//       cost with the lowest index afterwards we get exactly the
+//       same partition as the serial code.
+//
+
+typedef struct pick_job_s
+{
+  const eval_list_t *list;
+
+  // candidate segs, in the same order as the serial code
+  seg_t **cands;
+  int num_cands;
+
+  // cost of each candidate, negative if unsuitable (or pruned)
+  int *costs;
+
+  std::atomic<int> best_cost;
+}
+pick_job_t;
+
+
+static void PickNodeJob(int index, void *priv_dat)
+{
+  pick_job_t *job = (pick_job_t *) priv_dat;
+
+  int first = index * PICK_JOB_SIZE;
+  int last  = MIN(first + PICK_JOB_SIZE, job->num_cands);
+  int i;
+
+  int max_count = job->list->max_count + 1;
+
+  float_g *dist_a = (float_g *) UtilCalloc(max_count * sizeof(float_g));
+  float_g *dist_b = (float_g *) UtilCalloc(max_count * sizeof(float_g));
+
+  for (i=first; i < last; i++)
   {
     if (cur_comms->cancelled)
-      return FALSE;
+      break;
 
-#   if DEBUG_PICKNODE
-    PrintDebug("PickNode:   %sSEG %p  sector=%d  (%1.1f,%1.1f) -> (%1.1f,%1.1f)\n",
-      part->linedef ? "" : "MINI", part, 
-      part->sector ? part->sector->index : -1,
-      part->start->x, part->start->y, part->end->x, part->end->y);
-#   endif
+    int cost = EvalPartition(job->list, job->cands[i],
+        job->best_cost.load(), dist_a, dist_b);
+
+    job->costs[i] = cost;
+
+    if (cost < 0)
+      continue;
+
+    int old_cost = job->best_cost.load();
 
-    /* something for the user to look at */
-    (*progress) += 1;
+    while (cost < old_cost &&
+           ! job->best_cost.compare_exchange_weak(old_cost, cost))
+    { }
+  }
+
+  UtilFree(dist_a);
+  UtilFree(dist_b);
+}
 
-    if ((*progress % prog_step) == 0)
+
+/* returns FALSE if cancelled */
+static int PickNodeParallel(const eval_list_t *list, seg_t ** best,
+    int *best_cost, int prog_step)
+{
+  pick_job_t job;
+  int i;
+
+  job.list  = list;
+  job.cands = (seg_t **) UtilCalloc((list->num_segs + 1) * sizeof(seg_t *));
+  job.costs = (int *)    UtilCalloc((list->num_segs + 1) * sizeof(int));
+  job.num_cands = 0;
+  job.best_cost = *best_cost;
+
+  /* ignore minisegs as partition candidates */
+  for (i=0; i < list->num_segs; i++)
+  {
+    if (list->segs[i]->linedef)
     {
-      cur_comms->build_pos++;
-      DisplaySetBar(1, cur_comms->build_pos);
-      DisplaySetBar(2, cur_comms->file_pos + cur_comms->build_pos / 100);
+      job.costs[job.num_cands] = -1;
+      job.cands[job.num_cands++] = list->segs[i];
     }
+  }
 
-    /* ignore minisegs as partition candidates */
-    if (! part->linedef)
-      continue;
-    
-    cost = EvalPartition(seg_list, part, *best_cost);
+  (* cur_funcs->parallel_for)
+      ((job.num_cands + PICK_JOB_SIZE - 1) / PICK_JOB_SIZE, PickNodeJob, &job);
+
+  for (i=0; i < job.num_cands; i++)
+  {
+    int cost = job.costs[i];
 
-    /* seg unsuitable or too costly ? */
     if (cost < 0 || cost >= *best_cost)
       continue;
 
-    /* we have a new better choice */
     (*best_cost) = cost;
-
-    /* remember which Seg */
-    (*best) = part;
+    (*best) = job.cands[i];
   }
 
-  DisplayTicker();
+  UtilFree(job.cands);
+  UtilFree(job.costs);
 
-  /* recursively handle sub-blocks */
+  if (cur_comms->cancelled)
+    return FALSE;
 
-  for (num=0; num < 2; num++)
+  /* update progress, same as the serial code */
+  if (list->num_segs >= prog_step)
   {
-    if (part_list->subs[num])
-      PickNodeWorker(part_list->subs[num], seg_list, best, best_cost,
-        progress, prog_step);
+    cur_comms->build_pos += list->num_segs / prog_step;
+    DisplaySetBar(1, cur_comms->build_pos);
+    DisplaySetBar(2, cur_comms->file_pos + cur_comms->build_pos / 100);
   }
 
+  DisplayTicker();
+
   return TRUE;
 }
 
@@ -772,6 +1110,8 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
   int prog_step=1<<24;
   int build_step=0;
 
+  int result;
+
 # if DEBUG_PICKNODE
   PrintDebug("PickNode: BEGUN (depth %d)\n", depth);
 # endif
@@ -798,6 +1138,11 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
 
   DisplayTicker();
 
+  eval_list_t *list = CreateEvalList(seg_list);
+
+  float_g *dist_a = (float_g *) UtilCalloc((list->max_count + 1) * sizeof(float_g));
+  float_g *dist_b = (float_g *) UtilCalloc((list->max_count + 1) * sizeof(float_g));
+
   /* -AJA- another (optional) optimisation, when building just the GL
    *       nodes.  We assume that the original nodes are reasonably
    *       good choices, and re-use them as much as possible, saving
@@ -809,7 +1154,7 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
     PrintDebug("PickNode: Looking for Fast node...\n");
 #   endif
 
-    best = FindFastSeg(seg_list, bbox);
+    best = FindFastSeg(seg_list, list, bbox, dist_a, dist_b);
 
     if (best)
     {
@@ -823,12 +1168,27 @@ seg_t *PickNode(superblock_t *seg_list, int depth, const bbox_t *bbox)
           best->start->x, best->start->y, best->end->x, best->end->y);
 #     endif
 
+      UtilFree(dist_a);
+      UtilFree(dist_b);
+
+      FreeEvalList(list);
+
       return best;
     }
   }
 
-  if (FALSE == PickNodeWorker(seg_list, seg_list, &best, &best_cost, 
-      &progress, prog_step))
+  if (cur_funcs->parallel_for && seg_list->real_num >= PICK_PARALLEL_MIN)
+    result = PickNodeParallel(list, &best, &best_cost, prog_step);
+  else
+    result = PickNodeWorker(list, &best, &best_cost, &progress, prog_step,
+        dist_a, dist_b);
+
+  UtilFree(dist_a);
+  UtilFree(dist_b);
+
+  FreeEvalList(list);
+
+  if (FALSE == result)
   {
     /* hack here : BuildNodes will detect the cancellation */
     return NULL;
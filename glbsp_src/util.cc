@@ -233,6 +233,23 @@ int UtilFileExists(const char *filename)
 //
 char *UtilTimeString(void)
 {
+  // -AJA- honour SOURCE_DATE_EPOCH, so that output files can be
+  //       reproduced byte-for-byte (e.g. when benchmarking).
+  const char *sde = getenv("SOURCE_DATE_EPOCH");
+
+  if (sde && sde[0])
+  {
+    time_t fixed_time = (time_t) strtol(sde, NULL, 10);
+    struct tm *fixed_calend = gmtime(&fixed_time);
+
+    if (fixed_calend)
+      return UtilFormat("%04d-%02d-%02d %02d:%02d:%02d.%04d",
+          fixed_calend->tm_year + 1900, fixed_calend->tm_mon + 1,
+          fixed_calend->tm_mday,
+          fixed_calend->tm_hour, fixed_calend->tm_min,
+          fixed_calend->tm_sec,  0);
+  }
+
 #ifdef WIN32
 
   SYSTEMTIME sys_time;
@@ -762,6 +762,69 @@ static void SortLumps(lump_t ** list, const char **names, int count)
 }
 
 
+static lump_t **copy_lumps;
+static int num_copy_lumps;
+static int max_copy_lumps;
+
+//
+// FindSharedLump
+//
+// Looks for an earlier lump which is copied from the same place in
+// the input wad, hence has identical contents.  Such lumps share the
+// data in the output wad too.
+//
+static lump_t *FindSharedLump(lump_t *lump)
+{
+  int i;
+
+  if (! (lump->flags & LUMP_COPY_ME) || lump->length == 0)
+    return NULL;
+
+  for (i=0; i < num_copy_lumps; i++)
+  {
+    lump_t *other = copy_lumps[i];
+
+    if (other->start == lump->start && other->length == lump->length)
+      return other;
+  }
+
+  if (num_copy_lumps >= max_copy_lumps)
+  {
+    max_copy_lumps = max_copy_lumps * 2 + 64;
+
+    copy_lumps = (lump_t **)UtilRealloc(copy_lumps,
+        max_copy_lumps * sizeof(lump_t *));
+  }
+
+  copy_lumps[num_copy_lumps++] = lump;
+
+  return NULL;
+}
+
+
+//
+// PlaceLump
+//
+static void PlaceLump(lump_t *lump)
+{
+  lump_t *other = FindSharedLump(lump);
+
+  wad.num_entries++;
+
+  if (other)
+  {
+    lump->new_start = other->new_start;
+    lump->flags |= LUMP_SHARED;
+    return;
+  }
+
+  lump->new_start = wad.dir_start;
+  lump->flags &= ~LUMP_SHARED;
+
+  wad.dir_start += ALIGN_LEN(lump->length);
+}
+
+
 //
 // RecomputeDirectory
 //
@@ -784,10 +847,7 @@ static void RecomputeDirectory(void)
     if (cur->flags & LUMP_IGNORE_ME)
       continue;
 
-    cur->new_start = wad.dir_start;
-
-    wad.dir_start += ALIGN_LEN(cur->length);
-    wad.num_entries++;
+    PlaceLump(cur);
 
     lev = cur->lev_info;
 
@@ -803,13 +863,16 @@ static void RecomputeDirectory(void)
         if (L->flags & LUMP_IGNORE_ME)
           continue;
 
-        L->new_start = wad.dir_start;
-
-        wad.dir_start += ALIGN_LEN(L->length);
-        wad.num_entries++;
+        PlaceLump(L);
       }
     }
   }
+
+  if (copy_lumps)
+    UtilFree(copy_lumps);
+
+  copy_lumps = NULL;
+  num_copy_lumps = max_copy_lumps = 0;
 }
 
 
@@ -831,7 +894,11 @@ static void WriteLumpData(lump_t *lump)
   else
     PrintDebug("Writing... %s (%d)\n", lump->name, lump->length);
 # endif
-  
+
+  // the data was written for an earlier lump
+  if (lump->flags & LUMP_SHARED)
+    return;
+
   if (ftell(out_file) != lump->new_start)
     PrintWarn("Consistency failure writing %s (%08lX, %08X\n", 
       lump->name, ftell(out_file), lump->new_start);
@@ -144,6 +144,9 @@ lump_t;
 /* this lump is new (didn't exist in the original) */
 #define LUMP_NEW           0x0200
 
+/* this lump shares the data of an earlier lump (not written again) */
+#define LUMP_SHARED        0x0400
+
 
 /* ----- function prototypes --------------------- */
 
@@ -0,0 +1,463 @@
+//------------------------------------------------------------------------
+//  BACK-END BENCHMARKS
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  This loads a snapshot (see csg_snap.cc) and runs a single stage
+//  of the back end on it several times, timing just that stage.
+//  Any earlier stages it depends on are run too, but not timed.
+//  The Lua scripts are never involved.
+//
+//  The BSP chunk cache is emptied before each run, since otherwise
+//  every run after the first merely replays the cached chunks.  With
+//  --warm the cache is filled by an untimed run instead, and kept.
+//
+//  On Linux the hardware counters (cycles, instructions, etc) are
+//  also read, when the kernel allows it.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "lib_file.h"
+#include "lib_pak.h"
+#include "lib_thread.h"
+#include "lib_util.h"
+#include "lib_zip.h"
+#include "main.h"
+
+#include "q_common.h"
+#include "q_light.h"
+
+#include "csg_main.h"
+#include "csg_local.h"
+#include "csg_quake.h"
+
+
+extern csg_property_set_c csg_used_props;
+
+
+typedef enum
+{
+	STAGE_BSP = 0,   // CSG_BSP (all games)
+	STAGE_Quake,     // CSG_QUAKE_Build
+	STAGE_TJunc,     // QCOM_Fix_T_Junctions
+	STAGE_Vis,       // QVIS_Visibility  (Quake 1 only)
+	STAGE_Light,     // QLIT_LightAllFaces  (Quake 1 only)
+
+	NUM_STAGES
+}
+bench_stage_e;
+
+static const char * stage_names[NUM_STAGES] =
+{
+	"bsp", "quake", "tjunc", "vis", "light"
+};
+
+
+//------------------------------------------------------------------------
+
+#define NUM_COUNTERS  4
+
+static const char * counter_names[NUM_COUNTERS] =
+{
+	"cycles", "instructions", "cache-misses", "branch-misses"
+};
+
+
+class perf_counters_c
+{
+	// counts events on the calling thread, plus any threads it
+	// creates afterwards (the worker threads already exist).
+
+private:
+	int fds[NUM_COUNTERS];
+
+public:
+	u64_t values[NUM_COUNTERS];
+
+public:
+	perf_counters_c()
+	{
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+		{
+			fds[i] = -1;
+			values[i] = 0;
+		}
+
+#ifdef __linux__
+		static const u64_t configs[NUM_COUNTERS] =
+		{
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+		{
+			struct perf_event_attr attr;
+
+			memset(&attr, 0, sizeof(attr));
+
+			attr.size   = sizeof(attr);
+			attr.type   = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+
+			attr.disabled = 1;
+			attr.inherit  = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv     = 1;
+
+			fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+#endif
+	}
+
+	~perf_counters_c()
+	{
+#ifdef __linux__
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+			if (fds[i] >= 0)
+				close(fds[i]);
+#endif
+	}
+
+	bool Valid(int i) const
+	{
+		return fds[i] >= 0;
+	}
+
+	void Start()
+	{
+#ifdef __linux__
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+		{
+			if (fds[i] < 0)
+				continue;
+
+			ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	void Stop()
+	{
+#ifdef __linux__
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+		{
+			values[i] = 0;
+
+			if (fds[i] < 0)
+				continue;
+
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+			if (read(fds[i], &values[i], sizeof(u64_t)) != sizeof(u64_t))
+				values[i] = 0;
+		}
+#endif
+	}
+};
+
+
+//------------------------------------------------------------------------
+
+class bench_timer_c
+{
+private:
+	std::chrono::steady_clock::time_point start;
+
+	perf_counters_c *counters;
+
+public:
+	double millis;
+
+public:
+	bench_timer_c(perf_counters_c *_counters) :
+		start(), counters(_counters), millis(0)
+	{ }
+
+	~bench_timer_c()
+	{ }
+
+	void Begin()
+	{
+		counters->Start();
+
+		start = std::chrono::steady_clock::now();
+	}
+
+	void End()
+	{
+		std::chrono::steady_clock::time_point finish = std::chrono::steady_clock::now();
+
+		counters->Stop();
+
+		millis = std::chrono::duration<double, std::milli>(finish - start).count();
+	}
+};
+
+
+static int Bench_QuakeGame(const std::string& format)
+{
+	if (format == "quake")  return 1;
+	if (format == "quake2") return 2;
+	if (format == "quake3") return 3;
+
+	return 0;
+}
+
+
+static int Bench_QuakeSubFormat(int game)
+{
+	// only Quake 1 has sub-formats
+	const char *value = csg_used_props.getStr("sub_format");
+
+	if (game != 1 || ! value || StringCaseCmp(value, "quake") == 0)
+		return 0;
+
+	if (StringCaseCmp(value, "hexen2")   == 0) return SUBFMT_Hexen2;
+	if (StringCaseCmp(value, "halflife") == 0) return SUBFMT_HalfLife;
+
+	return -1;
+}
+
+
+static void Bench_RunOnce(int stage, const std::string& format, bench_timer_c& T)
+{
+	if (stage == STAGE_BSP)
+	{
+		T.Begin();
+		CSG_BSP((format == "doom") ? 4.0 : 1.0);
+		T.End();
+
+		CSG_BSP_Free();
+		return;
+	}
+
+	/* the Quake stages */
+
+	BSP_OpenLevel("maps/bench.bsp");
+
+	if (qk_game == 1)
+		Q1_SetLightingMode();
+
+	if (stage == STAGE_Quake) T.Begin();
+	CSG_QUAKE_Build();
+	if (stage == STAGE_Quake) T.End();
+
+	int num_node = 0;
+	int num_leaf = 0;
+
+	CSG_AssignIndexes(qk_bsp_root, &num_node, &num_leaf);
+
+	if (stage == STAGE_TJunc) T.Begin();
+	QCOM_Fix_T_Junctions();
+	if (stage == STAGE_TJunc) T.End();
+
+	if (stage >= STAGE_Vis)
+	{
+		// the lighting is done after vis in the real thing, so the
+		// vis is done here too (it is quick compared to lighting).
+		if (stage == STAGE_Vis) T.Begin();
+		Q1_VisWorld(num_leaf);
+		if (stage == STAGE_Vis) T.End();
+	}
+
+	if (stage == STAGE_Light)
+	{
+		T.Begin();
+		QLIT_LightAllFaces();
+		T.End();
+	}
+
+	// this frees the lightmaps and vis clusters too
+	BSP_CloseLevel();
+
+	CSG_QUAKE_Free();
+	CSG_BSP_Free();
+}
+
+
+int CSG_Benchmark(const char *filename, const char *stage_name, int runs, bool warm)
+{
+	int stage;
+
+	for (stage = 0 ; stage < NUM_STAGES ; stage++)
+		if (StringCaseCmp(stage_names[stage], stage_name) == 0)
+			break;
+
+	if (stage >= NUM_STAGES)
+	{
+		fprintf(stderr, "Unknown stage '%s', should be one of:", stage_name);
+
+		for (int i = 0 ; i < NUM_STAGES ; i++)
+			fprintf(stderr, " %s", stage_names[i]);
+
+		fprintf(stderr, "\n");
+		return 9;
+	}
+
+	if (runs < 1)
+		runs = 1;
+
+	std::string format;
+
+	if (! CSG_LoadSnapshot(filename, format))
+	{
+		fprintf(stderr, "Cannot load snapshot: %s\n", filename);
+		return 3;
+	}
+
+	if (stage != STAGE_BSP)
+	{
+		qk_game = Bench_QuakeGame(format);
+
+		if (qk_game == 0)
+		{
+			fprintf(stderr, "Stage '%s' needs a Quake snapshot (this one is '%s')\n",
+					stage_name, format.c_str());
+			return 9;
+		}
+
+		qk_sub_format = Bench_QuakeSubFormat(qk_game);
+
+		if (qk_sub_format < 0)
+		{
+			fprintf(stderr, "Unknown sub_format '%s' in snapshot\n",
+					csg_used_props.getStr("sub_format"));
+			return 9;
+		}
+
+		// the lump numbers used for vis and lighting are the Quake 1 ones
+		if (stage >= STAGE_Vis && qk_game != 1)
+		{
+			fprintf(stderr, "Stage '%s' only supports Quake 1 snapshots\n", stage_name);
+			return 9;
+		}
+	}
+
+	const char *temp_name = StringPrintf("%s/bench_temp.pak", home_dir);
+
+	if (stage != STAGE_BSP)
+	{
+		if (qk_game == 3)
+			ZIPF_OpenWrite(temp_name);
+		else
+			PAK_OpenWrite(temp_name);
+	}
+
+	printf("Snapshot: %s  (format: %s, %d brushes, %d entities)\n",
+		   filename, format.c_str(), (int)all_brushes.size(), (int)all_entities.size());
+	printf("Stage:    %s  x %d  (threads: %d, cache: %s)\n\n", stage_names[stage], runs,
+		   Thread_Count(), warm ? "warm" : "cold");
+
+	perf_counters_c counters;
+
+	std::vector<double> times;
+
+	// when warm, run #0 only fills the chunk cache and is not timed
+	int first_run = warm ? 0 : 1;
+
+	for (int r = first_run ; r <= runs ; r++)
+	{
+		// the stages consume their input, so reload it every time.
+		// loading sets the properties again, hence lighting ones must
+		// be reset to their defaults beforehand.
+		if (r > first_run || stage != STAGE_BSP)
+		{
+			if (stage != STAGE_BSP)
+				QLIT_InitProperties();
+
+			CSG_LoadSnapshot(filename, format);
+		}
+
+		if (! warm)
+			CSG_BSP_FreeCache();
+
+		bench_timer_c T(&counters);
+
+		Bench_RunOnce(stage, format, T);
+
+		if (r == 0)
+		{
+			CSG_Main_Free();
+			continue;
+		}
+
+		times.push_back(T.millis);
+
+		printf("run %-3d  %10.2f ms", r, T.millis);
+
+		for (int i = 0 ; i < NUM_COUNTERS ; i++)
+			if (counters.Valid(i))
+				printf("  %s=%llu", counter_names[i], (unsigned long long) counters.values[i]);
+
+		if (counters.Valid(0) && counters.Valid(1) && counters.values[0] > 0)
+			printf("  IPC=%1.2f", counters.values[1] / (double) counters.values[0]);
+
+		printf("\n");
+		fflush(stdout);
+
+		CSG_Main_Free();
+	}
+
+	if (stage != STAGE_BSP)
+	{
+		if (qk_game == 3)
+			ZIPF_CloseWrite();
+		else
+			PAK_CloseWrite();
+
+		FileDelete(temp_name);
+	}
+
+	StringFree(temp_name);
+
+	std::sort(times.begin(), times.end());
+
+	double total = 0;
+
+	for (unsigned int i = 0 ; i < times.size() ; i++)
+		total += times[i];
+
+	printf("\nmin %1.2f ms   median %1.2f ms   mean %1.2f ms   max %1.2f ms\n",
+		   times.front(), times[times.size() / 2], total / times.size(), times.back());
+
+	if (! counters.Valid(0))
+		printf("(hardware counters are not available)\n");
+	else if (Thread_Count() > 1)
+		printf("(hardware counters only cover the main thread, use -j 1 for full counts)\n");
+
+	return 0;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -23,7 +23,9 @@
 #include "hdr_lua.h"
 
 #include <algorithm>
+#include <mutex>
 
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "main.h"
 #include "m_lua.h"
@@ -34,11 +36,14 @@
 #include "g_doom.h"		// for MLF_DontDraw
 
 
-double QUANTIZE_GRID;
+// the CSG state is per-thread, so that the Quake clipping hulls
+// can be built at the same time on different threads.
 
-static bool csg_is_clip_hull;
+thread_local double QUANTIZE_GRID;
 
-static std::vector<region_c*> dead_regions;
+static thread_local bool csg_is_clip_hull;
+
+static thread_local std::vector<region_c*> dead_regions;
 
 
 
@@ -706,11 +711,16 @@ void bsp_node_c::AddBBox(region_c *leaf)
 
 /***** VARIABLES ******************/
 
-static std::vector<partition_c *> all_partitions;
+static thread_local std::vector<partition_c *> all_partitions;
+
+thread_local std::vector<region_c *> all_regions;
 
-std::vector<region_c *> all_regions;
+thread_local bsp_node_c * bsp_root;
 
-bsp_node_c * bsp_root;
+// new regions and partitions get added to these lists.  normally they
+// are the global lists, but each chunk split in parallel has its own.
+static thread_local std::vector<region_c *>    * split_regions    = &all_regions;
+static thread_local std::vector<partition_c *> * split_partitions = &all_partitions;
 
 
 //------------------------------------------------------------------------
@@ -1014,7 +1024,7 @@ static void DivideOneRegion(region_c *R, partition_c *part,
 
 	region_c *N = new region_c(*R);
 
-	all_regions.push_back(N);
+	split_regions->push_back(N);
 
 	// iterate over a swapped-out version of the region's snags
 	// (so we can safely add certain ones back into R->snags)
@@ -1097,16 +1107,45 @@ static region_c * MergeGroup(group_c & group)
 
 static partition_c * AddPartition(const snag_c *S)
 {
-	all_partitions.push_back(new partition_c(S));
+	split_partitions->push_back(new partition_c(S));
 
-	return all_partitions.back();
+	return split_partitions->back();
 }
 
 static partition_c * AddPartition(double x1, double y1, double x2, double y2)
 {
-	all_partitions.push_back(new partition_c(x1, y1, x2, y2));
+	split_partitions->push_back(new partition_c(x1, y1, x2, y2));
+
+	return split_partitions->back();
+}
+
+
+static void GetGroupChunks(group_c & group,
+                           double *gx1, double *gy1, double *gx2, double *gy2,
+                           int *sx1, int *sy1, int *sw, int *sh)
+{
+	group.GetGroupBounds(gx1, gy1, gx2, gy2);
+
+	*sx1 = floor(*gx1 / CHUNK_SIZE + SNAG_EPSILON);
+	*sy1 = floor(*gy1 / CHUNK_SIZE + SNAG_EPSILON);
+
+	int sx2 = ceil(*gx2 / CHUNK_SIZE - SNAG_EPSILON);
+	int sy2 = ceil(*gy2 / CHUNK_SIZE - SNAG_EPSILON);
+
+	*sw = sx2 - *sx1;
+	*sh = sy2 - *sy1;
+}
+
+
+static bool GroupIsChunk(group_c & group)
+{
+	double gx1, gy1, gx2, gy2;
+
+	int sx1, sy1, sw, sh;
+
+	GetGroupChunks(group, &gx1, &gy1, &gx2, &gy2, &sx1, &sy1, &sw, &sh);
 
-	return all_partitions.back();
+	return (sw < 2 && sh < 2);
 }
 
 
@@ -1127,15 +1166,9 @@ static partition_c * ChoosePartition(group_c & group, bool *reached_chunk)
 
 		double gx1, gy1, gx2, gy2;
 
-		group.GetGroupBounds(&gx1, &gy1, &gx2, &gy2);
+		int sx1, sy1, sw, sh;
 
-		int sx1 = floor(gx1 / CHUNK_SIZE + SNAG_EPSILON);
-		int sy1 = floor(gy1 / CHUNK_SIZE + SNAG_EPSILON);
-		int sx2 =  ceil(gx2 / CHUNK_SIZE - SNAG_EPSILON);
-		int sy2 =  ceil(gy2 / CHUNK_SIZE - SNAG_EPSILON);
-
-		int sw  = sx2 - sx1;
-		int sh  = sy2 - sy1;
+		GetGroupChunks(group, &gx1, &gy1, &gx2, &gy2, &sx1, &sy1, &sw, &sh);
 
 		// fprintf(stderr, "bounds (%1.5f %1.5f) .. (%1.5f %1.5f)\n", gx1, gy1, gx2, gy2);
 		// fprintf(stderr, " sx/sy (%d,%d) .. (%d,%d) = %dx%d\n",  sx1, sy1, sx2, sy2, sw, sh);
@@ -1208,6 +1241,681 @@ static void DivideOneEntity(csg_entity_c *E, partition_c *part,
 }
 
 
+//------------------------------------------------------------------------
+//   CHUNK CACHE
+//------------------------------------------------------------------------
+
+//
+// When the same level is rebuilt with small tweaks, most chunks of the
+// map end up with exactly the same geometry as before.  Once SplitGroup
+// reaches a chunk, everything below it depends only on the group's
+// regions (their snags and brush lists) and entity positions, so we
+// remember the result per chunk and replay it when the input matches.
+//
+// Brushes, brush sides, entities and partitions are stored as indices
+// relative to the input group, so a cached chunk can be re-used even
+// though all the csg_brush_c objects are new for each build.
+//
+
+bool bsp_chunk_cache = true;
+
+// entries not used during this many CSG_BSP calls are freed
+#define CHUNK_CACHE_AGE  8
+
+
+class cached_snag_c
+{
+public:
+	double x1, y1, x2, y2;
+
+	bool mini;
+
+	int on_node;  // partition slot, -1 for none
+	int region;   // region slot, -1 for none
+
+	// pairs of (brush, vertex) indices
+	std::vector<int> sides;
+};
+
+
+class cached_region_c
+{
+public:
+	bool degenerate;
+
+	std::vector<int> brushes;
+	std::vector<int> entities;
+
+	std::vector<cached_snag_c> snags;
+};
+
+
+class cached_node_c
+{
+public:
+	double x1, y1, x2, y2;
+
+	int front_node, front_leaf;
+	int  back_node,  back_leaf;
+};
+
+
+class chunk_cache_entry_c
+{
+public:
+	// the full input, for verifying a hash match
+	std::string key;
+
+	int last_used;
+
+	// number of threads replaying this entry right now
+	int users;
+
+	// partitions created inside this chunk.  they come after the
+	// input partitions when numbering slots.
+	std::vector<partition_c> new_parts;
+
+	// input regions first, then the new ones (in creation order)
+	std::vector<cached_region_c> regions;
+
+	std::vector<cached_node_c> nodes;
+
+	int root_node;
+	int root_leaf;
+
+public:
+	chunk_cache_entry_c() : key(), last_used(0), users(0), new_parts(), regions(),
+		nodes(), root_node(-1), root_leaf(-1)
+	{ }
+
+	~chunk_cache_entry_c()
+	{ }
+};
+
+
+static std::map<u64_t, chunk_cache_entry_c *> chunk_cache;
+
+static int chunk_cache_serial;
+
+// protects the above when chunks are split in parallel, or when
+// several clipping hulls are being built at once.
+static std::mutex chunk_cache_mutex;
+
+// statistics for the current CSG_BSP call
+static thread_local int chunk_cache_hits;
+static thread_local int chunk_cache_misses;
+
+
+// this maps objects in the input group to indices, in order of their
+// first appearance, and builds the cache key at the same time.
+class chunk_input_c
+{
+public:
+	std::vector<region_c *> regs;
+	std::vector<csg_entity_c *> ents;
+
+	std::vector<csg_brush_c *> brushes;
+	std::vector<partition_c *> parts;
+
+	std::map<const void *, int> lookup;
+
+	std::string key;
+
+public:
+	chunk_input_c() : regs(), ents(), brushes(), parts(), lookup(), key()
+	{ }
+
+	~chunk_input_c()
+	{ }
+
+	void AddRaw(const void *data, size_t len)
+	{
+		key.append((const char *)data, len);
+	}
+
+	void AddInt(int value)
+	{
+		AddRaw(&value, sizeof(value));
+	}
+
+	void AddDouble(double value)
+	{
+		AddRaw(&value, sizeof(value));
+	}
+
+	int BrushIndex(csg_brush_c *B)
+	{
+		std::map<const void *, int>::iterator IT = lookup.find(B);
+
+		if (IT != lookup.end())
+			return IT->second;
+
+		int index = (int)brushes.size();
+
+		brushes.push_back(B);
+		lookup[B] = index;
+
+		return index;
+	}
+
+	int PartIndex(partition_c *P)
+	{
+		if (! P)
+			return -1;
+
+		std::map<const void *, int>::iterator IT = lookup.find(P);
+
+		if (IT != lookup.end())
+			return IT->second;
+
+		int index = (int)parts.size();
+
+		parts.push_back(P);
+		lookup[P] = index;
+
+		return index;
+	}
+
+	int VertIndex(const brush_vert_c *V)
+	{
+		csg_brush_c *B = V->parent;
+
+		for (unsigned int i = 0 ; i < B->verts.size() ; i++)
+			if (B->verts[i] == V)
+				return i;
+
+		return -1;
+	}
+
+	void Build(group_c & group)
+	{
+		regs = group.regs;
+		ents = group.ents;
+
+		AddInt((int)regs.size());
+
+		for (unsigned int i = 0 ; i < regs.size() ; i++)
+		{
+			region_c *R = regs[i];
+
+			AddInt((int)R->brushes.size());
+
+			for (unsigned int b = 0 ; b < R->brushes.size() ; b++)
+				AddInt(BrushIndex(R->brushes[b]));
+
+			AddInt((int)R->snags.size());
+
+			for (unsigned int k = 0 ; k < R->snags.size() ; k++)
+			{
+				snag_c *S = R->snags[k];
+
+				AddDouble(S->x1); AddDouble(S->y1);
+				AddDouble(S->x2); AddDouble(S->y2);
+
+				AddInt(S->mini ? 1 : 0);
+				AddInt(PartIndex(S->on_node));
+
+				AddInt((int)S->sides.size());
+
+				for (unsigned int n = 0 ; n < S->sides.size() ; n++)
+				{
+					AddInt(BrushIndex(S->sides[n]->parent));
+					AddInt(VertIndex(S->sides[n]));
+				}
+			}
+		}
+
+		// vertex indices are only valid for the same vertex counts
+		AddInt((int)brushes.size());
+
+		for (unsigned int b = 0 ; b < brushes.size() ; b++)
+			AddInt((int)brushes[b]->verts.size());
+
+		AddInt((int)ents.size());
+
+		for (unsigned int e = 0 ; e < ents.size() ; e++)
+		{
+			AddDouble(ents[e]->x);
+			AddDouble(ents[e]->y);
+		}
+	}
+
+	u64_t Hash() const
+	{
+		// FNV-1a
+		u64_t hash = 0xcbf29ce484222325ULL;
+
+		for (size_t i = 0 ; i < key.size() ; i++)
+		{
+			hash ^= (u8_t)key[i];
+			hash *= 0x100000001b3ULL;
+		}
+
+		return hash;
+	}
+};
+
+
+static void SplitGroup(group_c & group, bool reached_chunk,
+                       region_c ** leaf_out, bsp_node_c ** node_out);
+
+
+static void ChunkCache_Free()
+{
+	std::map<u64_t, chunk_cache_entry_c *>::iterator IT;
+
+	for (IT = chunk_cache.begin() ; IT != chunk_cache.end() ; IT++)
+		delete IT->second;
+
+	chunk_cache.clear();
+}
+
+
+static void ChunkCache_Expire()
+{
+	std::map<u64_t, chunk_cache_entry_c *>::iterator IT, NEXT;
+
+	for (IT = chunk_cache.begin() ; IT != chunk_cache.end() ; IT = NEXT)
+	{
+		NEXT = IT; NEXT++;
+
+		if (IT->second->users > 0)
+			continue;
+
+		if (IT->second->last_used + CHUNK_CACHE_AGE < chunk_cache_serial)
+		{
+			delete IT->second;
+			chunk_cache.erase(IT);
+		}
+	}
+}
+
+
+static int ChunkCache_NodeRef(chunk_cache_entry_c *E, bsp_node_c *node,
+                              std::map<const void *, int> & reg_slots);
+
+static bool ChunkCache_LeafRef(region_c *leaf, int *ref,
+                               std::map<const void *, int> & reg_slots)
+{
+	*ref = -1;
+
+	if (! leaf)
+		return true;
+
+	std::map<const void *, int>::iterator IT = reg_slots.find(leaf);
+
+	if (IT == reg_slots.end())
+		return false;
+
+	*ref = IT->second;
+	return true;
+}
+
+
+static int ChunkCache_NodeRef(chunk_cache_entry_c *E, bsp_node_c *node,
+                              std::map<const void *, int> & reg_slots)
+{
+	// returns -1 for no node, -2 on failure
+
+	if (! node)
+		return -1;
+
+	cached_node_c CN;
+
+	CN.x1 = node->x1; CN.y1 = node->y1;
+	CN.x2 = node->x2; CN.y2 = node->y2;
+
+	if (! ChunkCache_LeafRef(node->front_leaf, &CN.front_leaf, reg_slots) ||
+		! ChunkCache_LeafRef(node-> back_leaf, &CN. back_leaf, reg_slots))
+		return -2;
+
+	CN.front_node = ChunkCache_NodeRef(E, node->front_node, reg_slots);
+	CN. back_node = ChunkCache_NodeRef(E, node-> back_node, reg_slots);
+
+	if (CN.front_node == -2 || CN.back_node == -2)
+		return -2;
+
+	E->nodes.push_back(CN);
+
+	return (int)E->nodes.size() - 1;
+}
+
+
+static chunk_cache_entry_c * ChunkCache_Record(chunk_input_c & input,
+		unsigned int first_region, unsigned int first_part,
+		region_c *leaf, bsp_node_c *node)
+{
+	chunk_cache_entry_c *E = new chunk_cache_entry_c;
+
+	std::vector<region_c *> slots(input.regs);
+
+	for (unsigned int i = first_region ; i < split_regions->size() ; i++)
+		slots.push_back((*split_regions)[i]);
+
+	std::map<const void *, int> reg_slots;
+	std::map<const void *, int> part_slots;
+	std::map<const void *, int> ent_slots;
+
+	for (unsigned int i = 0 ; i < slots.size() ; i++)
+		reg_slots[slots[i]] = (int)i;
+
+	for (unsigned int i = 0 ; i < input.parts.size() ; i++)
+		part_slots[input.parts[i]] = (int)i;
+
+	for (unsigned int i = first_part ; i < split_partitions->size() ; i++)
+	{
+		partition_c *P = (*split_partitions)[i];
+
+		part_slots[P] = (int)(input.parts.size() + E->new_parts.size());
+
+		E->new_parts.push_back(*P);
+	}
+
+	for (unsigned int i = 0 ; i < input.ents.size() ; i++)
+		ent_slots[input.ents[i]] = (int)i;
+
+	std::map<const void *, int>::iterator IT;
+
+	for (unsigned int i = 0 ; i < slots.size() ; i++)
+	{
+		region_c *R = slots[i];
+
+		E->regions.push_back(cached_region_c());
+
+		cached_region_c & CR = E->regions.back();
+
+		CR.degenerate = R->degenerate;
+
+		for (unsigned int b = 0 ; b < R->brushes.size() ; b++)
+		{
+			IT = input.lookup.find(R->brushes[b]);
+
+			if (IT == input.lookup.end())
+				goto failed;
+
+			CR.brushes.push_back(IT->second);
+		}
+
+		for (unsigned int e = 0 ; e < R->entities.size() ; e++)
+		{
+			IT = ent_slots.find(R->entities[e]);
+
+			if (IT == ent_slots.end())
+				goto failed;
+
+			CR.entities.push_back(IT->second);
+		}
+
+		for (unsigned int k = 0 ; k < R->snags.size() ; k++)
+		{
+			snag_c *S = R->snags[k];
+
+			CR.snags.push_back(cached_snag_c());
+
+			cached_snag_c & CS = CR.snags.back();
+
+			CS.x1 = S->x1; CS.y1 = S->y1;
+			CS.x2 = S->x2; CS.y2 = S->y2;
+
+			CS.mini    = S->mini;
+			CS.on_node = -1;
+			CS.region  = -1;
+
+			if (S->on_node)
+			{
+				IT = part_slots.find(S->on_node);
+
+				if (IT == part_slots.end())
+					goto failed;
+
+				CS.on_node = IT->second;
+			}
+
+			if (S->region)
+			{
+				IT = reg_slots.find(S->region);
+
+				if (IT == reg_slots.end())
+					goto failed;
+
+				CS.region = IT->second;
+			}
+
+			for (unsigned int n = 0 ; n < S->sides.size() ; n++)
+			{
+				IT = input.lookup.find(S->sides[n]->parent);
+
+				if (IT == input.lookup.end())
+					goto failed;
+
+				CS.sides.push_back(IT->second);
+				CS.sides.push_back(input.VertIndex(S->sides[n]));
+			}
+		}
+	}
+
+	if (! ChunkCache_LeafRef(leaf, &E->root_leaf, reg_slots))
+		goto failed;
+
+	E->root_node = ChunkCache_NodeRef(E, node, reg_slots);
+
+	if (E->root_node == -2)
+		goto failed;
+
+	return E;
+
+failed:
+	// something referenced outside of the chunk -- cannot cache it
+	delete E;
+	return NULL;
+}
+
+
+static bsp_node_c * ChunkCache_MakeNode(chunk_cache_entry_c *E, int ref,
+                                        std::vector<region_c *> & slots)
+{
+	if (ref < 0)
+		return NULL;
+
+	const cached_node_c & CN = E->nodes[ref];
+
+	bsp_node_c *node = new bsp_node_c(CN.x1, CN.y1, CN.x2, CN.y2);
+
+	node->front_leaf = (CN.front_leaf < 0) ? NULL : slots[CN.front_leaf];
+	node-> back_leaf = (CN. back_leaf < 0) ? NULL : slots[CN. back_leaf];
+
+	node->front_node = ChunkCache_MakeNode(E, CN.front_node, slots);
+	node-> back_node = ChunkCache_MakeNode(E, CN. back_node, slots);
+
+	return node;
+}
+
+
+static void ChunkCache_Replay(chunk_cache_entry_c *E, chunk_input_c & input,
+                              region_c ** leaf_out, bsp_node_c ** node_out)
+{
+	std::vector<region_c *> slots(input.regs);
+	std::vector<partition_c *> parts(input.parts);
+
+	for (unsigned int i = 0 ; i < E->new_parts.size() ; i++)
+	{
+		const partition_c & P = E->new_parts[i];
+
+		parts.push_back(AddPartition(P.x1, P.y1, P.x2, P.y2));
+	}
+
+	for (unsigned int i = input.regs.size() ; i < E->regions.size() ; i++)
+	{
+		region_c *N = new region_c;
+
+		split_regions->push_back(N);
+
+		slots.push_back(N);
+	}
+
+	// throw away the old snags, they are replaced by the cached ones
+	for (unsigned int i = 0 ; i < input.regs.size() ; i++)
+	{
+		region_c *R = input.regs[i];
+
+		for (unsigned int k = 0 ; k < R->snags.size() ; k++)
+			delete R->snags[k];
+
+		R->snags.clear();
+		R->brushes.clear();
+	}
+
+	for (unsigned int i = 0 ; i < E->regions.size() ; i++)
+	{
+		const cached_region_c & CR = E->regions[i];
+
+		region_c *R = slots[i];
+
+		R->degenerate = CR.degenerate;
+
+		for (unsigned int b = 0 ; b < CR.brushes.size() ; b++)
+			R->AddBrush(input.brushes[CR.brushes[b]]);
+
+		for (unsigned int e = 0 ; e < CR.entities.size() ; e++)
+			R->entities.push_back(input.ents[CR.entities[e]]);
+
+		for (unsigned int k = 0 ; k < CR.snags.size() ; k++)
+		{
+			const cached_snag_c & CS = CR.snags[k];
+
+			partition_c *part = (CS.on_node < 0) ? NULL : parts[CS.on_node];
+
+			snag_c *S = new snag_c(CS.x1, CS.y1, CS.x2, CS.y2, part);
+
+			S->mini   = CS.mini;
+			S->region = (CS.region < 0) ? NULL : slots[CS.region];
+
+			for (unsigned int n = 0 ; n < CS.sides.size() ; n += 2)
+			{
+				csg_brush_c *B = input.brushes[CS.sides[n]];
+
+				S->sides.push_back(B->verts[CS.sides[n+1]]);
+			}
+
+			R->AddSnag(S);
+		}
+	}
+
+	*leaf_out = (E->root_leaf < 0) ? NULL : slots[E->root_leaf];
+	*node_out = ChunkCache_MakeNode(E, E->root_node, slots);
+}
+
+
+static void SplitChunk(group_c & group, region_c ** leaf_out, bsp_node_c ** node_out)
+{
+	if (! bsp_chunk_cache)
+	{
+		SplitGroup(group, true /* reached_chunk */, leaf_out, node_out);
+		return;
+	}
+
+	chunk_input_c input;
+
+	input.Build(group);
+
+	u64_t hash = input.Hash();
+
+	chunk_cache_entry_c *E = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(chunk_cache_mutex);
+
+		std::map<u64_t, chunk_cache_entry_c *>::iterator IT = chunk_cache.find(hash);
+
+		if (IT != chunk_cache.end() && IT->second->key == input.key)
+		{
+			E = IT->second;
+			E->last_used = chunk_cache_serial;
+			E->users++;
+
+			chunk_cache_hits++;
+		}
+		else
+			chunk_cache_misses++;
+	}
+
+	// entries are never modified once stored (except 'last_used' and
+	// 'users'), hence the replay can happen outside of the lock.
+	if (E)
+	{
+		ChunkCache_Replay(E, input, leaf_out, node_out);
+
+		std::lock_guard<std::mutex> lock(chunk_cache_mutex);
+
+		E->users--;
+		return;
+	}
+
+	unsigned int first_region = split_regions->size();
+	unsigned int first_part   = split_partitions->size();
+
+	SplitGroup(group, true /* reached_chunk */, leaf_out, node_out);
+
+	E = ChunkCache_Record(input, first_region, first_part, *leaf_out, *node_out);
+	if (! E)
+		return;
+
+	E->key.swap(input.key);
+
+	std::lock_guard<std::mutex> lock(chunk_cache_mutex);
+
+	E->last_used = chunk_cache_serial;
+
+	std::map<u64_t, chunk_cache_entry_c *>::iterator IT = chunk_cache.find(hash);
+
+	if (IT == chunk_cache.end())
+	{
+		chunk_cache[hash] = E;
+	}
+	else if (IT->second->users == 0 && IT->second->last_used < chunk_cache_serial)
+	{
+		// replace a stale entry (a hash collision).  one which is
+		// getting replayed right now must be kept.
+		delete IT->second;
+		IT->second = E;
+	}
+	else
+	{
+		delete E;
+	}
+}
+
+
+static void JoinSplit(partition_c *part,
+                      region_c *front_leaf, bsp_node_c *front_node,
+                      region_c * back_leaf, bsp_node_c * back_node,
+                      region_c ** leaf_out, bsp_node_c ** node_out)
+{
+	// don't create a node unless there is something on both sides
+	if (! (front_leaf || front_node))
+	{
+		*leaf_out = back_leaf;
+		*node_out = back_node;
+	}
+	else if (! (back_leaf || back_node))
+	{
+		*leaf_out = front_leaf;
+		*node_out = front_node;
+	}
+	else
+	{
+		bsp_node_c *node = new bsp_node_c(part->x1, part->y1, part->x2, part->y2);
+
+		node->front_leaf = front_leaf;
+		node->front_node = front_node;
+		node-> back_leaf =  back_leaf;
+		node-> back_node =  back_node;
+
+		*node_out = node;
+	}
+}
+
+
 static void SplitGroup(group_c & group, bool reached_chunk,
                        region_c ** leaf_out, bsp_node_c ** node_out)
 {
@@ -1229,6 +1937,12 @@ static void SplitGroup(group_c & group, bool reached_chunk,
 	//       region will usually be "split" multiple times where everything
 	//       goes to the front and nothing to the back.
 	//
+	if (! reached_chunk && GroupIsChunk(group))
+	{
+		SplitChunk(group, leaf_out, node_out);
+		return;
+	}
+
 	partition_c *part = ChoosePartition(group, &reached_chunk);
 
 	if (part)
@@ -1256,28 +1970,8 @@ static void SplitGroup(group_c & group, bool reached_chunk,
 		SplitGroup(front, reached_chunk, &front_leaf, &front_node);
 		SplitGroup(back,  reached_chunk, & back_leaf, & back_node);
 
-		// don't create a node unless there is something on both sides
-		if (! (front_leaf || front_node))
-		{
-			*leaf_out = back_leaf;
-			*node_out = back_node;
-		}
-		else if (! (back_leaf || back_node))
-		{
-			*leaf_out = front_leaf;
-			*node_out = front_node;
-		}
-		else
-		{
-			bsp_node_c *node = new bsp_node_c(part->x1, part->y1, part->x2, part->y2);
-
-			node->front_leaf = front_leaf;
-			node->front_node = front_node;
-			node-> back_leaf =  back_leaf;
-			node-> back_node =  back_node;
-
-			*node_out = node;
-		}
+		JoinSplit(part, front_leaf, front_node, back_leaf, back_node,
+		          leaf_out, node_out);
 
 		// input group has been consumed now 
 	}
@@ -1291,6 +1985,225 @@ static void SplitGroup(group_c & group, bool reached_chunk,
 }
 
 
+//------------------------------------------------------------------------
+//   PARALLEL SPLITTING
+//------------------------------------------------------------------------
+
+//
+// Below the chunk level, the subtrees produced by SplitGroup() are
+// completely independent.  So we first do the seed-wise subdivision
+// serially, remembering each chunk as a job, then split all the chunks
+// using the worker threads, and finally build the nodes above them.
+//
+// Each job collects its new regions and partitions in its own lists.
+// The regions get spliced into all_regions at the place where the
+// serial code would have added them, hence the result is identical.
+// The partitions are simply appended to all_partitions, since that
+// list is only used to free them.
+//
+
+class chunk_job_c
+{
+public:
+	group_c group;
+
+	// where the new regions belong in all_regions
+	unsigned int region_pos;
+
+	std::vector<region_c *>    new_regions;
+	std::vector<partition_c *> new_parts;
+
+	region_c   *leaf;
+	bsp_node_c *node;
+
+	int cache_hits;
+	int cache_misses;
+
+public:
+	chunk_job_c() : group(), region_pos(0), new_regions(), new_parts(),
+		leaf(NULL), node(NULL), cache_hits(0), cache_misses(0)
+	{ }
+
+	~chunk_job_c()
+	{ }
+};
+
+
+class split_tree_c
+{
+public:
+	partition_c *part;
+
+	split_tree_c *front;
+	split_tree_c *back;
+
+	// non-NULL when this is a chunk
+	chunk_job_c *job;
+
+public:
+	split_tree_c() : part(NULL), front(NULL), back(NULL), job(NULL)
+	{ }
+
+	~split_tree_c()
+	{
+		delete front;
+		delete back;
+	}
+};
+
+
+static split_tree_c * CollectChunks(group_c & group, std::vector<chunk_job_c *> & jobs)
+{
+	if (group.regs.empty())
+	{
+		if (! group.ents.empty())
+		{
+			DebugPrintf("SplitGroup: lost %u entities\n", group.ents.size());
+		}
+
+		return NULL;
+	}
+
+	split_tree_c *T = new split_tree_c;
+
+	if (GroupIsChunk(group))
+	{
+		T->job = new chunk_job_c;
+
+		std::swap(T->job->group.regs, group.regs);
+		std::swap(T->job->group.ents, group.ents);
+
+		T->job->region_pos = all_regions.size();
+
+		jobs.push_back(T->job);
+		return T;
+	}
+
+	bool reached_chunk = false;
+
+	T->part = ChoosePartition(group, &reached_chunk);
+
+	SYS_ASSERT(T->part);
+	SYS_ASSERT(! reached_chunk);
+
+	group_c front;
+	group_c back;
+
+	for (unsigned int i = 0 ; i < group.regs.size() ; i++)
+		DivideOneRegion(group.regs[i], T->part, front, back);
+
+	for (unsigned int k = 0 ; k < group.ents.size() ; k++)
+		DivideOneEntity(group.ents[k], T->part, front, back);
+
+	T->front = CollectChunks(front, jobs);
+	T->back  = CollectChunks(back,  jobs);
+
+	return T;
+}
+
+
+static void SplitChunkJob(int index, void *priv_dat)
+{
+	std::vector<chunk_job_c *> *jobs = (std::vector<chunk_job_c *> *) priv_dat;
+
+	chunk_job_c *job = (*jobs)[index];
+
+	// the calling thread runs jobs too, so keep its statistics
+	int old_hits   = chunk_cache_hits;
+	int old_misses = chunk_cache_misses;
+
+	split_regions    = &job->new_regions;
+	split_partitions = &job->new_parts;
+
+	SplitChunk(job->group, &job->leaf, &job->node);
+
+	split_regions    = &all_regions;
+	split_partitions = &all_partitions;
+
+	job->cache_hits   = chunk_cache_hits   - old_hits;
+	job->cache_misses = chunk_cache_misses - old_misses;
+
+	chunk_cache_hits   = old_hits;
+	chunk_cache_misses = old_misses;
+}
+
+
+static void AssembleTree(split_tree_c *T, region_c ** leaf_out, bsp_node_c ** node_out)
+{
+	*leaf_out = NULL;
+	*node_out = NULL;
+
+	if (! T)
+		return;
+
+	if (T->job)
+	{
+		*leaf_out = T->job->leaf;
+		*node_out = T->job->node;
+		return;
+	}
+
+	region_c *front_leaf;
+	region_c * back_leaf;
+
+	bsp_node_c *front_node;
+	bsp_node_c * back_node;
+
+	AssembleTree(T->front, &front_leaf, &front_node);
+	AssembleTree(T->back,  & back_leaf, & back_node);
+
+	JoinSplit(T->part, front_leaf, front_node, back_leaf, back_node,
+	          leaf_out, node_out);
+}
+
+
+static void SpliceChunkLists(std::vector<chunk_job_c *> & jobs)
+{
+	std::vector<region_c *> old_list;
+
+	std::swap(all_regions, old_list);
+
+	unsigned int pos = 0;
+
+	for (unsigned int j = 0 ; j < jobs.size() ; j++)
+	{
+		chunk_job_c *job = jobs[j];
+
+		for ( ; pos < job->region_pos ; pos++)
+			all_regions.push_back(old_list[pos]);
+
+		all_regions.insert(all_regions.end(), job->new_regions.begin(), job->new_regions.end());
+
+		all_partitions.insert(all_partitions.end(), job->new_parts.begin(), job->new_parts.end());
+
+		chunk_cache_hits   += job->cache_hits;
+		chunk_cache_misses += job->cache_misses;
+	}
+
+	for ( ; pos < old_list.size() ; pos++)
+		all_regions.push_back(old_list[pos]);
+}
+
+
+static void SplitGroupParallel(group_c & root, region_c ** leaf_out, bsp_node_c ** node_out)
+{
+	std::vector<chunk_job_c *> jobs;
+
+	split_tree_c *tree = CollectChunks(root, jobs);
+
+	Thread_ParallelFor((int)jobs.size(), SplitChunkJob, &jobs);
+
+	SpliceChunkLists(jobs);
+
+	AssembleTree(tree, leaf_out, node_out);
+
+	delete tree;
+
+	for (unsigned int j = 0 ; j < jobs.size() ; j++)
+		delete jobs[j];
+}
+
+
 //------------------------------------------------------------------------
 
 static void MergeSnags(snag_c *A, snag_c *B)
@@ -1729,7 +2642,10 @@ static gap_c *GapForEntity(const region_c *R, csg_entity_c *E)
 
 		if (z1 < E->z && E->z < z2)
 		{
-			E->ex_floor = (int)i;
+			// entities are shared by the clipping hulls (which can be
+			// built in parallel), so only the real map sets this.
+			if (! csg_is_clip_hull)
+				E->ex_floor = (int)i;
 
 			return G;
 		}
@@ -2097,7 +3013,27 @@ void CSG_BSP(double grid, bool is_clip_hull)
 
 	region_c * bsp_leaf;
 
-	SplitGroup(root, false /* reached_chunk */, &bsp_leaf, &bsp_root);
+	chunk_cache_hits   = 0;
+	chunk_cache_misses = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(chunk_cache_mutex);
+
+		chunk_cache_serial++;
+
+		if (bsp_chunk_cache)
+			ChunkCache_Expire();
+		else
+			ChunkCache_Free();
+	}
+
+	if (Thread_Count() > 1)
+		SplitGroupParallel(root, &bsp_leaf, &bsp_root);
+	else
+		SplitGroup(root, false /* reached_chunk */, &bsp_leaf, &bsp_root);
+
+	if (bsp_chunk_cache)
+		LogPrintf("Chunk cache: %d hits, %d misses\n", chunk_cache_hits, chunk_cache_misses);
 
 	// all valid maps will get a root node -- this is only for sanity
 	if (! bsp_root)
@@ -2165,6 +3101,14 @@ void CSG_BSP_Free()
 }
 
 
+void CSG_BSP_FreeCache()
+{
+	std::lock_guard<std::mutex> lock(chunk_cache_mutex);
+
+	ChunkCache_Free();
+}
+
+
 //------------------------------------------------------------------------
 //   TESTING GOODIES
 //------------------------------------------------------------------------
@@ -24,6 +24,7 @@
 #include "hdr_ui.h"
 
 #include "lib_file.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 
 #include "main.h"
@@ -427,9 +428,7 @@ public:
 
 
 
-static std::vector<csg_brush_c *> saved_all_brushes;
-
-static std::vector<clip_side_c *> all_clip_sides;
+static thread_local std::vector<csg_brush_c *> saved_all_brushes;
 
 
 //------------------------------------------------------------------------
@@ -666,11 +665,12 @@ static void AdjustSlope(slope_info_c *slope, double pad_w, bool is_ceil)
 #endif
 
 
-static void FattenBrushes(double pad_w, double pad_t, double pad_b)
+static void FattenBrushes(const std::vector<csg_brush_c *> & source,
+                          double pad_w, double pad_t, double pad_b)
 {
-	for (unsigned int i = 0; i < saved_all_brushes.size(); i++)
+	for (unsigned int i = 0; i < source.size(); i++)
 	{
-		csg_brush_c *P = saved_all_brushes[i];
+		csg_brush_c *P = source[i];
 
 		if (P->bkind != BKIND_Solid)
 			continue;
@@ -1153,7 +1153,7 @@ void CLIP_BEGIN()
 {
 	SaveBrushes();
 
-	FattenBrushes(16, 24, 32);
+	FattenBrushes(saved_all_brushes, 16, 24, 32);
 }
 
 void CLIP_END()
@@ -1163,14 +1163,14 @@ void CLIP_END()
 #endif
 
 
-static void Q1_ClipWorld(int hull, double *pads)
+static clip_node_c * Q1_BuildClipHull(const std::vector<csg_brush_c *> & source,
+                                      double *pads)
 {
-	qk_world_model->nodes[hull] = q1_total_clip;
-
+	// the caller has saved the real brushes (via SaveBrushes).
+	// only the CSG state of the current thread is used here, hence
+	// different hulls can be built at the same time.
 
-	SaveBrushes();
-
-	FattenBrushes(pads[0], pads[1], pads[2]);
+	FattenBrushes(source, pads[0], pads[1], pads[2]);
 
 	CSG_BSP(0.5, true /* is_clip_hull */);
 
@@ -1181,8 +1181,13 @@ static void Q1_ClipWorld(int hull, double *pads)
 
 	CreateClipSides(GROUP);
 
-	clip_node_c * ROOT = PartitionGroup(GROUP);
+	return PartitionGroup(GROUP);
+}
+
 
+static void Q1_ClipWorld(int hull, clip_node_c *ROOT)
+{
+	qk_world_model->nodes[hull] = q1_total_clip;
 
 	int cur_index = q1_total_clip;
 
@@ -1192,9 +1197,6 @@ static void Q1_ClipWorld(int hull, double *pads)
 
 	// this deletes the entire BSP tree (nodes and leafs)
 	delete ROOT;
-
-
-	RestoreBrushes();
 }
 
 
@@ -1240,16 +1242,117 @@ static void Q1_ClipMapModel(quake_mapmodel_c *model, int hull,
 }
 
 
-void Q1_ClippingHull(int hull)
+static int Q1_NumClipHulls()
+{
+	if (qk_sub_format == SUBFMT_HalfLife) return 3;
+	if (qk_sub_format == SUBFMT_Hexen2)   return 5;
+
+	return 2;
+}
+
+
+static double * Q1_HullPads(int hull)
+{
+	if (qk_sub_format == SUBFMT_Hexen2)
+		return H2_hull_sizes[hull-1];
+	else if (qk_sub_format == SUBFMT_HalfLife)
+		return HL_hull_sizes[hull-1];
+	else
+		return Q1_hull_sizes[hull-1];
+}
+
+
+static void Q1_WriteClipHull(int hull, clip_node_c *ROOT)
+{
+	double *pads = Q1_HullPads(hull);
+
+	// first clip the world, then the map-models
+
+	Q1_ClipWorld(hull, ROOT);
+
+	for (unsigned int m = 0 ; m < qk_all_mapmodels.size() ; m++)
+	{
+		Q1_ClipMapModel(qk_all_mapmodels[m], hull,
+				pads[0], pads[1], pads[2]);
+	}
+
+	if (q1_total_clip >= MAX_MAP_CLIPNODES)
+		Main_FatalError("Quake build failure: exceeded limit of %d CLIPNODES\n",
+				MAX_MAP_CLIPNODES);
+}
+
+
+//------------------------------------------------------------------------
+
+//
+// Each hull only needs the original brushes (which are not modified)
+// and its own CSG state, so all the hulls can be built in parallel.
+// Writing the clip nodes uses the shared plane list and must follow
+// the hull order, so that part is done afterwards by the main thread,
+// giving exactly the same output as building them one at a time.
+//
+
+class clip_hull_work_c
+{
+public:
+	std::vector<csg_brush_c *> source;
+
+	std::vector<clip_node_c *> roots;
+
+public:
+	clip_hull_work_c() : source(), roots()
+	{ }
+
+	~clip_hull_work_c()
+	{ }
+};
+
+
+static void Q1_ClipHullJob(int index, void *priv_dat)
+{
+	clip_hull_work_c *work = (clip_hull_work_c *) priv_dat;
+
+	int hull = 1 + index;
+
+	SaveBrushes();
+
+	work->roots[index] = Q1_BuildClipHull(work->source, Q1_HullPads(hull));
+
+	RestoreBrushes();
+
+	// free the regions (etc) while still on the same thread
+	CSG_BSP_Free();
+}
+
+
+static void Q1_ParallelHulls(int num_hulls)
 {
-	int clip_hulls = 2;
+	LogPrintf("\nClipping Hulls 1-%d (%d threads)...\n", num_hulls, Thread_Count());
+
+	clip_hull_work_c work;
+
+	// the jobs cannot use all_brushes directly, since it is swapped
+	// out by SaveBrushes() when the main thread runs a job.
+	work.source = all_brushes;
+	work.roots.resize(num_hulls, NULL);
+
+	Thread_ParallelFor(num_hulls, Q1_ClipHullJob, &work);
+
+	for (int hull = 1 ; hull <= num_hulls ; hull++)
+	{
+		if (main_win)
+			main_win->build_box->Prog_Step("Hull");
+
+		Q1_WriteClipHull(hull, work.roots[hull-1]);
+	}
+}
 
-	if (qk_sub_format == SUBFMT_HalfLife) clip_hulls = 3;
-	if (qk_sub_format == SUBFMT_Hexen2)   clip_hulls = 5;
 
+static void Q1_ClippingHull(int hull)
+{
 	SYS_ASSERT(hull >= 1);
 
-	if (hull > clip_hulls)
+	if (hull > Q1_NumClipHulls())
 		return;
 
 	if (main_action >= MAIN_CANCEL)
@@ -1265,29 +1368,33 @@ void Q1_ClippingHull(int hull)
 	///???  FreeAll();
 
 
-	double *pads;
+	SaveBrushes();
 
-	if (qk_sub_format == SUBFMT_Hexen2)
-		pads = H2_hull_sizes[hull-1];
-	else if (qk_sub_format == SUBFMT_HalfLife)
-		pads = HL_hull_sizes[hull-1];
-	else
-		pads = Q1_hull_sizes[hull-1];
+	clip_node_c *ROOT = Q1_BuildClipHull(saved_all_brushes, Q1_HullPads(hull));
 
+	RestoreBrushes();
 
-	// first clip the world, then the map-models
+	Q1_WriteClipHull(hull, ROOT);
+}
 
-	Q1_ClipWorld(hull, pads);
 
-	for (unsigned int m = 0 ; m < qk_all_mapmodels.size() ; m++)
+void Q1_ClippingHulls()
+{
+	int num_hulls = Q1_NumClipHulls();
+
+	if (Thread_Count() > 1)
 	{
-		Q1_ClipMapModel(qk_all_mapmodels[m], hull,
-				pads[0], pads[1], pads[2]);
+		if (main_action >= MAIN_CANCEL)
+			return;
+
+		Q1_ParallelHulls(num_hulls);
+		return;
 	}
 
-	if (q1_total_clip >= MAX_MAP_CLIPNODES)
-		Main_FatalError("Quake build failure: exceeded limit of %d CLIPNODES\n",
-				MAX_MAP_CLIPNODES);
+	for (int hull = 1 ; hull <= num_hulls ; hull++)
+	{
+		Q1_ClippingHull(hull);
+	}
 }
 
 //--- editor settings ---
@@ -769,7 +769,30 @@ static std::vector<dummy_sector_c *> dm_dummies;
 static std::vector<extrafloor_c *>   dm_exfloors;
 static std::vector<fs_thing_t>       dm_fs_things;
 
-static std::map<int, unsigned int>   dm_vertex_map;
+
+// open-addressing hash table for finding vertices by coordinate.
+// the size is always a power of two, and kept at most half full.
+typedef struct
+{
+	u64_t key;
+	int   index;  // -1 when slot is empty
+
+} dm_vertex_slot_t;
+
+static std::vector<dm_vertex_slot_t> dm_vertex_hash;
+static unsigned int dm_vertex_hash_used;
+
+// uniform grid of vertices, used while rounding corners to find the
+// vertices near a corner.  each cell lists the vertex indices inside
+// it (coordinates outside the grid are clamped to the border cells).
+// vertices never move, and dud vertices remain in the grid (they are
+// skipped by the queries), hence it stays valid while lines merge.
+#define DM_GRID_SIZE  64
+
+static std::vector< std::vector<int> > dm_vertex_grid;
+
+static int dm_grid_x, dm_grid_y;
+static int dm_grid_W, dm_grid_H;
 
 
 //------------------------------------------------------------------------
@@ -1108,9 +1131,52 @@ static void DM_GrabNeighborFloors()
 }
 
 
-static int DM_CoalescePass()
+// disjoint-set forest over sector indices, used to coalesce sectors.
+// each entry is the parent index, roots point at themselves.
+static std::vector<int> dm_sector_parent;
+
+
+static int DM_SectorRoot(int idx)
+{
+	// find the root, using path halving to keep the trees flat
+	while (dm_sector_parent[idx] != idx)
+	{
+		dm_sector_parent[idx] = dm_sector_parent[dm_sector_parent[idx]];
+
+		idx = dm_sector_parent[idx];
+	}
+
+	return idx;
+}
+
+
+static void DM_SectorUnion(int a, int b)
+{
+	a = DM_SectorRoot(a);
+	b = DM_SectorRoot(b);
+
+	if (a == b)
+		return;
+
+	// the lowest index always becomes the root, since that is the
+	// sector which the old iterative method would end up keeping.
+	if (a < b)
+		dm_sector_parent[b] = a;
+	else
+		dm_sector_parent[a] = b;
+}
+
+
+static void DM_CoalesceSectors()
 {
-	int changes = 0;
+	// the merge test is an equivalence relation, hence every group of
+	// touching (and matching) sectors gets merged into a single one,
+	// which we can compute in one sweep over the regions.
+
+	dm_sector_parent.resize(dm_sectors.size());
+
+	for (unsigned int i = 0 ; i < dm_sectors.size() ; i++)
+		dm_sector_parent[i] = (int)i;
 
 	for (unsigned int i = 0 ; i < all_regions.size() ; i++)
 	{
@@ -1137,28 +1203,32 @@ static int DM_CoalescePass()
 			doom_sector_c *D2 = dm_sectors[N->index];
 
 			if (D2->ShouldMerge(D1))
-			{
-				D2->MarkUnused();
+				DM_SectorUnion(R->index, N->index);
+		}
+	}
 
-				N->index = R->index;
+	// propagate the cave flag to the surviving sectors
+	for (unsigned int i = 0 ; i < dm_sectors.size() ; i++)
+	{
+		int root = DM_SectorRoot((int)i);
 
-				D1->is_cave |= D2->is_cave;
+		if (root != (int)i)
+		{
+			dm_sectors[root]->is_cave |= dm_sectors[i]->is_cave;
 
-				changes++;
-			}
+			dm_sectors[i]->MarkUnused();
 		}
 	}
 
-	// fprintf(stderr, "DM_CoalescePass  changes:%d\n", changes);
-
-	return changes;
-}
+	for (unsigned int i = 0 ; i < all_regions.size() ; i++)
+	{
+		region_c *R = all_regions[i];
 
+		if (R->index >= 0)
+			R->index = DM_SectorRoot(R->index);
+	}
 
-static void DM_CoalesceSectors()
-{
-	while (DM_CoalescePass() > 0)
-	{ }
+	dm_sector_parent.clear();
 
   	DM_GrabNeighborFloors();
 
@@ -1169,23 +1239,174 @@ static void DM_CoalesceSectors()
 
 //------------------------------------------------------------------------
 
+static inline u64_t DM_VertexKey(int x, int y)
+{
+	return ((u64_t)(u32_t)x << 32) | (u64_t)(u32_t)y;
+}
+
+
+static inline unsigned int DM_VertexHash(u64_t key)
+{
+	// 64-bit mixer (from MurmurHash3's finalizer)
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return (unsigned int)key;
+}
+
+
+static void DM_ResizeVertexHash(unsigned int new_size)
+{
+	std::vector<dm_vertex_slot_t> old_slots;
+
+	old_slots.swap(dm_vertex_hash);
+
+	dm_vertex_slot_t empty;
+
+	empty.key   = 0;
+	empty.index = -1;
+
+	dm_vertex_hash.assign(new_size, empty);
+
+	unsigned int mask = new_size - 1;
+
+	for (unsigned int i = 0 ; i < old_slots.size() ; i++)
+	{
+		if (old_slots[i].index < 0)
+			continue;
+
+		unsigned int pos = DM_VertexHash(old_slots[i].key) & mask;
+
+		while (dm_vertex_hash[pos].index >= 0)
+			pos = (pos + 1) & mask;
+
+		dm_vertex_hash[pos] = old_slots[i];
+	}
+}
+
+
+static void DM_InitVertexHash(unsigned int expected)
+{
+	unsigned int size = 256;
+
+	while (size < expected * 2)
+		size <<= 1;
+
+	dm_vertex_hash.clear();
+	dm_vertex_hash_used = 0;
+
+	DM_ResizeVertexHash(size);
+}
+
+
+static inline int DM_GridCellX(int x)
+{
+	int gx = (x - dm_grid_x) / DM_GRID_SIZE;
+
+	return CLAMP(0, gx, dm_grid_W - 1);
+}
+
+
+static inline int DM_GridCellY(int y)
+{
+	int gy = (y - dm_grid_y) / DM_GRID_SIZE;
+
+	return CLAMP(0, gy, dm_grid_H - 1);
+}
+
+
+static void DM_GridAddVertex(int index)
+{
+	const doom_vertex_c *V = dm_vertices[index];
+
+	int gx = DM_GridCellX(V->x);
+	int gy = DM_GridCellY(V->y);
+
+	dm_vertex_grid[gy * dm_grid_W + gx].push_back(index);
+}
+
+
+static void DM_BuildVertexGrid()
+{
+	int x1 = 0, y1 = 0;
+	int x2 = 0, y2 = 0;
+
+	for (unsigned int i = 0 ; i < dm_vertices.size() ; i++)
+	{
+		const doom_vertex_c *V = dm_vertices[i];
+
+		if (i == 0 || V->x < x1) x1 = V->x;
+		if (i == 0 || V->y < y1) y1 = V->y;
+		if (i == 0 || V->x > x2) x2 = V->x;
+		if (i == 0 || V->y > y2) y2 = V->y;
+	}
+
+	dm_grid_x = x1;
+	dm_grid_y = y1;
+
+	dm_grid_W = (x2 - x1) / DM_GRID_SIZE + 1;
+	dm_grid_H = (y2 - y1) / DM_GRID_SIZE + 1;
+
+	dm_vertex_grid.clear();
+	dm_vertex_grid.resize(dm_grid_W * dm_grid_H);
+
+	for (unsigned int i = 0 ; i < dm_vertices.size() ; i++)
+		DM_GridAddVertex((int)i);
+}
+
+
+static void DM_FreeVertexGrid()
+{
+	std::vector< std::vector<int> >().swap(dm_vertex_grid);
+
+	dm_grid_W = dm_grid_H = 0;
+}
+
+
 static doom_vertex_c * DM_MakeVertex(int x, int y)
 {
-	// look for existing vertex
-	int combo = (x << 16) + y;
+	if (dm_vertex_hash.empty())
+		DM_InitVertexHash(0);
+
+	// keep load factor at or below 50%
+	if ((dm_vertex_hash_used + 1) * 2 > dm_vertex_hash.size())
+		DM_ResizeVertexHash(dm_vertex_hash.size() * 2);
+
+	u64_t key = DM_VertexKey(x, y);
+
+	unsigned int mask = dm_vertex_hash.size() - 1;
+	unsigned int pos  = DM_VertexHash(key) & mask;
 
-	if (dm_vertex_map.find(combo) != dm_vertex_map.end())
+	// look for existing vertex, stopping at the first empty slot
+	for (;;)
 	{
-		return dm_vertices[dm_vertex_map[combo]];
+		dm_vertex_slot_t& slot = dm_vertex_hash[pos];
+
+		if (slot.index < 0)
+			break;
+
+		if (slot.key == key)
+			return dm_vertices[slot.index];
+
+		pos = (pos + 1) & mask;
 	}
 
-	// create new one
+	// create new one, placing it into the empty slot we found
 	doom_vertex_c * V = new doom_vertex_c(x, y);
 
-	dm_vertex_map[combo] = dm_vertices.size();
+	dm_vertex_hash[pos].key   = key;
+	dm_vertex_hash[pos].index = (int)dm_vertices.size();
+
+	dm_vertex_hash_used++;
 
 	dm_vertices.push_back(V);
 
+	if (! dm_vertex_grid.empty())
+		DM_GridAddVertex((int)dm_vertices.size() - 1);
+
 	return V;
 }
 
@@ -1714,6 +1935,15 @@ static void DM_CreateLinedefs()
 	map_bound_x2 = -99999;
 	map_bound_y2 = -99999;
 
+	// size the vertex table from the snag count, each snag can add
+	// at most two vertices (but most of them get shared).
+	unsigned int total_snags = 0;
+
+	for (unsigned int i = 0 ; i < all_regions.size() ; i++)
+		total_snags += all_regions[i]->snags.size();
+
+	DM_InitVertexHash(total_snags);
+
 	for (unsigned int i = 0 ; i < all_regions.size() ; i++)
 	{
 		region_c *R = all_regions[i];
@@ -1891,24 +2121,35 @@ static bool RoundWouldClobber(int cx, int cy, int ox, int oy,
 	int x2 = MAX(cx, ox);
 	int y2 = MAX(cy, oy);
 
-	for (unsigned int i = 0 ; i < dm_vertices.size() ; i++)
+	int gx1 = DM_GridCellX(x1);
+	int gy1 = DM_GridCellY(y1);
+	int gx2 = DM_GridCellX(x2);
+	int gy2 = DM_GridCellY(y2);
+
+	for (int gy = gy1 ; gy <= gy2 ; gy++)
+	for (int gx = gx1 ; gx <= gx2 ; gx++)
 	{
-		const doom_vertex_c *V = dm_vertices[i];
+		const std::vector<int>& cell = dm_vertex_grid[gy * dm_grid_W + gx];
 
-		if (V == ignore1 || V == ignore2 || V == ignore3)
-			continue;
+		for (unsigned int i = 0 ; i < cell.size() ; i++)
+		{
+			const doom_vertex_c *V = dm_vertices[cell[i]];
 
-		if (! V->lines[0])  // dud vertex?
-			continue;
+			if (V == ignore1 || V == ignore2 || V == ignore3)
+				continue;
 
-		// allow vertex at opposite corner
-		// (this is the cheesy way -- the proper way would be to check if the
-		//  vertex is within the triangle).
-		if (V->x == ox && V->y == oy)
-			continue;
+			if (! V->lines[0])  // dud vertex?
+				continue;
 
-		if (x1 <= V->x && V->x <= x2 && y1 <= V->y && V->y <= y2)
-			return true;
+			// allow vertex at opposite corner
+			// (this is the cheesy way -- the proper way would be to check if the
+			//  vertex is within the triangle).
+			if (V->x == ox && V->y == oy)
+				continue;
+
+			if (x1 <= V->x && V->x <= x2 && y1 <= V->y && V->y <= y2)
+				return true;
+		}
 	}
 
 	return false;  // OK
@@ -2150,11 +2391,15 @@ static void DM_RoundCorners()
 
 	int count = 0;
 
+	DM_BuildVertexGrid();
+
 	for (int pass = 0 ; pass < 2 ; pass++)
 		for (int i = 0 ; i < (int)dm_vertices.size() ; i++)
 			if (dm_vertices[i]->getNumLines() == 2)
 				count += TryRoundAtVertex(dm_vertices[i]);
 
+	DM_FreeVertexGrid();
+
 	LogPrintf("Rounded %d square corners\n", count);
 
 	// need this again, since we often create co-linear diagonals
@@ -3058,7 +3303,10 @@ void DM_FreeStuff()
 
 	dm_fs_things.clear();
 
-	dm_vertex_map.clear();
+	dm_vertex_hash.clear();
+	dm_vertex_hash_used = 0;
+
+	DM_FreeVertexGrid();
 }
 
 
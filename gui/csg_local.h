@@ -221,9 +221,13 @@ private:
 
 /***** VARIABLES ****************/
 
-extern std::vector<region_c *> all_regions;
+// these are per-thread (see Q1_ClippingHulls)
+extern thread_local std::vector<region_c *> all_regions;
 
-extern bsp_node_c * bsp_root;
+extern thread_local bsp_node_c * bsp_root;
+
+// remember the BSP of each chunk between builds (on by default)
+extern bool bsp_chunk_cache;
 
 
 /***** FUNCTIONS ****************/
@@ -231,6 +235,9 @@ extern bsp_node_c * bsp_root;
 void CSG_BSP(double grid, bool is_clip_hull = false);
 void CSG_BSP_Free();
 
+// forget all the chunks remembered by previous builds
+void CSG_BSP_FreeCache();
+
 region_c * CSG_PointInRegion(double x, double y);
 
 void CSG_Shade();
@@ -36,12 +36,26 @@
 #define EPSILON  0.001
 
 
-std::vector< csg_brush_c *> all_brushes;
+thread_local std::vector< csg_brush_c *> all_brushes;
 
 std::vector< csg_entity_c *> all_entities;
 
 std::map< std::string, csg_property_set_c *> all_tex_props;
 
+// every gui.property() setting of the current level, kept for
+// snapshots.  settings made outside of a level (e.g. by the engine)
+// are also remembered in csg_build_props, and apply to every level.
+csg_property_set_c csg_used_props;
+
+static csg_property_set_c csg_build_props;
+
+static bool csg_in_level;
+
+static int csg_snapshot_count;
+
+// when set, a snapshot of each level is written using this prefix
+const char *csg_snapshot_prefix = NULL;
+
 std::string dummy_wall_tex;
 std::string dummy_plane_tex;
 
@@ -779,6 +793,15 @@ static void CSG_DeleteQuadTree()
 	brush_quad_tree = NULL;
 }
 
+void CSG_RebuildQuadTree()
+{
+	CSG_DeleteQuadTree();
+	CSG_CreateQuadTree();
+
+	for (unsigned int k = 0 ; k < all_brushes.size() ; k++)
+		brush_quad_tree->Add(all_brushes[k]);
+}
+
 
 //------------------------------------------------------------------------
 
@@ -1112,6 +1135,11 @@ int CSG_begin_level(lua_State *L)
 
 	CSG_Main_Free();
 
+	csg_in_level = true;
+
+	// forget the settings of previous levels
+	csg_used_props = csg_build_props;
+
 	game_object->BeginLevel();
 
 	CSG_CreateQuadTree();
@@ -1126,8 +1154,25 @@ int CSG_end_level(lua_State *L)
 {
 	SYS_ASSERT(game_object);
 
+	if (csg_snapshot_prefix)
+	{
+		csg_snapshot_count++;
+
+		char *filename = StringPrintf("%s_%02d.snap", csg_snapshot_prefix, csg_snapshot_count);
+
+		CSG_SaveSnapshot(filename, ob_game_format());
+
+		StringFree(filename);
+	}
+
+	u32_t start_time = TimeGetMillies();
+
+	csg_in_level = false;
+
 	game_object->EndLevel();
 
+	LogPrintf("LEVEL TIME: %1.2f seconds\n", (TimeGetMillies() - start_time) / 1000.0);
+
 	CSG_Main_Free();
 
 	CSG_BSP_Free();
@@ -1136,47 +1181,66 @@ int CSG_end_level(lua_State *L)
 }
 
 
-// LUA: property(key, value)
-//
-int CSG_property(lua_State *L)
+bool CSG_ParseProperty(const char *key, const char *value)
 {
-	const char *key   = luaL_checkstring(L,1);
-	const char *value = luaL_checkstring(L,2);
-
 	// eat propertities intended for CSG2
 
 	if (strcmp(key, "error_tex") == 0)
 	{
 		dummy_wall_tex = std::string(value);
-		return 0;
+		return true;
 	}
 	else if (strcmp(key, "error_flat") == 0)
 	{
 		dummy_plane_tex = std::string(value);
-		return 0;
+		return true;
 	}
 	else if (strcmp(key, "spot_low_h") == 0)
 	{
 		spot_low_h = atoi(value);
-		return 0;
+		return true;
 	}
 	else if (strcmp(key, "spot_high_h") == 0)
 	{
 		spot_high_h = atoi(value);
-		return 0;
+		return true;
 	}
 	else if (StringCaseCmp(key, "chunk_size") == 0)
 	{
 		CHUNK_SIZE = atof(value);
-		return 0;
+		return true;
 	}
 	else if (StringCaseCmp(key, "cluster_size") == 0)
 	{
 		CLUSTER_SIZE = atof(value);
-		return 0;
+		return true;
+	}
+	else if (StringCaseCmp(key, "bsp_cache") == 0)
+	{
+		bsp_chunk_cache = atoi(value) ? true : false;
+		return true;
 	}
 
 	if (QLIT_ParseProperty(key, value))
+		return true;
+
+	return false;
+}
+
+
+// LUA: property(key, value)
+//
+int CSG_property(lua_State *L)
+{
+	const char *key   = luaL_checkstring(L,1);
+	const char *value = luaL_checkstring(L,2);
+
+	csg_used_props.Add(key, value);
+
+	if (! csg_in_level)
+		csg_build_props.Add(key, value);
+
+	if (CSG_ParseProperty(key, value))
 		return 0;
 
 	SYS_ASSERT(game_object);
@@ -1406,6 +1470,17 @@ static void CSG_FreeTexProps()
 }
 
 
+void CSG_BeginBuild()
+{
+	csg_used_props  = csg_property_set_c();
+	csg_build_props = csg_property_set_c();
+
+	csg_in_level = false;
+
+	csg_snapshot_count = 0;
+}
+
+
 void CSG_LinkBrushToEntity(csg_brush_c *B, const char *link_key)
 {
 	for (unsigned int k = 0 ; k < all_entities.size() ; k++)
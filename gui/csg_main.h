@@ -249,7 +249,8 @@ public:
 
 /***** VARIABLES ****************/
 
-extern std::vector<csg_brush_c *> all_brushes;
+// this is per-thread, the clipping hulls use their own lists
+extern thread_local std::vector<csg_brush_c *> all_brushes;
 
 extern std::vector<csg_entity_c *> all_entities;
 
@@ -270,6 +271,32 @@ csg_property_set_c * CSG_LookupTexProps(const char *name);
 
 void CSG_LinkBrushToEntity(csg_brush_c *B, const char *link_key);
 
+// handles the properties which belong to the CSG code (and lighting),
+// returns false for anything else (which the game object handles).
+bool CSG_ParseProperty(const char *key, const char *value);
+
+
+/***** SNAPSHOTS ****************/
+
+// set by the --snapshot option
+extern const char *csg_snapshot_prefix;
+
+// forgets the properties of a previous build, and restarts the
+// snapshot numbering.
+void CSG_BeginBuild();
+
+// writes the brushes, entities and properties of the current level
+bool CSG_SaveSnapshot(const char *filename, const char *format);
+
+// replaces the current level with the snapshot, 'format' is set
+// to the game format it was written for.
+bool CSG_LoadSnapshot(const char *filename, std::string& format);
+
+// the --bench option: runs one back-end stage on a snapshot 'runs'
+// times and reports the timings.  When 'warm' is true the BSP chunk
+// cache is kept between runs.  Returns a program exit code.
+int CSG_Benchmark(const char *filename, const char *stage, int runs, bool warm);
+
 
 #endif /* __OBLIGE_CSG_MAIN_H__ */
 
@@ -345,6 +345,10 @@ void CSG_QUAKE_Free();
 
 void CSG_AssignIndexes(quake_node_c *node, int *cur_node, int *cur_leaf);
 
+// g_quake.cc (also used by the benchmark)
+void Q1_SetLightingMode();
+void Q1_VisWorld(int base_leafs);
+
 
 #endif /* __OBLIGE_CSG_QUAKE_H__ */
 
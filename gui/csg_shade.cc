@@ -27,6 +27,7 @@
 
 #include "lib_util.h"
 #include "lib_argv.h"
+#include "lib_thread.h"
 #include "main.h"
 
 #include "csg_main.h"
@@ -383,5 +384,299 @@ void CSG_Shade()
 	SHADE_MergeResults();
 }
 
+
+//------------------------------------------------------------------------
+//  CAVE TORCH LIGHTING
+//------------------------------------------------------------------------
+
+//
+// Cave areas are lit by torches (point lights), each cell of the cave
+// gets the brightest level of all the torches which can see it, with
+// the level stepping down as the distance increases.
+//
+// This computes a whole area in one go.  The lights are put into
+// buckets as big as their radius, so each cell only looks at the
+// lights in the nine buckets around it, and those are tried from
+// brightest to dimmest so that the first one which is not blocked
+// gives the result, and no more rays need to be traced.
+//
+
+#define CAVE_CELL_SIZE     64
+#define CAVE_LIGHT_RADIUS  312
+
+#define CAVE_CELL_Z  80  // height of tested point above the floor
+
+
+typedef struct
+{
+	double x, y, z;
+}
+cave_light_t;
+
+
+class cave_lighting_c
+{
+public:
+	double base_x, base_y;
+
+	int cw, ch;
+
+	// floor height of each cell, only valid when is_open is set.
+	// indexed by [x * ch + y], like the result.
+	std::vector<double> floor_h;
+	std::vector<bool>   is_open;
+
+	std::vector<cave_light_t> lights;
+
+	// lights sorted into square buckets of CAVE_LIGHT_RADIUS size
+	double bk_x, bk_y;
+	int bk_w, bk_h;
+
+	std::vector< std::vector<int> > buckets;
+
+	std::vector<int> result;
+
+public:
+	cave_lighting_c(double _bx, double _by, int _cw, int _ch) :
+		base_x(_bx), base_y(_by), cw(_cw), ch(_ch),
+		floor_h(_cw * _ch, 0), is_open(_cw * _ch, false),
+		lights(), buckets(), result(_cw * _ch, 0)
+	{
+		// the buckets cover every cell, plus enough around them for
+		// any light which might reach one.
+		bk_x = base_x - CAVE_LIGHT_RADIUS;
+		bk_y = base_y - CAVE_LIGHT_RADIUS;
+
+		bk_w = (cw * CAVE_CELL_SIZE) / CAVE_LIGHT_RADIUS + 3;
+		bk_h = (ch * CAVE_CELL_SIZE) / CAVE_LIGHT_RADIUS + 3;
+
+		buckets.resize(bk_w * bk_h);
+	}
+
+	~cave_lighting_c()
+	{ }
+
+	void AddLight(double x, double y, double z)
+	{
+		int bx = (int)floor((x - bk_x) / CAVE_LIGHT_RADIUS);
+		int by = (int)floor((y - bk_y) / CAVE_LIGHT_RADIUS);
+
+		// too far away to reach any cell?
+		if (bx < 0 || bx >= bk_w || by < 0 || by >= bk_h)
+			return;
+
+		cave_light_t L;
+
+		L.x = x; L.y = y; L.z = z;
+
+		buckets[by * bk_w + bx].push_back((int)lights.size());
+
+		lights.push_back(L);
+	}
+
+	static int DistToLevel(double d)
+	{
+		if (d >= 312) return 0;
+		if (d >= 208) return 16;
+		if (d >= 104) return 32;
+
+		return 48;
+	}
+
+	struct Compare_Candidate_pred
+	{
+		// brightest first, and in list order when equal
+		inline bool operator() (const std::pair<int, int>& A,
+		                        const std::pair<int, int>& B) const
+		{
+			if (A.first != B.first)
+				return A.first > B.first;
+
+			return A.second < B.second;
+		}
+	};
+
+	void CalcCell(int x, int y, std::vector< std::pair<int, int> >& cands)
+	{
+		int idx = x * ch + y;
+
+		if (! is_open[idx])
+			return;
+
+		double cell_x = base_x + x * CAVE_CELL_SIZE + CAVE_CELL_SIZE / 2;
+		double cell_y = base_y + y * CAVE_CELL_SIZE + CAVE_CELL_SIZE / 2;
+		double cell_z = floor_h[idx] + CAVE_CELL_Z;
+
+		int bx = (int)floor((cell_x - bk_x) / CAVE_LIGHT_RADIUS);
+		int by = (int)floor((cell_y - bk_y) / CAVE_LIGHT_RADIUS);
+
+		cands.clear();
+
+		for (int ny = by - 1 ; ny <= by + 1 ; ny++)
+		for (int nx = bx - 1 ; nx <= bx + 1 ; nx++)
+		{
+			if (nx < 0 || nx >= bk_w || ny < 0 || ny >= bk_h)
+				continue;
+
+			const std::vector<int>& bucket = buckets[ny * bk_w + nx];
+
+			for (unsigned int k = 0 ; k < bucket.size() ; k++)
+			{
+				const cave_light_t& L = lights[bucket[k]];
+
+				double dx = L.x - cell_x;
+				double dy = L.y - cell_y;
+
+				int level = DistToLevel(sqrt(dx * dx + dy * dy));
+
+				if (level > 0)
+					cands.push_back(std::make_pair(level, bucket[k]));
+			}
+		}
+
+		std::sort(cands.begin(), cands.end(), Compare_Candidate_pred());
+
+		for (unsigned int k = 0 ; k < cands.size() ; k++)
+		{
+			const cave_light_t& L = lights[cands[k].second];
+
+			// a light sitting on the cell itself always reaches it
+			// (and gui.trace_ray rejects a zero-length ray too).
+			bool same_spot = (fabs(L.x - cell_x) < 1 &&
+			                  fabs(L.y - cell_y) < 1 &&
+			                  fabs(L.z - cell_z) < 1);
+
+			// line of sight blocked?
+			if (! same_spot &&
+			    CSG_TraceRay(L.x, L.y, L.z, cell_x, cell_y, cell_z, "v"))
+				continue;
+
+			result[idx] = cands[k].first;
+			return;
+		}
+	}
+};
+
+
+static void CaveLightColumnJob(int index, void *priv_dat)
+{
+	cave_lighting_c *info = (cave_lighting_c *) priv_dat;
+
+	std::vector< std::pair<int, int> > cands;
+
+	for (int y = 0 ; y < info->ch ; y++)
+		info->CalcCell(index, y, cands);
+}
+
+
+// LUA: cave_lighting(grid, cw, ch, base_x, base_y, lights)
+//
+//   grid    -- 2D table of cells, [1..cw][1..ch], each cell is either
+//              nil or a table where 'floor_h' is nil for solid cells
+//   cw, ch  -- size of grid
+//   base_x, base_y  -- map coordinate of bottom-left corner of grid
+//   lights  -- list of lights, each a table with x, y, z fields
+//
+// returns a new 2D table with the light level of each cell (0 when
+// no light reaches it).
+//
+// All the solid brushes must already have been added, since rays are
+// traced against them.
+//
+int CSG_cave_lighting(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	int cw = luaL_checkint(L, 2);
+	int ch = luaL_checkint(L, 3);
+
+	double base_x = luaL_checknumber(L, 4);
+	double base_y = luaL_checknumber(L, 5);
+
+	luaL_checktype(L, 6, LUA_TTABLE);
+
+	if (cw < 1 || ch < 1)
+		return luaL_error(L, "gui.cave_lighting: bad grid size");
+
+	cave_lighting_c info(base_x, base_y, cw, ch);
+
+	// grab the floor heights
+
+	for (int x = 0 ; x < cw ; x++)
+	{
+		lua_rawgeti(L, 1, 1+x);
+
+		if (lua_istable(L, -1))
+		{
+			for (int y = 0 ; y < ch ; y++)
+			{
+				lua_rawgeti(L, -1, 1+y);
+
+				if (lua_istable(L, -1))
+				{
+					lua_getfield(L, -1, "floor_h");
+
+					if (lua_isnumber(L, -1))
+					{
+						info.floor_h[x * ch + y] = lua_tonumber(L, -1);
+						info.is_open[x * ch + y] = true;
+					}
+
+					lua_pop(L, 1);
+				}
+
+				lua_pop(L, 1);
+			}
+		}
+
+		lua_pop(L, 1);
+	}
+
+	// grab the lights
+
+	int num_lights = (int)lua_objlen(L, 6);
+
+	for (int i = 0 ; i < num_lights ; i++)
+	{
+		lua_rawgeti(L, 6, 1+i);
+
+		if (! lua_istable(L, -1))
+			return luaL_error(L, "gui.cave_lighting: bad light #%d", 1+i);
+
+		lua_getfield(L, -1, "x");
+		lua_getfield(L, -2, "y");
+		lua_getfield(L, -3, "z");
+
+		info.AddLight(luaL_checknumber(L, -3),
+		              luaL_checknumber(L, -2),
+		              luaL_checknumber(L, -1));
+
+		lua_pop(L, 4);
+	}
+
+	// the rays are traced on all the worker threads
+
+	Thread_ParallelFor(cw, CaveLightColumnJob, &info);
+
+	// build the result table
+
+	lua_createtable(L, cw, 0);
+
+	for (int x = 0 ; x < cw ; x++)
+	{
+		lua_createtable(L, ch, 0);
+
+		for (int y = 0 ; y < ch ; y++)
+		{
+			lua_pushinteger(L, info.result[x * ch + y]);
+			lua_rawseti(L, -2, 1+y);
+		}
+
+		lua_rawseti(L, -2, 1+x);
+	}
+
+	return 1;
+}
+
 //--- editor settings ---
 // vi:ts=4:sw=4:noexpandtab
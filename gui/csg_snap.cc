@@ -0,0 +1,595 @@
+//------------------------------------------------------------------------
+//  CSG SNAPSHOTS
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  A snapshot is everything the Lua code has sent to the CSG system
+//  for a single level: the brushes, entities, texture properties and
+//  CSG properties.  Loading one gives the back end exactly the same
+//  input again, without running any scripts.
+//
+//  File format (all numbers are little-endian):
+//
+//     8 bytes   : magic "OBSNAP01"
+//     u32       : number of strings
+//     strings   : u16 length + characters (no terminator)
+//     u32       : length of body
+//     body      : format, properties, tex props, entities, brushes
+//
+//  Every string in the body is an index into the string table, since
+//  the same keys and texture names turn up over and over.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#include "lib_util.h"
+#include "main.h"
+
+#include "csg_main.h"
+#include "csg_local.h"
+#include "csg_quake.h"
+
+
+#define SNAPSHOT_MAGIC  "OBSNAP01"
+
+
+extern std::map< std::string, csg_property_set_c *> all_tex_props;
+
+extern csg_property_set_c csg_used_props;
+
+extern void CSG_RebuildQuadTree();
+
+
+class snapshot_writer_c
+{
+private:
+	std::vector<byte> body;
+
+	std::map<std::string, u32_t> string_map;
+	std::vector<std::string> strings;
+
+public:
+	snapshot_writer_c() : body(), string_map(), strings()
+	{ }
+
+	~snapshot_writer_c()
+	{ }
+
+	void Int(s32_t value)
+	{
+		u32_t raw = LE_U32((u32_t) value);
+
+		const byte *p = (const byte *) &raw;
+
+		body.insert(body.end(), p, p + 4);
+	}
+
+	void Float(float value)
+	{
+		u32_t raw;
+
+		memcpy(&raw, &value, 4);
+
+		Int((s32_t) raw);
+	}
+
+	void Double(double value)
+	{
+		u32_t raw[2];
+
+		memcpy(raw, &value, 8);
+
+#if (UT_BYTEORDER == UT_BIG_ENDIAN)
+		std::swap(raw[0], raw[1]);
+#endif
+		Int((s32_t) raw[0]);
+		Int((s32_t) raw[1]);
+	}
+
+	void String(const std::string& str)
+	{
+		std::map<std::string, u32_t>::iterator SI = string_map.find(str);
+
+		if (SI != string_map.end())
+		{
+			Int((s32_t) SI->second);
+			return;
+		}
+
+		u32_t index = (u32_t) strings.size();
+
+		strings.push_back(str);
+		string_map[str] = index;
+
+		Int((s32_t) index);
+	}
+
+	void Props(csg_property_set_c& props)
+	{
+		int count = 0;
+
+		csg_property_set_c::iterator PI;
+
+		for (PI = props.begin() ; PI != props.end() ; PI++)
+			count++;
+
+		Int(count);
+
+		for (PI = props.begin() ; PI != props.end() ; PI++)
+		{
+			String(PI->first);
+			String(PI->second);
+		}
+	}
+
+	void UVMatrix(const uv_matrix_c *uv_mat)
+	{
+		Int(uv_mat ? 1 : 0);
+
+		if (! uv_mat)
+			return;
+
+		for (int i = 0 ; i < 4 ; i++) Float(uv_mat->s[i]);
+		for (int i = 0 ; i < 4 ; i++) Float(uv_mat->t[i]);
+	}
+
+	void Plane(brush_plane_c& P)
+	{
+		Double(P.z);
+
+		Int(P.slope ? 1 : 0);
+
+		if (P.slope)
+		{
+			Float(P.slope->x);  Float(P.slope->y);  Float(P.slope->z);
+			Float(P.slope->nx); Float(P.slope->ny); Float(P.slope->nz);
+		}
+
+		Props(P.face);
+		UVMatrix(P.uv_mat);
+	}
+
+	bool WriteFile(const char *filename)
+	{
+		FILE *fp = fopen(filename, "wb");
+
+		if (! fp)
+			return false;
+
+		fwrite(SNAPSHOT_MAGIC, 8, 1, fp);
+
+		u32_t raw = LE_U32((u32_t) strings.size());
+		fwrite(&raw, 4, 1, fp);
+
+		for (unsigned int i = 0 ; i < strings.size() ; i++)
+		{
+			u16_t len = LE_U16((u16_t) strings[i].size());
+
+			fwrite(&len, 2, 1, fp);
+			fwrite(strings[i].data(), strings[i].size(), 1, fp);
+		}
+
+		raw = LE_U32((u32_t) body.size());
+		fwrite(&raw, 4, 1, fp);
+
+		if (! body.empty())
+			fwrite(&body[0], body.size(), 1, fp);
+
+		bool ok = ! ferror(fp);
+
+		fclose(fp);
+
+		return ok;
+	}
+};
+
+
+class snapshot_reader_c
+{
+private:
+	std::vector<byte> data;
+
+	unsigned int pos;
+
+	std::vector<std::string> strings;
+
+	// set when reading past the end, or a bad string index
+	bool failed;
+
+public:
+	snapshot_reader_c() : data(), pos(0), strings(), failed(false)
+	{ }
+
+	~snapshot_reader_c()
+	{ }
+
+	bool Failed() const { return failed; }
+
+	bool ReadFile(const char *filename)
+	{
+		FILE *fp = fopen(filename, "rb");
+
+		if (! fp)
+			return false;
+
+		byte buffer[4096];
+
+		for (;;)
+		{
+			size_t got = fread(buffer, 1, sizeof(buffer), fp);
+
+			if (got == 0)
+				break;
+
+			data.insert(data.end(), buffer, buffer + got);
+		}
+
+		fclose(fp);
+
+		if (data.size() < 8 || memcmp(&data[0], SNAPSHOT_MAGIC, 8) != 0)
+			return false;
+
+		pos = 8;
+
+		int num_strings = Int();
+
+		for (int i = 0 ; i < num_strings && ! failed ; i++)
+		{
+			if (pos + 2 > data.size())
+			{
+				failed = true;
+				break;
+			}
+
+			u16_t len = LE_U16(*(const u16_t *) &data[pos]);
+
+			pos += 2;
+
+			if (pos + len > data.size())
+			{
+				failed = true;
+				break;
+			}
+
+			strings.push_back(std::string((const char *) &data[pos], len));
+
+			pos += len;
+		}
+
+		int body_len = Int();
+
+		if (failed || pos + body_len != data.size())
+			return false;
+
+		return true;
+	}
+
+	s32_t Int()
+	{
+		if (pos + 4 > data.size())
+		{
+			failed = true;
+			return 0;
+		}
+
+		u32_t raw;
+
+		memcpy(&raw, &data[pos], 4);
+
+		pos += 4;
+
+		return (s32_t) LE_U32(raw);
+	}
+
+	float Float()
+	{
+		u32_t raw = (u32_t) Int();
+
+		float value;
+
+		memcpy(&value, &raw, 4);
+
+		return value;
+	}
+
+	double Double()
+	{
+		u32_t raw[2];
+
+		raw[0] = (u32_t) Int();
+		raw[1] = (u32_t) Int();
+
+#if (UT_BYTEORDER == UT_BIG_ENDIAN)
+		std::swap(raw[0], raw[1]);
+#endif
+		double value;
+
+		memcpy(&value, raw, 8);
+
+		return value;
+	}
+
+	const std::string& String()
+	{
+		static const std::string empty_str;
+
+		s32_t index = Int();
+
+		if (index < 0 || index >= (int)strings.size())
+		{
+			failed = true;
+			return empty_str;
+		}
+
+		return strings[index];
+	}
+
+	void Props(csg_property_set_c& props)
+	{
+		int count = Int();
+
+		for (int i = 0 ; i < count && ! failed ; i++)
+		{
+			std::string key = String();
+			std::string value = String();
+
+			props.Add(key.c_str(), value.c_str());
+		}
+	}
+
+	uv_matrix_c * UVMatrix()
+	{
+		if (! Int())
+			return NULL;
+
+		uv_matrix_c *uv_mat = new uv_matrix_c;
+
+		for (int i = 0 ; i < 4 ; i++) uv_mat->s[i] = Float();
+		for (int i = 0 ; i < 4 ; i++) uv_mat->t[i] = Float();
+
+		return uv_mat;
+	}
+
+	void Plane(brush_plane_c& P)
+	{
+		P.z = Double();
+
+		if (Int())
+		{
+			P.slope = new quake_plane_c;
+
+			P.slope->x  = Float(); P.slope->y  = Float(); P.slope->z  = Float();
+			P.slope->nx = Float(); P.slope->ny = Float(); P.slope->nz = Float();
+		}
+
+		Props(P.face);
+
+		P.uv_mat = UVMatrix();
+	}
+};
+
+
+bool CSG_SaveSnapshot(const char *filename, const char *format)
+{
+	snapshot_writer_c W;
+
+	W.String(format ? format : "");
+
+	W.Props(csg_used_props);
+
+	// texture properties
+
+	W.Int((int)all_tex_props.size());
+
+	std::map< std::string, csg_property_set_c *>::iterator TPI;
+
+	for (TPI = all_tex_props.begin() ; TPI != all_tex_props.end() ; TPI++)
+	{
+		W.String(TPI->first);
+		W.Props(*TPI->second);
+	}
+
+	// entities
+
+	std::map<const csg_entity_c *, int> ent_index;
+
+	W.Int((int)all_entities.size());
+
+	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
+	{
+		csg_entity_c *E = all_entities[i];
+
+		ent_index[E] = (int)i;
+
+		W.String(E->id);
+
+		W.Double(E->x);
+		W.Double(E->y);
+		W.Double(E->z);
+
+		W.Props(E->props);
+	}
+
+	// brushes
+
+	W.Int((int)all_brushes.size());
+
+	for (unsigned int i = 0 ; i < all_brushes.size() ; i++)
+	{
+		csg_brush_c *B = all_brushes[i];
+
+		W.Int(B->bkind);
+		W.Int(B->bflags);
+
+		W.Props(B->props);
+
+		W.Plane(B->b);
+		W.Plane(B->t);
+
+		W.Int(B->link_ent ? ent_index[B->link_ent] : -1);
+
+		W.Int((int)B->verts.size());
+
+		for (unsigned int k = 0 ; k < B->verts.size() ; k++)
+		{
+			brush_vert_c *V = B->verts[k];
+
+			W.Double(V->x);
+			W.Double(V->y);
+
+			W.Props(V->face);
+			W.UVMatrix(V->uv_mat);
+		}
+	}
+
+	if (! W.WriteFile(filename))
+	{
+		LogPrintf("WARNING: could not write snapshot: %s\n", filename);
+		return false;
+	}
+
+	LogPrintf("Wrote CSG snapshot: %s (%d brushes, %d entities)\n", filename,
+			  (int)all_brushes.size(), (int)all_entities.size());
+
+	return true;
+}
+
+
+bool CSG_LoadSnapshot(const char *filename, std::string& format)
+{
+	snapshot_reader_c R;
+
+	if (! R.ReadFile(filename))
+	{
+		LogPrintf("Bad or missing snapshot: %s\n", filename);
+		return false;
+	}
+
+	CSG_Main_Free();
+
+	format = R.String();
+
+	// CSG properties
+
+	csg_property_set_c props;
+
+	R.Props(props);
+
+	csg_property_set_c::iterator PI;
+
+	for (PI = props.begin() ; PI != props.end() ; PI++)
+		CSG_ParseProperty(PI->first.c_str(), PI->second.c_str());
+
+	// keep all of them, the game specific ones are looked up later
+	csg_used_props = props;
+
+	// texture properties
+
+	int num_tex = R.Int();
+
+	for (int i = 0 ; i < num_tex && ! R.Failed() ; i++)
+	{
+		std::string name = R.String();
+
+		csg_property_set_c *tex_props = new csg_property_set_c;
+
+		R.Props(*tex_props);
+
+		delete all_tex_props[name];
+
+		all_tex_props[name] = tex_props;
+	}
+
+	// entities
+
+	int num_ents = R.Int();
+
+	for (int i = 0 ; i < num_ents && ! R.Failed() ; i++)
+	{
+		csg_entity_c *E = new csg_entity_c;
+
+		E->id = R.String();
+
+		E->x = R.Double();
+		E->y = R.Double();
+		E->z = R.Double();
+
+		R.Props(E->props);
+
+		all_entities.push_back(E);
+	}
+
+	// brushes
+
+	int num_brushes = R.Int();
+
+	for (int i = 0 ; i < num_brushes && ! R.Failed() ; i++)
+	{
+		csg_brush_c *B = new csg_brush_c;
+
+		B->bkind  = R.Int();
+		B->bflags = R.Int();
+
+		R.Props(B->props);
+
+		R.Plane(B->b);
+		R.Plane(B->t);
+
+		int link = R.Int();
+
+		if (link >= 0 && link < (int)all_entities.size())
+			B->link_ent = all_entities[link];
+
+		int num_verts = R.Int();
+
+		for (int k = 0 ; k < num_verts && ! R.Failed() ; k++)
+		{
+			brush_vert_c *V = new brush_vert_c(B);
+
+			V->x = R.Double();
+			V->y = R.Double();
+
+			R.Props(V->face);
+
+			V->uv_mat = R.UVMatrix();
+
+			B->verts.push_back(V);
+		}
+
+		// NOTE: slopes were saved after ComputePlanes() was done
+		B->ComputeBBox();
+
+		all_brushes.push_back(B);
+	}
+
+	if (R.Failed())
+	{
+		LogPrintf("Snapshot is corrupt: %s\n", filename);
+
+		CSG_Main_Free();
+		return false;
+	}
+
+	CSG_RebuildQuadTree();
+
+	return true;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -829,12 +829,22 @@ static void TransferFILEtoWAD(PHYSFS_File *fp, const char *dest_lump)
 }
 
 
-static void TransferWADtoWAD(int src_entry, const char *dest_lump)
+static void TransferWADtoWAD(wad_reader_c& src, int src_entry, const char *dest_lump)
 {
-	int length = WAD_EntryLen(src_entry);
+	int length = src.EntryLen(src_entry);
 
 	WAD_NewLump(dest_lump);
 
+	const byte *data = src.EntryData(src_entry);
+
+	// when the source is mapped, pass its data straight through
+	if (data)
+	{
+		WAD_AppendData(data, length);
+		WAD_FinishLump();
+		return;
+	}
+
 	int buf_size = 4096;
 	char *buffer = new char[buf_size];
 
@@ -843,7 +853,7 @@ static void TransferWADtoWAD(int src_entry, const char *dest_lump)
 		int want_len = MIN(buf_size, length - pos);
 
 		// FIXME: handle error better
-		if (! WAD_ReadData(src_entry, pos, want_len, buffer))
+		if (! src.ReadData(src_entry, pos, want_len, buffer))
 			break;
 
 		WAD_AppendData(buffer, want_len);
@@ -857,11 +867,19 @@ static void TransferWADtoWAD(int src_entry, const char *dest_lump)
 }
 
 
-static qLump_c * DoLoadLump(int src_entry)
+static qLump_c * DoLoadLump(wad_reader_c& src, int src_entry)
 {
 	qLump_c *lump = new qLump_c();
 
-	int length = WAD_EntryLen(src_entry);
+	int length = src.EntryLen(src_entry);
+
+	const byte *data = src.EntryData(src_entry);
+
+	if (data)
+	{
+		lump->Append(data, length);
+		return lump;
+	}
 
 	int buf_size = 4096;
 	char *buffer = new char[buf_size];
@@ -871,7 +889,7 @@ static qLump_c * DoLoadLump(int src_entry)
 		int want_len = MIN(buf_size, length - pos);
 
 		// FIXME: handle error better
-		if (! WAD_ReadData(src_entry, pos, want_len, buffer))
+		if (! src.ReadData(src_entry, pos, want_len, buffer))
 			break;
 
 		lump->Append(buffer, want_len);
@@ -939,19 +957,21 @@ int DM_wad_transfer_lump(lua_State *L)
 	if (! MatchExtension(pkg_name, "wad"))
 		return luaL_error(L, "wad_transfer_lump: file extension is not WAD: %s\n", pkg_name);
 
-	if (! WAD_OpenRead(pkg_name))
+	wad_reader_c src;
+
+	if (! src.Open(pkg_name))
 		return luaL_error(L, "wad_transfer_lump: bad WAD file: %s", pkg_name);
 
-	int entry = WAD_FindEntry(src_lump);
+	int entry = src.FindEntry(src_lump);
 	if (entry < 0)
 	{
-		WAD_CloseRead();
+		src.Close();
 		return luaL_error(L, "wad_transfer_lump: lump '%s' not found", src_lump);
 	}
 
-	TransferWADtoWAD(entry, dest_lump);
+	TransferWADtoWAD(src, entry, dest_lump);
 
-	WAD_CloseRead();
+	src.Close();
 
 	return 0;
 }
@@ -970,58 +990,60 @@ int DM_wad_transfer_map(lua_State *L)
 	if (! MatchExtension(pkg_name, "wad"))
 		return luaL_error(L, "wad_transfer_map: file extension is not WAD: %s\n", pkg_name);
 
-	if (! WAD_OpenRead(pkg_name))
+	wad_reader_c src;
+
+	if (! src.Open(pkg_name))
 		return luaL_error(L, "wad_transfer_map: bad WAD file: %s", pkg_name);
 
-	int entry = WAD_FindEntry(src_map);
+	int entry = src.FindEntry(src_map);
 	if (entry < 0)
 	{
-		WAD_CloseRead();
+		src.Close();
 		return luaL_error(L, "wad_transfer_map: map '%s' not found", src_map);
 	}
 
 	// step 1: copy the map marker
-	TransferWADtoWAD(entry, dest_map);
+	TransferWADtoWAD(src, entry, dest_map);
 	entry++;
 
 	// step 2: copy all the lumps belonging to the map.
 	for (int loop = 0; loop < 15; loop++)
 	{
-		if (entry >= WAD_NumEntries())
+		if (entry >= src.NumEntries())
 			break;
 
-		const char *src_lump = WAD_EntryName(entry);
+		const char *src_lump = src.EntryName(entry);
 		if (! IsLevelLump(src_lump))
 			break;
 
-		TransferWADtoWAD(entry, src_lump);
+		TransferWADtoWAD(src, entry, src_lump);
 		entry++;
 	}
 
-	WAD_CloseRead();
+	src.Close();
 
 	return 0;
 }
 
 
-static void DoMergeSection(char ch, const char *start1, const char *start2,
+static void DoMergeSection(wad_reader_c& src, char ch, const char *start1, const char *start2,
 		const char *end1, const char *end2)
 {
-	int start = WAD_FindEntry(start1);
+	int start = src.FindEntry(start1);
 	if (start < 0 && start2)
 	{
 		start1 = start2;
-		start = WAD_FindEntry(start1);
+		start = src.FindEntry(start1);
 	}
 
 	if (start < 0)
 		return;
 
-	int end = WAD_FindEntry(end1);
+	int end = src.FindEntry(end1);
 	if (end < 0 && end2)
 	{
 		end1 = end2;
-		end = WAD_FindEntry(end1);
+		end = src.FindEntry(end1);
 	}
 
 	if (end < 0)
@@ -1038,10 +1060,10 @@ static void DoMergeSection(char ch, const char *start1, const char *start2,
 	for (int i = start+1; i < end; i++)
 	{
 		// skip other markers (e.g. F1_START)
-		if (WAD_EntryLen(i) == 0)
+		if (src.EntryLen(i) == 0)
 			continue;
 
-		DM_AddSectionLump(ch, WAD_EntryName(i), DoLoadLump(i));
+		DM_AddSectionLump(ch, src.EntryName(i), DoLoadLump(src, i));
 	}
 }
 
@@ -1061,16 +1083,18 @@ int DM_wad_merge_sections(lua_State *L)
 	if (! MatchExtension(pkg_name, "wad"))
 		return luaL_error(L, "wad_merge_sections: file extension is not WAD: %s\n", pkg_name);
 
-	if (! WAD_OpenRead(pkg_name))
+	wad_reader_c src;
+
+	if (! src.Open(pkg_name))
 		return luaL_error(L, "wad_merge_sections: bad WAD file: %s", pkg_name);
 
-	DoMergeSection('P', "P_START", "PP_START", "P_END", "PP_END");
-	DoMergeSection('S', "S_START", "SS_START", "S_END", "SS_END");
-	DoMergeSection('F', "F_START", "FF_START", "F_END", "FF_END");
-	DoMergeSection('C', "C_START",  NULL,      "C_END",  NULL);
-	DoMergeSection('T', "TX_START", NULL,      "TX_END", NULL);
+	DoMergeSection(src, 'P', "P_START", "PP_START", "P_END", "PP_END");
+	DoMergeSection(src, 'S', "S_START", "SS_START", "S_END", "SS_END");
+	DoMergeSection(src, 'F', "F_START", "FF_START", "F_END", "FF_END");
+	DoMergeSection(src, 'C', "C_START",  NULL,      "C_END",  NULL);
+	DoMergeSection(src, 'T', "TX_START", NULL,      "TX_END", NULL);
 
-	WAD_CloseRead();
+	src.Close();
 
 	return 0;
 }
@@ -1132,21 +1156,23 @@ int DM_wad_read_text_lump(lua_State *L)
 	if (! MatchExtension(pkg_name, "wad"))
 		return luaL_error(L, "wad_read_text_lump: file extension is not WAD: %s\n", pkg_name);
 
-	if (! WAD_OpenRead(pkg_name))
+	wad_reader_c src;
+
+	if (! src.Open(pkg_name))
 		return luaL_error(L, "wad_read_text_lump: bad WAD file: %s", pkg_name);
 
-	int entry = WAD_FindEntry(src_lump);
+	int entry = src.FindEntry(src_lump);
 	if (entry < 0)
 	{
-		WAD_CloseRead();
+		src.Close();
 
 		lua_pushnil(L);
 		return 1;
 	}
 
-	qLump_c *lump = DoLoadLump(entry);
+	qLump_c *lump = DoLoadLump(src, entry);
 
-	WAD_CloseRead();
+	src.Close();
 
 	// create the table
 	lua_newtable(L);
@@ -1252,33 +1278,166 @@ static rgb_color_t Grab_Color(lua_State *L, int stack_idx)
 }
 
 
-static byte PaletteLookup(rgb_color_t col, const rgb_color_t *palette)
+//
+// This maps RGB colors to the nearest color in a palette, giving exactly
+// the same result as checking every color (on ties the lowest index
+// wins).  The color cube is divided into 32x32x32 cells, and each cell
+// remembers which palette colors could be the nearest one for a color
+// inside that cell, usually only a handful.  Cells are computed when
+// first needed.
+//
+
+#define QUANT_BITS   5
+#define QUANT_SHIFT  (8 - QUANT_BITS)
+#define QUANT_CELLS  (1 << (QUANT_BITS * 3))
+
+class palette_quantizer_c
 {
-	int r = RGB_RED(col);
-	int g = RGB_GREEN(col);
-	int b = RGB_BLUE(col);
+private:
+	rgb_color_t palette[256];
 
-	int best = 0;
-	int best_dist = (1 << 30);
+	int num_colors;
 
-	// ignore the very last color
-	for (int c = 0 ; c < 255 ; c++)
+	// position in 'candidates' for each cell, -1 if not computed yet
+	std::vector<int> cell_pos;
+	std::vector<int> cell_len;
+
+	std::vector<byte> candidates;
+
+public:
+	palette_quantizer_c() : num_colors(255), cell_pos(), cell_len(), candidates()
+	{
+		memset(palette, 0, sizeof(palette));
+
+		Clear();
+	}
+
+	~palette_quantizer_c()
+	{ }
+
+	// only the first 'count' colors of the palette are used
+	void SetPalette(const rgb_color_t *pal, int count)
+	{
+		SYS_ASSERT(1 <= count && count <= 256);
+
+		memcpy(palette, pal, count * sizeof(rgb_color_t));
+
+		num_colors = count;
+
+		Clear();
+	}
+
+	byte Lookup(rgb_color_t col)
 	{
-		int dr = r - RGB_RED(palette[c]);
-		int dg = g - RGB_GREEN(palette[c]);
-		int db = b - RGB_BLUE(palette[c]);
+		int r = RGB_RED(col);
+		int g = RGB_GREEN(col);
+		int b = RGB_BLUE(col);
+
+		int cell = ((r >> QUANT_SHIFT) << (QUANT_BITS * 2)) |
+		           ((g >> QUANT_SHIFT) <<  QUANT_BITS) |
+		            (b >> QUANT_SHIFT);
+
+		if (cell_pos[cell] < 0)
+			BuildCell(cell);
 
-		int dist = dr*dr + dg*dg + db*db;
+		const byte *cand = &candidates[cell_pos[cell]];
 
-		if (dist < best_dist)
+		int len = cell_len[cell];
+
+		if (len == 1)
+			return cand[0];
+
+		int best = cand[0];
+		int best_dist = (1 << 30);
+
+		for (int i = 0 ; i < len ; i++)
 		{
-			best = c;
-			best_dist = dist;
+			int c = cand[i];
+
+			int dr = r - RGB_RED(palette[c]);
+			int dg = g - RGB_GREEN(palette[c]);
+			int db = b - RGB_BLUE(palette[c]);
+
+			int dist = dr*dr + dg*dg + db*db;
+
+			if (dist < best_dist)
+			{
+				best = c;
+				best_dist = dist;
+			}
 		}
+
+		return best;
 	}
 
-	return best;
-}
+private:
+	void Clear()
+	{
+		cell_pos.assign(QUANT_CELLS, -1);
+		cell_len.assign(QUANT_CELLS, 0);
+
+		candidates.clear();
+	}
+
+	static inline int AxisMin(int v, int lo, int hi)
+	{
+		if (v < lo) return lo - v;
+		if (v > hi) return v - hi;
+
+		return 0;
+	}
+
+	static inline int AxisMax(int v, int lo, int hi)
+	{
+		return MAX(abs(v - lo), abs(v - hi));
+	}
+
+	void BuildCell(int cell)
+	{
+		int lo_r = ((cell >> (QUANT_BITS * 2)) & ((1 << QUANT_BITS) - 1)) << QUANT_SHIFT;
+		int lo_g = ((cell >>  QUANT_BITS)      & ((1 << QUANT_BITS) - 1)) << QUANT_SHIFT;
+		int lo_b = ( cell                      & ((1 << QUANT_BITS) - 1)) << QUANT_SHIFT;
+
+		int hi_r = lo_r + (1 << QUANT_SHIFT) - 1;
+		int hi_g = lo_g + (1 << QUANT_SHIFT) - 1;
+		int hi_b = lo_b + (1 << QUANT_SHIFT) - 1;
+
+		int min_dist[256];
+
+		// the nearest color for any point in the cell is never further
+		// away than the smallest "furthest distance" of all the colors.
+		int limit = (1 << 30);
+
+		for (int c = 0 ; c < num_colors ; c++)
+		{
+			int r = RGB_RED(palette[c]);
+			int g = RGB_GREEN(palette[c]);
+			int b = RGB_BLUE(palette[c]);
+
+			int dr = AxisMin(r, lo_r, hi_r);
+			int dg = AxisMin(g, lo_g, hi_g);
+			int db = AxisMin(b, lo_b, hi_b);
+
+			min_dist[c] = dr*dr + dg*dg + db*db;
+
+			dr = AxisMax(r, lo_r, hi_r);
+			dg = AxisMax(g, lo_g, hi_g);
+			db = AxisMax(b, lo_b, hi_b);
+
+			limit = MIN(limit, dr*dr + dg*dg + db*db);
+		}
+
+		cell_pos[cell] = (int)candidates.size();
+
+		for (int c = 0 ; c < num_colors ; c++)
+		{
+			if (min_dist[c] <= limit)
+				candidates.push_back((byte) c);
+		}
+
+		cell_len[cell] = (int)candidates.size() - cell_pos[cell];
+	}
+};
 
 
 //------------------------------------------------------------------------
@@ -1295,6 +1454,8 @@ static rgb_color_t * title_pix;
 
 static rgb_color_t title_palette[256];
 
+static palette_quantizer_c title_quantizer;
+
 typedef enum
 {
 	REND_Solid = 0,
@@ -1438,31 +1599,64 @@ static bool TitleCacheImage(const char *filename)
 }
 
 
-static int TitleAveragePixel(int x, int y)
+static void TitleDownsample(rgb_color_t *dest)
 {
-	x *= 3;
-	y *= 3;
+	// box filter: each output pixel is the average of a 3x3 block.
+	// the channels are summed in separate arrays, one output row at
+	// a time, which lets the compiler vectorise these loops.
 
-	// compute average
-	int r = 0;
-	int g = 0;
-	int b = 0;
+	std::vector<int> sum_r(title_W);
+	std::vector<int> sum_g(title_W);
+	std::vector<int> sum_b(title_W);
 
-	for (int ky = 0 ; ky < 3 ; ky++)
-	for (int kx = 0 ; kx < 3 ; kx++)
+	for (int y = 0 ; y < title_H ; y++)
 	{
-		const rgb_color_t c = title_pix[(y + ky) * title_W3 + (x + kx)];
+		std::fill(sum_r.begin(), sum_r.end(), 0);
+		std::fill(sum_g.begin(), sum_g.end(), 0);
+		std::fill(sum_b.begin(), sum_b.end(), 0);
+
+		for (int ky = 0 ; ky < 3 ; ky++)
+		{
+			const rgb_color_t *src = &title_pix[(y*3 + ky) * title_W3];
+
+			for (int x = 0 ; x < title_W ; x++)
+			{
+				rgb_color_t c0 = src[x*3 + 0];
+				rgb_color_t c1 = src[x*3 + 1];
+				rgb_color_t c2 = src[x*3 + 2];
+
+				sum_r[x] += RGB_RED(c0)   + RGB_RED(c1)   + RGB_RED(c2);
+				sum_g[x] += RGB_GREEN(c0) + RGB_GREEN(c1) + RGB_GREEN(c2);
+				sum_b[x] += RGB_BLUE(c0)  + RGB_BLUE(c1)  + RGB_BLUE(c2);
+			}
+		}
 
-		r += RGB_RED(c);
-		g += RGB_GREEN(c);
-		b += RGB_BLUE(c);
+		rgb_color_t *out = &dest[y * title_W];
+
+		for (int x = 0 ; x < title_W ; x++)
+		{
+			out[x] = MAKE_RGBA(sum_r[x] / 9, sum_g[x] / 9, sum_b[x] / 9, 255);
+		}
 	}
+}
 
-	r = r / 9;
-	g = g / 9;
-	b = b / 9;
 
-	return MAKE_RGBA(r, g, b, 255);
+static byte * TitleConvertPixels()
+{
+	rgb_color_t *pixels = new rgb_color_t[title_W * title_H];
+
+	TitleDownsample(pixels);
+
+	byte *conv_pixels = new byte[title_W * title_H];
+
+	for (int i = 0 ; i < title_W * title_H ; i++)
+	{
+		conv_pixels[i] = title_quantizer.Lookup(pixels[i]);
+	}
+
+	delete[] pixels;
+
+	return conv_pixels;
 }
 
 
@@ -1494,33 +1688,30 @@ static qLump_c * TitleCreateTGA()
 	lump->AddByte(24); // pixel_bits
 	lump->AddByte(0);  // attributes
 
+	rgb_color_t *pixels = new rgb_color_t[title_W * title_H];
+
+	TitleDownsample(pixels);
+
 	for (int y = title_H-1 ; y >= 0 ; y--)
 	for (int x = 0 ; x < title_W ; x++)
 	{
-		rgb_color_t col = TitleAveragePixel(x, y);
+		rgb_color_t col = pixels[y * title_W + x];
 
 		lump->AddByte( RGB_BLUE(col));
 		lump->AddByte(RGB_GREEN(col));
 		lump->AddByte(  RGB_RED(col));
 	}
 
+	delete[] pixels;
+
 	return lump;
 }
 
 
 static qLump_c * TitleCreatePatch()
 {
-	// convert image to the palette  [ this is very slow! ]
-
-	byte *conv_pixels = new byte[title_W * title_H];
-
-	for (int y = 0 ; y < title_H ; y++)
-	for (int x = 0 ; x < title_W ; x++)
-	{
-		rgb_color_t col = TitleAveragePixel(x, y);
-
-		conv_pixels[y * title_W + x] = PaletteLookup(col, title_palette);
-	}
+	// convert image to the palette
+	byte *conv_pixels = TitleConvertPixels();
 
 	qLump_c *lump = DM_CreatePatch(title_W, title_H, 0, 0, conv_pixels, title_W, title_H);
 
@@ -1532,17 +1723,8 @@ static qLump_c * TitleCreatePatch()
 
 static qLump_c * TitleCreateRaw()
 {
-	// convert image to the palette  [ this is very slow! ]
-
-	byte *conv_pixels = new byte[title_W * title_H];
-
-	for (int y = 0 ; y < title_H ; y++)
-	for (int x = 0 ; x < title_W ; x++)
-	{
-		rgb_color_t col = TitleAveragePixel(x, y);
-
-		conv_pixels[y * title_W + x] = PaletteLookup(col, title_palette);
-	}
+	// convert image to the palette
+	byte *conv_pixels = TitleConvertPixels();
 
 	qLump_c *lump = new qLump_c;
 
@@ -1616,6 +1798,9 @@ int DM_title_set_palette(lua_State *L)
 		title_palette[c] = MAKE_RGBA(r, g, b, 255);
 	}
 
+	// ignore the very last color
+	title_quantizer.SetPalette(title_palette, 255);
+
 	return 0;
 }
 
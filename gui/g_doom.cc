@@ -24,6 +24,7 @@
 #include "hdr_ui.h"
 
 #include "lib_file.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "lib_wad.h"
 
@@ -199,6 +200,8 @@ void DM_AddSectionLump(char ch, const char *name, qLump_c *lump)
 
 bool DM_StartWAD(const char *filename)
 {
+	WAD_SetWriteBuffer(wad_buffer_kb * 1024, direct_io);
+
 	if (! WAD_OpenWrite(filename))
 	{
 		DLG_ShowError(_("Unable to create wad file:\n\n%s"), strerror(errno));
@@ -222,7 +225,8 @@ bool DM_EndWAD()
 	DM_WriteSections();
 	DM_ClearSections();
 
-	WAD_CloseWrite();
+	if (! WAD_CloseWrite())
+		errors_seen++;
 
 	return (errors_seen == 0);
 }
@@ -615,6 +619,11 @@ static void GB_DisplayClose(void)
 	/* does nothing */
 }
 
+static void GB_ParallelFor(int count, void (* func)(int index, void *priv), void *priv)
+{
+	Thread_ParallelFor(count, func, priv);
+}
+
 static const nodebuildfuncs_t edge_build_funcs =
 {
 	GB_FatalError,
@@ -626,7 +635,10 @@ static const nodebuildfuncs_t edge_build_funcs =
 	GB_DisplaySetBar,
 	GB_DisplaySetBarLimit,
 	GB_DisplaySetBarText,
-	GB_DisplayClose
+	GB_DisplayClose,
+
+	NULL,  // parallel_for (set in DM_BuildNodes)
+	0
 };
 
 
@@ -647,6 +659,15 @@ static bool DM_BuildNodes(const char *filename, const char *out_name)
 	nb_info.force_normal = TRUE;
 	nb_info.fast = TRUE;
 
+	nodebuildfuncs_t funcs = edge_build_funcs;
+
+	// with a single thread the serial code is quicker
+	if (Thread_Count() > 1)
+	{
+		funcs.parallel_for = GB_ParallelFor;
+		funcs.parallel_threads = Thread_Count();
+	}
+
 	glbsp_ret_e ret = GlbspCheckInfo(&nb_info, &nb_comms);
 
 	if (ret != GLBSP_E_OK)
@@ -659,7 +680,7 @@ static bool DM_BuildNodes(const char *filename, const char *out_name)
 		return false;
 	}
 
-	ret = GlbspBuildNodes(&nb_info, &edge_build_funcs, &nb_comms);
+	ret = GlbspBuildNodes(&nb_info, &funcs, &nb_comms);
 
 	if (ret == GLBSP_E_Cancelled)
 	{
@@ -689,13 +710,18 @@ class doom_game_interface_c : public game_interface_c
 private:
 	const char *filename;
 
+	// the WAD is written here first, the node builder then
+	// produces the real file from it.
+	char *temp_name;
+
 public:
-	doom_game_interface_c() : filename(NULL)
+	doom_game_interface_c() : filename(NULL), temp_name(NULL)
 	{ }
 
 	~doom_game_interface_c()
 	{
 		StringFree(filename);
+		StringFree(temp_name);
 	}
 
 	bool Start(const char *preset);
@@ -729,10 +755,11 @@ bool doom_game_interface_c::Start(const char *preset)
 		return false;
 	}
 
-	if (create_backups)
-		Main_BackupFile(filename, "old");
+	StringFree(temp_name);
+
+	temp_name = ReplaceExtension(filename, "tmp");
 
-	if (! DM_StartWAD(filename))
+	if (! DM_StartWAD(temp_name))
 	{
 		Main_ProgStatus(_("Error (create file)"));
 		return false;
@@ -747,22 +774,28 @@ bool doom_game_interface_c::Start(const char *preset)
 
 bool doom_game_interface_c::BuildNodes()
 {
-	char *temp_name = ReplaceExtension(filename, "tmp");
+	// the output is built under another name and then renamed,
+	// so the file never exists in a half-written state.
+	char *part_name = ReplaceExtension(filename, "part");
 
-	FileDelete(temp_name);
+	FileDelete(part_name);
 
-	if (! FileRename(filename, temp_name))
+	bool result = DM_BuildNodes(temp_name, part_name);
+
+	// the existing file is copied (not renamed) for the backup, so
+	// the rename below is the only step which changes the target.
+	if (result && create_backups)
+		Main_BackupFile(filename, "old", true /* copy */);
+
+	if (result && ! FileReplace(part_name, filename))
 	{
-		LogPrintf("WARNING: could not rename file to .TMP!\n");
-		StringFree(temp_name);
-		return false;
+		LogPrintf("WARNING: could not rename .PART file to: %s\n", filename);
+		result = false;
 	}
 
-	bool result = DM_BuildNodes(temp_name, filename);
+	FileDelete(part_name);
 
-	FileDelete(temp_name);
-
-	StringFree(temp_name);
+	StringFree(part_name);
 
 	return result;
 }
@@ -770,20 +803,18 @@ bool doom_game_interface_c::BuildNodes()
 
 bool doom_game_interface_c::Finish(bool build_ok)
 {
-	// TODO: handle write errors
-	DM_EndWAD();
+	if (! DM_EndWAD())
+		build_ok = false;
 
 	if (build_ok)
 	{
 		build_ok = BuildNodes();
 	}
 
-	if (! build_ok)
-	{
-		// remove the WAD if an error occurred
-		FileDelete(filename);
-	}
-	else
+	// on error the previous file (if any) is left untouched
+	FileDelete(temp_name);
+
+	if (build_ok)
 	{
 		Recent_AddFile(RECG_Output, filename);
 	}
@@ -66,7 +66,7 @@
 #define MODEL_PADDING  1.0
 
 
-extern void Q1_ClippingHull(int hull);
+extern void Q1_ClippingHulls();
 
 
 static char *level_name;
@@ -205,7 +205,7 @@ static void CreateLogoMip(qLump_c *lump, const char *name, const byte *data,
 }
 
 
-static void TransferOneMipTex(qLump_c *lump, unsigned int m, const char *name)
+static void TransferOneMipTex(wad_reader_c& tex_wad, qLump_c *lump, unsigned int m, const char *name)
 {
 	static byte relief_colors[8] =  // yellow range
 	{
@@ -238,12 +238,21 @@ static void TransferOneMipTex(qLump_c *lump, unsigned int m, const char *name)
 		return;
 	}
 
-	int entry = WAD2_FindEntry(name);
+	int entry = tex_wad.FindEntry(name);
 
 	if (entry >= 0)
 	{
 		int pos    = 0;
-		int length = WAD2_EntryLen(entry);
+		int length = tex_wad.EntryLen(entry);
+
+		const byte *data = tex_wad.EntryData(entry);
+
+		// mapped texture wad: take the data straight from it
+		if (data)
+		{
+			lump->Append(data, length);
+			return;
+		}
 
 		byte buffer[1024];
 
@@ -251,7 +260,7 @@ static void TransferOneMipTex(qLump_c *lump, unsigned int m, const char *name)
 		{
 			int actual = MIN(1024, length);
 
-			if (! WAD2_ReadData(entry, pos, actual, buffer))
+			if (! tex_wad.ReadData(entry, pos, actual, buffer))
 				Main_FatalError("Error reading texture data in wad!");
 
 			lump->Append(buffer, actual);
@@ -323,7 +332,9 @@ static void Q1_WriteMipTex()
 		return; /* NOT REACHED */
 	}
 
-	if (! WAD2_OpenRead(qk_texture_wad))
+	wad_reader_c tex_wad(true /* WAD2 */);
+
+	if (! tex_wad.Open(qk_texture_wad))
 	{
 		// should not happen, Lua code has checked that the file exists
 		Main_FatalError("Missing wad file: %s\n", qk_texture_wad);
@@ -342,10 +353,10 @@ static void Q1_WriteMipTex()
 		offsets[m] = dir_size + (u32_t)lump->GetSize();
 		offsets[m] = LE_U32(offsets[m]);
 
-		TransferOneMipTex(lump, m, q1_miptexs[m].c_str());
+		TransferOneMipTex(tex_wad, lump, m, q1_miptexs[m].c_str());
 	}
 
-	WAD2_CloseRead();
+	tex_wad.Close();
 
 	// create miptex directory
 	num_miptex = LE_S32(num_miptex);
@@ -1247,10 +1258,7 @@ static void Q1_ClipModels()
 	q1_clip = BSP_NewLump(LUMP_CLIPNODES);
 	q1_total_clip = 0;
 
-	for (int hull = 1 ; hull < 6 ; hull++)
-	{
-		Q1_ClippingHull(hull);
-	}
+	Q1_ClippingHulls();
 }
 
 
@@ -1303,7 +1311,7 @@ static void Q1_LightWorld()
 }
 
 
-static void Q1_VisWorld(int base_leafs)
+void Q1_VisWorld(int base_leafs)
 {
 	if (main_win)
 		main_win->build_box->Prog_Step("Vis");
@@ -1321,12 +1329,18 @@ static void Q1_VisWorld(int base_leafs)
 }
 
 
-static void Q1_CreateBSPFile(const char *name)
+void Q1_SetLightingMode()
 {
 	q_mono_lighting = true;
 
 	if (qk_sub_format == SUBFMT_HalfLife)
 		q_mono_lighting = false;
+}
+
+
+static void Q1_CreateBSPFile(const char *name)
+{
+	Q1_SetLightingMode();
 
 	BSP_OpenLevel(name);
 
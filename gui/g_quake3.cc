@@ -19,6 +19,9 @@
 //------------------------------------------------------------------------
 
 #include "headers.h"
+
+#include <algorithm>
+
 #include "hdr_fltk.h"
 #include "hdr_lua.h"
 #include "hdr_ui.h"
@@ -64,6 +67,9 @@
 static char *level_name;
 static char *description;
 
+// combine faces into larger draw surfaces (see Q3_MergeSurfaces)
+static bool merge_surfaces = true;
+
 static char *water_shader;
 static char *slime_shader;
 static char * lava_shader;
@@ -765,6 +771,40 @@ static inline void DoWriteSurface(dsurface3_t & raw_surf)
 }
 
 
+static int Q3_FaceLightmapNum(const quake_face_c *face)
+{
+	if (face->lmap && face->lmap->offset >= 0)
+		return face->lmap->offset;
+
+	return LIGHTMAP_BY_VERTEX;
+}
+
+
+static void Q3_SurfaceShader(quake_face_c *face, dsurface3_t *raw_surf)
+{
+	const char *texture = face->texture.c_str();
+
+	// lighting and texture...
+
+	raw_surf->lightmapNum = Q3_FaceLightmapNum(face);
+
+	face->GetNormal(raw_surf->lightmapVecs[2]);
+
+
+	// TODO : ability to specify flags and contents
+	int flags    = 0;
+	int contents = CONTENTS_SOLID;
+
+	if (strstr(texture, "skies/") != NULL)
+		flags |= SURF_NOIMPACT | SURF_NOMARKS | SURF_NOLIGHTMAP | SURF_NODLIGHT | SURF_NOSTEPS;
+
+	else if (strstr(texture, "liquids/") != NULL)
+		flags |= SURF_NOIMPACT | SURF_NOMARKS | SURF_NOLIGHTMAP | SURF_NODLIGHT | SURF_NOSTEPS;
+
+	raw_surf->shaderNum = Q3_AddShader(texture, flags, contents);
+}
+
+
 static void Q3_AddSurface(quake_face_c *face)
 {
 	// already added?
@@ -773,8 +813,346 @@ static void Q3_AddSurface(quake_face_c *face)
 
 	face->index = q3_total_surfaces;
 
-	const char *texture = face->texture.c_str();
+	dsurface3_t raw_surf;
+
+	memset(&raw_surf, 0, sizeof(raw_surf));
+
+	raw_surf.fogNum = -1;
+	raw_surf.surfaceType = MST_PLANAR;
+
+	Q3_TriangulateSurface(face, &raw_surf);
+
+	Q3_SurfaceShader(face, &raw_surf);
+
+	DoWriteSurface(raw_surf);
+}
+
+
+//------------------------------------------------------------------------
+//  VERTEX CACHE ORDERING
+//------------------------------------------------------------------------
+
+// The triangles of a merged surface are reordered so that the GPU's
+// post-transform vertex cache gets more hits, using the method from
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".  Then the
+// vertices are renumbered in the order they are first used.
+//
+// The result is measured as the ACMR (average cache misses per
+// triangle) of a simple FIFO cache, and reported in the log.
+
+#define VCACHE_MODEL_SIZE  32   // LRU cache used for scoring
+#define VCACHE_FIFO_SIZE   16   // FIFO cache used for the ACMR
+
+static int q3_acmr_triangles;
+static int q3_acmr_misses_before;
+static int q3_acmr_misses_after;
+
+
+static int Q3_CountCacheMisses(const std::vector<int>& indexes)
+{
+	int fifo[VCACHE_FIFO_SIZE];
+	int pos = 0;
+
+	for (int k = 0 ; k < VCACHE_FIFO_SIZE ; k++)
+		fifo[k] = -1;
+
+	int misses = 0;
+
+	for (unsigned int i = 0 ; i < indexes.size() ; i++)
+	{
+		bool found = false;
+
+		for (int k = 0 ; k < VCACHE_FIFO_SIZE ; k++)
+		{
+			if (fifo[k] == indexes[i])
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (found)
+			continue;
+
+		misses++;
+
+		fifo[pos] = indexes[i];
+		pos = (pos + 1) % VCACHE_FIFO_SIZE;
+	}
+
+	return misses;
+}
+
+
+static float Q3_VertexCacheScore(int cache_pos, int remaining)
+{
+	// no triangles left to use this vertex
+	if (remaining == 0)
+		return -1.0;
+
+	float score = 0;
+
+	if (cache_pos < 0)
+	{
+		// not in the cache
+	}
+	else if (cache_pos < 3)
+	{
+		// used by the last triangle.  a fixed score is given,
+		// otherwise it depends on which order it was added.
+		score = 0.75;
+	}
+	else
+	{
+		float scale = 1.0 - (cache_pos - 3) / (float)(VCACHE_MODEL_SIZE - 3);
+
+		score = pow(scale, 1.5);
+	}
+
+	// bonus for vertices with few triangles left, so lone
+	// triangles are not left behind.
+	score += 2.0 * pow(remaining, -0.5);
+
+	return score;
+}
+
+
+static void Q3_OptimizeTriangles(std::vector<ddrawvert3_t>& verts, std::vector<int>& indexes)
+{
+	int num_verts = (int)verts.size();
+	int num_tris  = (int)indexes.size() / 3;
+
+	if (num_tris < 2)
+		return;
+
+	int before = Q3_CountCacheMisses(indexes);
+
+	// triangles using each vertex
+	std::vector< std::vector<int> > vert_tris(num_verts);
+
+	for (int t = 0 ; t < num_tris ; t++)
+		for (int k = 0 ; k < 3 ; k++)
+			vert_tris[indexes[t*3 + k]].push_back(t);
+
+	std::vector<int>   remaining(num_verts);
+	std::vector<int>   cache_pos(num_verts, -1);
+	std::vector<float> vert_score(num_verts);
+
+	for (int v = 0 ; v < num_verts ; v++)
+	{
+		remaining[v]  = (int)vert_tris[v].size();
+		vert_score[v] = Q3_VertexCacheScore(-1, remaining[v]);
+	}
+
+	std::vector<float> tri_score(num_tris);
+	std::vector<bool>  tri_done(num_tris, false);
+
+	for (int t = 0 ; t < num_tris ; t++)
+		tri_score[t] = vert_score[indexes[t*3]] + vert_score[indexes[t*3+1]] + vert_score[indexes[t*3+2]];
+
+	std::vector<int> cache;
+	std::vector<int> new_indexes;
+
+	new_indexes.reserve(indexes.size());
+
+	int best_tri = -1;
+
+	for (int count = 0 ; count < num_tris ; count++)
+	{
+		// when nothing in the cache was usable, check every triangle
+		if (best_tri < 0)
+		{
+			float best_score = -1;
+
+			for (int t = 0 ; t < num_tris ; t++)
+			{
+				if (! tri_done[t] && tri_score[t] > best_score)
+				{
+					best_score = tri_score[t];
+					best_tri   = t;
+				}
+			}
+		}
+
+		SYS_ASSERT(best_tri >= 0);
+
+		tri_done[best_tri] = true;
+
+		// add it, and move its vertices to the front of the cache
+
+		std::vector<int> new_cache;
+
+		for (int k = 0 ; k < 3 ; k++)
+		{
+			int v = indexes[best_tri*3 + k];
+
+			new_indexes.push_back(v);
+
+			if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+				new_cache.push_back(v);
+
+			std::vector<int>& list = vert_tris[v];
+
+			list.erase(std::find(list.begin(), list.end(), best_tri));
+
+			remaining[v] -= 1;
+		}
+
+		for (unsigned int i = 0 ; i < cache.size() ; i++)
+		{
+			if (std::find(new_cache.begin(), new_cache.end(), cache[i]) == new_cache.end())
+				new_cache.push_back(cache[i]);
+		}
+
+		// vertices pushed out of the cache, their triangles need new
+		// scores too (those still touching the cache get them below).
+		for (unsigned int i = VCACHE_MODEL_SIZE ; i < new_cache.size() ; i++)
+		{
+			int v = new_cache[i];
+
+			cache_pos[v]  = -1;
+			vert_score[v] = Q3_VertexCacheScore(-1, remaining[v]);
+		}
+
+		for (unsigned int i = VCACHE_MODEL_SIZE ; i < new_cache.size() ; i++)
+		{
+			const std::vector<int>& list = vert_tris[new_cache[i]];
+
+			for (unsigned int j = 0 ; j < list.size() ; j++)
+			{
+				int t = list[j];
+
+				tri_score[t] = vert_score[indexes[t*3]] + vert_score[indexes[t*3+1]] + vert_score[indexes[t*3+2]];
+			}
+		}
+
+		if (new_cache.size() > VCACHE_MODEL_SIZE)
+			new_cache.resize(VCACHE_MODEL_SIZE);
+
+		cache.swap(new_cache);
+
+		for (unsigned int i = 0 ; i < cache.size() ; i++)
+		{
+			int v = cache[i];
+
+			cache_pos[v]  = (int)i;
+			vert_score[v] = Q3_VertexCacheScore((int)i, remaining[v]);
+		}
+
+		// update scores of triangles touching the cache, and find the
+		// best one.  ties go to the lowest numbered triangle.
+
+		best_tri = -1;
+
+		float best_score = -1;
+
+		for (unsigned int i = 0 ; i < cache.size() ; i++)
+		{
+			const std::vector<int>& list = vert_tris[cache[i]];
+
+			for (unsigned int j = 0 ; j < list.size() ; j++)
+			{
+				int t = list[j];
+
+				tri_score[t] = vert_score[indexes[t*3]] + vert_score[indexes[t*3+1]] + vert_score[indexes[t*3+2]];
+
+				if (tri_score[t] > best_score ||
+					(tri_score[t] == best_score && t < best_tri))
+				{
+					best_score = tri_score[t];
+					best_tri   = t;
+				}
+			}
+		}
+	}
+
+	// renumber the vertices in the order they are first used
+
+	std::vector<int> remap(num_verts, -1);
+	std::vector<ddrawvert3_t> new_verts;
+
+	new_verts.reserve(num_verts);
+
+	for (unsigned int i = 0 ; i < new_indexes.size() ; i++)
+	{
+		int v = new_indexes[i];
+
+		if (remap[v] < 0)
+		{
+			remap[v] = (int)new_verts.size();
+			new_verts.push_back(verts[v]);
+		}
+
+		new_indexes[i] = remap[v];
+	}
+
+	// keep any unused vertices, though there should not be any
+	for (int v = 0 ; v < num_verts ; v++)
+		if (remap[v] < 0)
+			new_verts.push_back(verts[v]);
+
+	verts.swap(new_verts);
+	indexes.swap(new_indexes);
+
+	q3_acmr_triangles     += num_tris;
+	q3_acmr_misses_before += before;
+	q3_acmr_misses_after  += Q3_CountCacheMisses(indexes);
+}
+
+
+//------------------------------------------------------------------------
+//  SURFACE MERGING
+//------------------------------------------------------------------------
+
+// Writing one surface per face produces a huge number of tiny
+// surfaces, and each one costs the renderer a separate batch.
+// Here faces on the same plane which share a shader and lightmap
+// block (and are in the same cluster) are written as a single
+// surface, with identical drawverts shared.
+//
+// The limits match the defaults of q3map2.
+
+#define MERGE_MAX_VERTS    64
+#define MERGE_MAX_INDEXES  1000
+
+
+class q3_face_group_c
+{
+public:
+	std::vector<quake_face_c *> faces;
+
+	// upper limits (actual numbers can be less)
+	int num_verts;
+	int num_indexes;
+
+public:
+	q3_face_group_c() : faces(), num_verts(0), num_indexes(0)
+	{ }
+
+	~q3_face_group_c()
+	{ }
+};
+
+
+static int Q3_FindDrawVert(std::vector<ddrawvert3_t>& verts, const ddrawvert3_t *V)
+{
+	for (unsigned int i = 0 ; i < verts.size() ; i++)
+		if (memcmp(&verts[i], V, sizeof(ddrawvert3_t)) == 0)
+			return (int)i;
+
+	verts.push_back(*V);
 
+	return (int)verts.size() - 1;
+}
+
+
+static void Q3_WriteGroupSurface(q3_face_group_c *G)
+{
+	if (G->faces.size() == 1)
+	{
+		Q3_AddSurface(G->faces[0]);
+		return;
+	}
 
 	dsurface3_t raw_surf;
 
@@ -783,38 +1161,193 @@ static void Q3_AddSurface(quake_face_c *face)
 	raw_surf.fogNum = -1;
 	raw_surf.surfaceType = MST_PLANAR;
 
+	std::vector<ddrawvert3_t> verts;
+	std::vector<int> indexes;
 
-	Q3_TriangulateSurface(face, &raw_surf);
+	for (unsigned int k = 0 ; k < G->faces.size() ; k++)
+	{
+		quake_face_c *face = G->faces[k];
 
+		face->index = q3_total_surfaces;
 
-	// lighting and texture...
+		int num_v = (int)face->verts.size();
 
-	raw_surf.lightmapNum = LIGHTMAP_BY_VERTEX;
+		if (num_v + 2 > MAX_FACE_VERTS)
+			Main_FatalError("Quake3 build failure: face with more than %d verts\n", MAX_FACE_VERTS);
 
-	if (face->lmap && face->lmap->offset >= 0)
-	{
-		raw_surf.lightmapNum = face->lmap->offset;
+		ddrawvert3_t raw_verts[MAX_FACE_VERTS];
+		int remap[MAX_FACE_VERTS];
+
+		for (int i = 0 ; i < num_v ; i++)
+		{
+			Q3_CreateDrawVert(face, &face->verts[i], &raw_verts[i]);
+			remap[i] = Q3_FindDrawVert(verts, &raw_verts[i]);
+		}
+
+		// same triangulation as Q3_TriangulateSurface
+		if (FaceHasDegenTriangle(face))
+		{
+			Q3_AverageDrawVert(raw_verts, num_v, &raw_verts[num_v]);
+			remap[num_v] = Q3_FindDrawVert(verts, &raw_verts[num_v]);
+
+			for (int i = 0 ; i < num_v ; i++)
+			{
+				indexes.push_back(remap[num_v]);
+				indexes.push_back(remap[(i == 0) ? num_v - 1 : (i - 1)]);
+				indexes.push_back(remap[i]);
+			}
+		}
+		else
+		{
+			for (int i = 2 ; i < num_v ; i++)
+			{
+				indexes.push_back(remap[0]);
+				indexes.push_back(remap[i - 1]);
+				indexes.push_back(remap[i]);
+			}
+		}
 	}
 
-	face->GetNormal(raw_surf.lightmapVecs[2]);
+	Q3_OptimizeTriangles(verts, indexes);
 
+	raw_surf.firstVert  = q3_total_drawverts;
+	raw_surf.numVerts   = (int)verts.size();
 
-	// TODO : ability to specify flags and contents
-	int flags    = 0;
-	int contents = CONTENTS_SOLID;
+	raw_surf.firstIndex = q3_total_indexes;
+	raw_surf.numIndexes = (int)indexes.size();
 
-	if (strstr(texture, "skies/") != NULL)
-		flags |= SURF_NOIMPACT | SURF_NOMARKS | SURF_NOLIGHTMAP | SURF_NODLIGHT | SURF_NOSTEPS;
+	for (unsigned int i = 0 ; i < indexes.size() ; i++)
+		Q3_WriteDrawIndex(indexes[i]);
 
-	else if (strstr(texture, "liquids/") != NULL)
-		flags |= SURF_NOIMPACT | SURF_NOMARKS | SURF_NOLIGHTMAP | SURF_NODLIGHT | SURF_NOSTEPS;
+	for (unsigned int i = 0 ; i < verts.size() ; i++)
+		Q3_WriteDrawVert(&verts[i]);
 
-	raw_surf.shaderNum = Q3_AddShader(texture, flags, contents);
+	// all faces share the shader, lightmap and normal
+	Q3_SurfaceShader(G->faces[0], &raw_surf);
 
 	DoWriteSurface(raw_surf);
 }
 
 
+static std::string Q3_MergeKey(quake_face_c *face, int cluster)
+{
+	// planes are compared after rounding, faces on the same brush
+	// side will always match, and a near miss only means the faces
+	// are kept separate.
+
+	const quake_plane_c& P = face->plane;
+
+	char buffer[256];
+
+	snprintf(buffer, sizeof(buffer), "%d:%d:%d:%d:%d:%d:",
+			 cluster, Q3_FaceLightmapNum(face),
+			 I_ROUND(P.nx * 4096.0), I_ROUND(P.ny * 4096.0),
+			 I_ROUND(P.nz * 4096.0), I_ROUND(P.CalcDist() * 16.0));
+
+	return std::string(buffer) + face->texture;
+}
+
+
+static void Q3_MergeSurfaces(const std::vector<quake_leaf_c *>& leafs, bool use_clusters)
+{
+	// the groups are kept in the order they are created, hence the
+	// surfaces are written in the order the faces are visited.
+
+	std::vector<q3_face_group_c *> groups;
+
+	std::map<std::string, int> open_groups;
+
+	int num_faces = 0;
+
+	for (unsigned int n = 0 ; n < leafs.size() ; n++)
+	{
+		quake_leaf_c *leaf = leafs[n];
+
+		int cluster = -1;
+
+		if (use_clusters && leaf->medium != MEDIUM_SOLID)
+			cluster = leaf->cluster ? leaf->cluster->CalcID() : 0;
+
+		for (unsigned int i = 0 ; i < leaf->faces.size() ; i++)
+		{
+			quake_face_c *face = leaf->faces[i];
+
+			// already written, or in a group?
+			if (face->index != -1)
+				continue;
+
+			face->index = -2;
+
+			num_faces++;
+
+			int face_verts   = (int)face->verts.size() + 1;
+			int face_indexes = (int)face->verts.size() * 3;
+
+			std::string key = Q3_MergeKey(face, cluster);
+
+			std::map<std::string, int>::iterator IT = open_groups.find(key);
+
+			q3_face_group_c *G = NULL;
+
+			if (IT != open_groups.end())
+			{
+				G = groups[IT->second];
+
+				if (G->num_verts   + face_verts   > MERGE_MAX_VERTS ||
+					G->num_indexes + face_indexes > MERGE_MAX_INDEXES)
+				{
+					G = NULL;
+				}
+			}
+
+			if (! G)
+			{
+				G = new q3_face_group_c;
+
+				open_groups[key] = (int)groups.size();
+
+				groups.push_back(G);
+			}
+
+			G->faces.push_back(face);
+
+			G->num_verts   += face_verts;
+			G->num_indexes += face_indexes;
+		}
+	}
+
+	for (unsigned int k = 0 ; k < groups.size() ; k++)
+	{
+		// Q3_AddSurface needs this
+		for (unsigned int i = 0 ; i < groups[k]->faces.size() ; i++)
+			groups[k]->faces[i]->index = -1;
+
+		Q3_WriteGroupSurface(groups[k]);
+
+		delete groups[k];
+	}
+
+	if (num_faces > 0)
+		LogPrintf("Merged %d faces into %d surfaces\n", num_faces, (int)groups.size());
+}
+
+
+static void Q3_CollectLeafs(quake_node_c *node, std::vector<quake_leaf_c *>& leafs)
+{
+	// same order as Q3_WriteNode
+
+	if (node->front_N)
+		Q3_CollectLeafs(node->front_N, leafs);
+	else
+		leafs.push_back(node->front_L);
+
+	if (node->back_N)
+		Q3_CollectLeafs(node->back_N, leafs);
+	else
+		leafs.push_back(node->back_L);
+}
+
+
 static void Q3_WriteLeafSurf(int index)
 {
 	SYS_ASSERT(index >= 0);
@@ -877,17 +1410,27 @@ static void Q3_WriteLeaf(quake_leaf_c *leaf)
 
 	// create the 'mark surfs'
 
-	// NOTE : currently surfaces are NEVER shared between leafs
-	//        [ but the Q3 format allows this ]
+	// NOTE : surfaces are only shared between leafs when faces have
+	//        been merged (and then only within a cluster).
 
 	raw_leaf.firstLeafSurface = q3_total_leaf_surfs;
 	raw_leaf.numLeafSurfaces  = 0;
 
+	std::vector<int> written;
+
 	for (unsigned int i = 0 ; i < leaf->faces.size() ; i++)
 	{
 		Q3_AddSurface(leaf->faces[i]);
 
-		Q3_WriteLeafSurf(leaf->faces[i]->index);
+		int index = leaf->faces[i]->index;
+
+		// several faces can belong to the same merged surface
+		if (std::find(written.begin(), written.end(), index) != written.end())
+			continue;
+
+		written.push_back(index);
+
+		Q3_WriteLeafSurf(index);
 
 		raw_leaf.numLeafSurfaces += 1;
 	}
@@ -1006,6 +1549,10 @@ static void Q3_WriteBSP()
 	q3_total_leaf_surfs = 0;
 	q3_total_leaf_brushes = 0;
 
+	q3_acmr_triangles = 0;
+	q3_acmr_misses_before = 0;
+	q3_acmr_misses_after  = 0;
+
 	q3_nodes = BSP_NewLump(LUMP_NODES);
 	q3_leafs = BSP_NewLump(LUMP_LEAFS);
 
@@ -1030,6 +1577,15 @@ static void Q3_WriteBSP()
 	// we create a unused leaf, like q3map2 does
 	Q3_WriteDummyLeaf();
 
+	if (merge_surfaces)
+	{
+		std::vector<quake_leaf_c *> leafs;
+
+		Q3_CollectLeafs(qk_bsp_root, leafs);
+
+		Q3_MergeSurfaces(leafs, true /* use_clusters */);
+	}
+
 	Q3_WriteNode(qk_bsp_root);
 
 
@@ -1079,13 +1635,22 @@ static void Q3_CreateSubModel(quake_leaf_c *L)
 	raw_model.firstSurface = q3_total_surfaces;
 	raw_model.firstBrush   = (int)q3_brushes.size();
 
+	if (merge_surfaces)
+	{
+		std::vector<quake_leaf_c *> leafs;
+
+		leafs.push_back(L);
+
+		Q3_MergeSurfaces(leafs, false /* use_clusters */);
+	}
+
 	for (unsigned int i = 0 ; i < L->faces.size() ; i++)
 	{
 		Q3_AddSurface(L->faces[i]);
-
-		raw_model.numSurfaces += 1;
 	}
 
+	raw_model.numSurfaces = q3_total_surfaces - raw_model.firstSurface;
+
 	for (unsigned int k = 0 ; k < L->brushes.size() ; k++)
 	{
 		Q3_AddBrush(L->brushes[k]);
@@ -1147,6 +1712,14 @@ static void Q3_WriteModels()
 	{
 		Q3_CreateSubModel(qk_all_detail_models[k]);
 	}
+
+	if (q3_acmr_triangles > 0)
+	{
+		LogPrintf("Vertex cache ACMR: %1.3f --> %1.3f  (%d triangles in merged surfaces)\n",
+				  q3_acmr_misses_before / (double)q3_acmr_triangles,
+				  q3_acmr_misses_after  / (double)q3_acmr_triangles,
+				  q3_acmr_triangles);
+	}
 }
 
 
@@ -1328,6 +1901,8 @@ bool quake3_game_interface_c::Start(const char *preset)
 
 	q3_default_tex_scale = 1.0 / 128.0;
 
+	merge_surfaces = true;
+
 	// this is not used here
 	qk_world_model = NULL;
 
@@ -1415,6 +1990,10 @@ void quake3_game_interface_c::Property(const char *key, const char *value)
 	{
 		lava_shader = StringDup(value);
 	}
+	else if (StringCaseCmp(key, "merge_surfaces") == 0)
+	{
+		merge_surfaces = (atoi(value) > 0);
+	}
 	else
 	{
 		LogPrintf("WARNING: unknown QUAKE3 property: %s=%s\n", key, value);
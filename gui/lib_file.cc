@@ -31,7 +31,9 @@
 
 #ifdef UNIX
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #endif
@@ -299,6 +301,19 @@ bool FileRename(const char *old_name, const char *new_name)
 }
 
 
+bool FileReplace(const char *old_name, const char *new_name)
+{
+	// like FileRename, but any existing file is replaced atomically
+#ifdef WIN32
+	return (::MoveFileEx(old_name, new_name, MOVEFILE_REPLACE_EXISTING) != 0);
+
+#else // UNIX or MacOSX
+
+	return (rename(old_name, new_name) == 0);
+#endif
+}
+
+
 bool FileDelete(const char *filename)
 {
 #ifdef WIN32
@@ -387,6 +402,90 @@ void FileFree(const byte *mem)
 }
 
 
+//
+// Maps a whole file into memory (read only).  Returns NULL when it
+// cannot be done, e.g. the file is empty.
+//
+const byte *FileMap(const char *filename, int *length)
+{
+	*length = 0;
+
+#ifdef WIN32
+	HANDLE file = ::CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+							   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	DWORD size = ::GetFileSize(file, NULL);
+
+	if (size == INVALID_FILE_SIZE || size == 0 || size > INT_MAX)
+	{
+		::CloseHandle(file);
+		return NULL;
+	}
+
+	HANDLE mapping = ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	// the view keeps the file open by itself
+	::CloseHandle(file);
+
+	if (! mapping)
+		return NULL;
+
+	void *mem = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	::CloseHandle(mapping);
+
+	if (! mem)
+		return NULL;
+
+	*length = (int)size;
+
+	return (const byte *)mem;
+
+#else // UNIX or MacOSX
+
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	struct stat finfo;
+
+	if (fstat(fd, &finfo) != 0 || finfo.st_size <= 0 || finfo.st_size > INT_MAX)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *mem = mmap(NULL, (size_t)finfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	*length = (int)finfo.st_size;
+
+	return (const byte *)mem;
+#endif
+}
+
+
+void FileUnmap(const byte *mem, int length)
+{
+	if (! mem)
+		return;
+
+#ifdef WIN32
+	::UnmapViewOfFile(mem);
+#else
+	munmap((void *)mem, (size_t)length);
+#endif
+}
+
+
 //
 // Note: returns false when the path doesn't exist.
 //
@@ -42,6 +42,7 @@ void FilenameGetPath(char *dest, size_t maxsize, const char *filename);
 bool FileExists(const char *filename);
 bool FileCopy(const char *src_name, const char *dest_name);
 bool FileRename(const char *old_name, const char *new_name);
+bool FileReplace(const char *old_name, const char *new_name);
 bool FileDelete(const char *filename);
 bool FileChangeDir(const char *dir_name);
 bool FileMakeDir(const char *dir_name);
@@ -49,6 +50,9 @@ bool FileMakeDir(const char *dir_name);
 byte *FileLoad(const char *filename, int *length);
 void  FileFree(const byte *mem);
 
+const byte *FileMap(const char *filename, int *length);
+void  FileUnmap(const byte *mem, int length);
+
 const char * FileFindInPath(const char *paths, const char *base_name);
 
 // miscellanous
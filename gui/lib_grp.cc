@@ -20,6 +20,7 @@
 
 #include "headers.h"
 #include "main.h"
+#include "m_addons.h"
 
 #include <list>
 
@@ -27,6 +28,7 @@
 #include "physfs.h"
 #endif
 
+#include "lib_file.h"
 #include "lib_util.h"
 #include "lib_grp.h"
 
@@ -48,6 +50,12 @@ static raw_grp_header_t  grp_R_header;
 static raw_grp_lump_t * grp_R_dir;
 static u32_t * grp_R_starts;
 
+static archive_index_c grp_R_index;
+
+// when the file is on disk, it is also memory-mapped
+static const byte * grp_R_mem;
+static int grp_R_mem_len;
+
 
 static const byte grp_magic_data[GRP_MAGIC_LEN] =
 {
@@ -153,12 +161,32 @@ bool GRP_OpenRead(const char *filename)
 		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, L->start, L->length, L->name);
 	}
 
+	// names are not NUL terminated when they use all the space
+	for (int i = 0 ; i < (int)grp_R_header.num_lumps ; i++)
+		grp_R_index.Add(grp_R_dir[i].name, i, GRP_NAME_LEN);
+
+#ifdef HAVE_PHYSFS
+	grp_R_mem = VFS_MapFile(filename, &grp_R_mem_len);
+#else
+	grp_R_mem = FileMap(filename, &grp_R_mem_len);
+#endif
+
 	return true; // OK
 }
 
 
 void GRP_CloseRead(void)
 {
+	if (grp_R_mem)
+	{
+#ifdef HAVE_PHYSFS
+		VFS_UnmapFile(grp_R_mem, grp_R_mem_len);
+#else
+		FileUnmap(grp_R_mem, grp_R_mem_len);
+#endif
+		grp_R_mem = NULL;
+	}
+
 #ifdef HAVE_PHYSFS
 	PHYSFS_close(grp_R_fp);
 #else
@@ -172,6 +200,8 @@ void GRP_CloseRead(void)
 
 	grp_R_dir = NULL;
 	grp_R_starts = NULL;
+
+	grp_R_index.Clear();
 }
 
 
@@ -183,18 +213,7 @@ int GRP_NumEntries(void)
 
 int GRP_FindEntry(const char *name)
 {
-	for (unsigned int i = 0 ; i < grp_R_header.num_lumps ; i++)
-	{
-		char buffer[GRP_NAME_LEN + 4];
-
-		strncpy(buffer, grp_R_dir[i].name, GRP_NAME_LEN);
-		buffer[GRP_NAME_LEN] = 0;
-
-		if (StringCaseCmp(name, buffer) == 0)
-			return i;
-	}
-
-	return -1; // not found
+	return grp_R_index.Find(name);
 }
 
 
@@ -220,6 +239,18 @@ const char * GRP_EntryName(int entry)
 }
 
 
+const byte * GRP_EntryData(int entry)
+{
+	SYS_ASSERT(entry >= 0 && entry < (int)grp_R_header.num_lumps);
+
+	// only possible when the file is memory-mapped
+	if (! grp_R_mem || (u64_t)grp_R_starts[entry] + grp_R_dir[entry].length > (u64_t)grp_R_mem_len)
+		return NULL;
+
+	return grp_R_mem + grp_R_starts[entry];
+}
+
+
 bool GRP_ReadData(int entry, int offset, int length, void *buffer)
 {
 	SYS_ASSERT(entry >= 0 && entry < (int)grp_R_header.num_lumps);
@@ -231,6 +262,14 @@ bool GRP_ReadData(int entry, int offset, int length, void *buffer)
 	if ((u32_t)offset + (u32_t)length > grp_R_dir[entry].length)  // EOF
 		return false;
 
+	const byte *data = GRP_EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
 #ifdef HAVE_PHYSFS
 	if (! PHYSFS_seek(grp_R_fp, L_start + offset))
 		return false;
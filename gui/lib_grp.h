@@ -32,6 +32,9 @@ int  GRP_FindEntry(const char *name);
 int  GRP_EntryLen(int entry);
 const char * GRP_EntryName(int entry);
 
+// pointer to the whole lump, or NULL when the file is not mapped
+const byte * GRP_EntryData(int entry);
+
 bool GRP_ReadData(int entry, int offset, int length, void *buffer);
 
 void GRP_ListEntries(void);
@@ -0,0 +1,176 @@
+//------------------------------------------------------------------------
+//  Memory Pools
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#include "lib_mempool.h"
+
+
+mem_pool_c::mem_pool_c() : slab_pos(NULL), slab_end(NULL), slabs()
+{
+	for (int i = 0 ; i < MEMPOOL_CLASSES ; i++)
+		free_lists[i] = NULL;
+}
+
+
+mem_pool_c::~mem_pool_c()
+{
+	Clear();
+}
+
+
+void mem_pool_c::Clear()
+{
+	for (unsigned int k = 0 ; k < slabs.size() ; k++)
+		free(slabs[k]);
+
+	slabs.clear();
+
+	slab_pos = slab_end = NULL;
+
+	for (int i = 0 ; i < MEMPOOL_CLASSES ; i++)
+		free_lists[i] = NULL;
+}
+
+
+void * mem_pool_c::AllocSmall(int cls)
+{
+	size_t block_size = (size_t)(cls + 1) * MEMPOOL_GRANULE;
+
+	if (slab_pos + block_size > slab_end)
+	{
+		// the rest of the old slab is given to the free lists,
+		// so nothing is wasted.
+		while (slab_pos && slab_pos + MEMPOOL_GRANULE <= slab_end)
+		{
+			int rest = SizeClass(slab_end - slab_pos);
+
+			free_block_t *blk = (free_block_t *)slab_pos;
+
+			blk->next = free_lists[rest];
+			free_lists[rest] = blk;
+
+			slab_pos += (size_t)(rest + 1) * MEMPOOL_GRANULE;
+		}
+
+		byte *slab = (byte *) malloc(MEMPOOL_SLAB_SIZE);
+
+		if (! slab)
+			return NULL;
+
+		slabs.push_back(slab);
+
+		slab_pos = slab;
+		slab_end = slab + MEMPOOL_SLAB_SIZE;
+	}
+
+	void *ptr = slab_pos;
+
+	slab_pos += block_size;
+
+	return ptr;
+}
+
+
+void * mem_pool_c::Alloc(size_t size)
+{
+	if (size == 0)
+		return NULL;
+
+	if (size > MEMPOOL_MAX_SMALL)
+		return malloc(size);
+
+	int cls = SizeClass(size);
+
+	free_block_t *blk = free_lists[cls];
+
+	if (blk)
+	{
+		free_lists[cls] = blk->next;
+		return blk;
+	}
+
+	return AllocSmall(cls);
+}
+
+
+void mem_pool_c::Free(void *ptr, size_t size)
+{
+	if (! ptr)
+		return;
+
+	if (size > MEMPOOL_MAX_SMALL)
+	{
+		free(ptr);
+		return;
+	}
+
+	int cls = SizeClass(size);
+
+	free_block_t *blk = (free_block_t *)ptr;
+
+	blk->next = free_lists[cls];
+	free_lists[cls] = blk;
+}
+
+
+void * mem_pool_c::Realloc(void *ptr, size_t old_size, size_t new_size)
+{
+	if (new_size == 0)
+	{
+		Free(ptr, old_size);
+		return NULL;
+	}
+
+	if (! ptr)
+		return Alloc(new_size);
+
+	bool old_small = (old_size <= MEMPOOL_MAX_SMALL);
+	bool new_small = (new_size <= MEMPOOL_MAX_SMALL);
+
+	if (! old_small && ! new_small)
+		return realloc(ptr, new_size);
+
+	// same block is fine when the size class does not change
+	if (old_small && new_small && SizeClass(old_size) == SizeClass(new_size))
+		return ptr;
+
+	void *new_ptr = Alloc(new_size);
+
+	if (! new_ptr)
+	{
+		// shrinking must never fail, so keep the old block.  It is big
+		// enough, and freeing it later with the new size only puts it
+		// into a smaller size class.
+		if (new_size <= old_size && old_small)
+			return ptr;
+
+		return NULL;
+	}
+
+	memcpy(new_ptr, ptr, MIN(old_size, new_size));
+
+	Free(ptr, old_size);
+
+	return new_ptr;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -0,0 +1,85 @@
+//------------------------------------------------------------------------
+//  Memory Pools
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __LIB_MEMPOOL_H__
+#define __LIB_MEMPOOL_H__
+
+// Small blocks are grouped into size classes, each with its own free
+// list, and are carved out of large slabs.  Bigger blocks go straight
+// to malloc.  The caller must supply the size when freeing (as the
+// Lua allocator interface does), so blocks need no header.
+//
+// A pool is NOT thread-safe, use one per thread (or per Lua state).
+
+#define MEMPOOL_GRANULE    16
+#define MEMPOOL_MAX_SMALL  512
+#define MEMPOOL_CLASSES    (MEMPOOL_MAX_SMALL / MEMPOOL_GRANULE)
+
+#define MEMPOOL_SLAB_SIZE  (64 * 1024)
+
+class mem_pool_c
+{
+private:
+	struct free_block_t
+	{
+		free_block_t *next;
+	};
+
+	free_block_t * free_lists[MEMPOOL_CLASSES];
+
+	// unused part of the current slab
+	byte * slab_pos;
+	byte * slab_end;
+
+	std::vector<byte *> slabs;
+
+public:
+	mem_pool_c();
+	~mem_pool_c();
+
+	void * Alloc(size_t size);
+	void   Free(void *ptr, size_t size);
+
+	// follows realloc() semantics, except that the old size is needed.
+	// a new size of zero frees the block and returns NULL.
+	void * Realloc(void *ptr, size_t old_size, size_t new_size);
+
+	// total memory held for small blocks (it never shrinks).
+	size_t Reserved() const
+	{
+		return slabs.size() * (size_t)MEMPOOL_SLAB_SIZE;
+	}
+
+	// frees everything, including blocks still in use.
+	void Clear();
+
+private:
+	static inline int SizeClass(size_t size)
+	{
+		return (int)((size - 1) / MEMPOOL_GRANULE);
+	}
+
+	void * AllocSmall(int cls);
+};
+
+#endif /* __LIB_MEMPOOL_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -20,6 +20,7 @@
 
 #include "headers.h"
 #include "main.h"
+#include "m_addons.h"
 
 #include <list>
 
@@ -27,6 +28,7 @@
 #include "physfs.h"
 #endif
 
+#include "lib_file.h"
 #include "lib_util.h"
 #include "lib_pak.h"
 
@@ -48,6 +50,12 @@ static raw_pak_header_t r_header;
 
 static raw_pak_entry_t * r_directory;
 
+static archive_index_c r_pak_index;
+
+// when the file is on disk, it is also memory-mapped
+static const byte * r_pak_mem;
+static int r_pak_mem_len;
+
 
 bool PAK_OpenRead(const char *filename)
 {
@@ -162,12 +170,31 @@ bool PAK_OpenRead(const char *filename)
 		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, E->offset, E->length, E->name);
 	}
 
+	for (int i = 0; i < (int)r_header.entry_num; i++)
+		r_pak_index.Add(r_directory[i].name, i);
+
+#ifdef HAVE_PHYSFS
+	r_pak_mem = VFS_MapFile(filename, &r_pak_mem_len);
+#else
+	r_pak_mem = FileMap(filename, &r_pak_mem_len);
+#endif
+
 	return true; // OK
 }
 
 
 void PAK_CloseRead(void)
 {
+	if (r_pak_mem)
+	{
+#ifdef HAVE_PHYSFS
+		VFS_UnmapFile(r_pak_mem, r_pak_mem_len);
+#else
+		FileUnmap(r_pak_mem, r_pak_mem_len);
+#endif
+		r_pak_mem = NULL;
+	}
+
 #ifdef HAVE_PHYSFS
 	PHYSFS_close(r_pak_fp);
 #else
@@ -178,6 +205,8 @@ void PAK_CloseRead(void)
 
 	delete[] r_directory;
 	r_directory = NULL;
+
+	r_pak_index.Clear();
 }
 
 
@@ -189,13 +218,7 @@ int PAK_NumEntries(void)
 
 int PAK_FindEntry(const char *name)
 {
-	for (unsigned int i = 0; i < r_header.entry_num; i++)
-	{
-		if (StringCaseCmp(name, r_directory[i].name) == 0)
-			return i;
-	}
-
-	return -1; // not found
+	return r_pak_index.Find(name);
 }
 
 
@@ -215,6 +238,18 @@ const char * PAK_EntryName(int entry)
 }
 
 
+const byte * PAK_EntryData(int entry)
+{
+	SYS_ASSERT(entry >= 0 && entry < (int)r_header.entry_num);
+
+	// only possible when the file is memory-mapped
+	if (! r_pak_mem || (u64_t)r_directory[entry].offset + r_directory[entry].length > (u64_t)r_pak_mem_len)
+		return NULL;
+
+	return r_pak_mem + r_directory[entry].offset;
+}
+
+
 void PAK_FindMaps(std::vector<int>& entries)
 {
 	entries.resize(0);
@@ -258,6 +293,14 @@ bool PAK_ReadData(int entry, int offset, int length, void *buffer)
 	if ((u32_t)offset + (u32_t)length > E->length)  // EOF
 		return false;
 
+	const byte *data = PAK_EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
 #ifdef HAVE_PHYSFS
 	if (! PHYSFS_seek(r_pak_fp, E->offset + offset))
 		return false;
@@ -300,16 +343,38 @@ void PAK_ListEntries(void)
 //  PAK WRITING
 //------------------------------------------------------------------------
 
+// Each lump is kept in memory until finished, so that duplicates can
+// be found (see lump_dedupe_c).
+
 static FILE *w_pak_fp;
 
-static std::list<raw_pak_entry_t> w_pak_dir;
+static std::vector<raw_pak_entry_t> w_pak_dir;
 
 static raw_pak_entry_t w_pak_entry;
 
+static std::vector<u8_t> w_pak_data;
+
+static bool PAK_ReadBack(u32_t pos, u8_t *buf, int length)
+{
+	long end_pos = ftell(w_pak_fp);
+
+	fseek(w_pak_fp, pos, SEEK_SET);
+
+	bool ok = (fread(buf, length, 1, w_pak_fp) == 1);
+
+	// a seek is needed before writing again anyway
+	fseek(w_pak_fp, end_pos, SEEK_SET);
+
+	return ok;
+}
+
+static lump_dedupe_c w_pak_dedupe(PAK_ReadBack);
+
 
 bool PAK_OpenWrite(const char *filename)
 {
-	w_pak_fp = fopen(filename, "wb");
+	// opened for update, since earlier lumps are read back
+	w_pak_fp = fopen(filename, "w+b");
 
 	if (! w_pak_fp)
 	{
@@ -326,6 +391,8 @@ bool PAK_OpenWrite(const char *filename)
 	fwrite(&header, sizeof(raw_pak_header_t), 1, w_pak_fp);
 	fflush(w_pak_fp);
 
+	w_pak_dedupe.Clear();
+
 	return true;
 }
 
@@ -345,16 +412,10 @@ void PAK_CloseWrite(void)
 	header.dir_start = (int)ftell(w_pak_fp);
 	header.entry_num = 0;
 
-	std::list<raw_pak_entry_t>::iterator PDI;
+	header.entry_num = (u32_t)w_pak_dir.size();
 
-	for (PDI = w_pak_dir.begin(); PDI != w_pak_dir.end(); PDI++)
-	{
-		raw_pak_entry_t *E = & (*PDI);
-
-		fwrite(E, sizeof(raw_pak_entry_t), 1, w_pak_fp);
-
-		header.entry_num++;
-	}
+	if (! w_pak_dir.empty())
+		fwrite(&w_pak_dir[0], sizeof(raw_pak_entry_t), w_pak_dir.size(), w_pak_fp);
 
 	fflush(w_pak_fp);
 
@@ -371,9 +432,16 @@ void PAK_CloseWrite(void)
 	fflush(w_pak_fp);
 	fclose(w_pak_fp);
 
+	if (w_pak_dedupe.shared_lumps > 0)
+		LogPrintf("Shared %d duplicate lumps (%d bytes)\n",
+				  w_pak_dedupe.shared_lumps, w_pak_dedupe.shared_bytes);
+
 	LogPrintf("Closed PAK file\n");
 
 	w_pak_dir.clear();
+	w_pak_dedupe.Clear();
+
+	w_pak_data.clear();
 }
 
 
@@ -385,7 +453,7 @@ void PAK_NewLump(const char *name)
 
 	strcpy(w_pak_entry.name, name);
 
-	w_pak_entry.offset = (u32_t)ftell(w_pak_fp);
+	w_pak_data.clear();
 }
 
 
@@ -396,29 +464,47 @@ bool PAK_AppendData(const void *data, int length)
 
 	SYS_ASSERT(length > 0);
 
-	return (fwrite(data, length, 1, w_pak_fp) == 1);
+	const u8_t *src = (const u8_t *)data;
+
+	w_pak_data.insert(w_pak_data.end(), src, src + length);
+
+	return true;
 }
 
 
 void PAK_FinishLump(void)
 {
-	int len = (int)ftell(w_pak_fp) - (int)w_pak_entry.offset;
+	int len = (int)w_pak_data.size();
 
-	// pad lumps to a multiple of four bytes
-	int padding = ALIGN_LEN(len) - len;
+	u32_t offset = (u32_t)ftell(w_pak_fp);
 
-	if (padding > 0)
+	if (len > 0)
 	{
-		static u8_t zeros[4] = { 0,0,0,0 };
+		const u8_t *data = &w_pak_data[0];
+
+		if (! w_pak_dedupe.Check(data, len, &offset))
+		{
+			fwrite(data, len, 1, w_pak_fp);
+
+			// pad lumps to a multiple of four bytes
+			int padding = ALIGN_LEN(len) - len;
+
+			if (padding > 0)
+			{
+				static u8_t zeros[4] = { 0,0,0,0 };
 
-		fwrite(zeros, padding, 1, w_pak_fp);
+				fwrite(zeros, padding, 1, w_pak_fp);
+			}
+		}
 	}
 
 	// fix endianness
-	w_pak_entry.offset = LE_U32(w_pak_entry.offset);
+	w_pak_entry.offset = LE_U32(offset);
 	w_pak_entry.length = LE_U32(len);
 
 	w_pak_dir.push_back(w_pak_entry);
+
+	w_pak_data.clear();
 }
 
 
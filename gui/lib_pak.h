@@ -34,6 +34,9 @@ void PAK_FindMaps(std::vector<int>& entries);
 int  PAK_EntryLen(int entry);
 const char * PAK_EntryName(int entry);
 
+// pointer to the whole lump, or NULL when the file is not mapped
+const byte * PAK_EntryData(int entry);
+
 bool PAK_ReadData(int entry, int offset, int length, void *buffer);
 
 void PAK_ListEntries(void);
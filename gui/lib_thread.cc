@@ -0,0 +1,277 @@
+//------------------------------------------------------------------------
+//  Worker Threads
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "lib_thread.h"
+#include "main.h"
+
+
+#define MAX_THREADS  64
+
+
+static std::vector<std::thread> workers;
+
+// only one parallel-for can use the pool at a time
+static std::mutex pool_mutex;
+
+static std::mutex job_mutex;
+static std::condition_variable job_cond;
+static std::condition_variable done_cond;
+
+// the current job, protected by job_mutex
+static thread_job_f job_func;
+static void * job_data;
+static int  job_count;
+static int  job_busy;
+static unsigned int job_serial;
+static bool job_quit;
+
+static std::atomic<int> job_next;
+
+// set by Thread_JobError, job_error is protected by job_mutex
+static std::atomic<bool> job_failed;
+static std::string job_error;
+
+// thrown by Thread_JobError, caught in RunJobs
+class thread_job_error_c
+{ };
+
+static thread_local int  thread_index = 0;
+static thread_local bool thread_in_job = false;
+
+
+static void RunJobs(thread_job_f func, void *priv_dat, int count)
+{
+	thread_in_job = true;
+
+	try
+	{
+		for (;;)
+		{
+			int index = job_next.fetch_add(1);
+
+			if (index >= count || job_failed)
+				break;
+
+			(* func)(index, priv_dat);
+		}
+	}
+	catch (thread_job_error_c&)
+	{
+		// reported by Thread_ParallelFor
+	}
+
+	thread_in_job = false;
+}
+
+
+static void WorkerLoop(int index)
+{
+	thread_index = index;
+
+	unsigned int seen_serial = 0;
+
+	for (;;)
+	{
+		thread_job_f func;
+		void *priv_dat;
+		int count;
+
+		{
+			std::unique_lock<std::mutex> lock(job_mutex);
+
+			while (! job_quit && job_serial == seen_serial)
+				job_cond.wait(lock);
+
+			if (job_quit)
+				return;
+
+			seen_serial = job_serial;
+
+			func     = job_func;
+			priv_dat = job_data;
+			count    = job_count;
+		}
+
+		RunJobs(func, priv_dat, count);
+
+		{
+			std::unique_lock<std::mutex> lock(job_mutex);
+
+			job_busy--;
+
+			if (job_busy == 0)
+				done_cond.notify_all();
+		}
+	}
+}
+
+
+void Thread_Init(int num_threads)
+{
+	Thread_Shutdown();
+
+	if (num_threads <= 0)
+		num_threads = (int)std::thread::hardware_concurrency();
+
+	num_threads = CLAMP(1, num_threads, MAX_THREADS);
+
+	job_quit = false;
+
+	for (int i = 1 ; i < num_threads ; i++)
+		workers.push_back(std::thread(WorkerLoop, i));
+
+	// make sure the workers are gone before static objects (like the
+	// mutexes above) get destroyed, even when exit() is called.
+	static bool registered = false;
+
+	if (! registered && ! workers.empty())
+	{
+		atexit(Thread_Shutdown);
+		registered = true;
+	}
+
+	LogPrintf("Using %d thread%s\n", num_threads, (num_threads == 1) ? "" : "s");
+}
+
+
+void Thread_Shutdown()
+{
+	if (workers.empty())
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(job_mutex);
+
+		job_quit = true;
+		job_cond.notify_all();
+	}
+
+	for (unsigned int i = 0 ; i < workers.size() ; i++)
+	{
+		// a worker cannot join itself (e.g. a fatal error in a job)
+		if (thread_index == 0)
+			workers[i].join();
+		else
+			workers[i].detach();
+	}
+
+	workers.clear();
+}
+
+
+int Thread_Count()
+{
+	return 1 + (int)workers.size();
+}
+
+
+int Thread_Index()
+{
+	return thread_index;
+}
+
+
+bool Thread_InJob()
+{
+	return thread_in_job;
+}
+
+
+void Thread_JobError(const char *msg)
+{
+	{
+		std::unique_lock<std::mutex> lock(job_mutex);
+
+		if (! job_failed)
+		{
+			job_error  = msg;
+			job_failed = true;
+		}
+	}
+
+	throw thread_job_error_c();
+}
+
+
+void Thread_ParallelFor(int count, thread_job_f func, void *priv_dat)
+{
+	if (count <= 0)
+		return;
+
+	std::unique_lock<std::mutex> pool_lock(pool_mutex, std::defer_lock);
+
+	if (workers.empty() || count == 1 || thread_in_job || ! pool_lock.try_lock())
+	{
+		for (int i = 0 ; i < count ; i++)
+			(* func)(i, priv_dat);
+
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(job_mutex);
+
+		job_func  = func;
+		job_data  = priv_dat;
+		job_count = count;
+		job_busy  = (int)workers.size();
+
+		job_next.store(0);
+		job_failed = false;
+
+		job_serial++;
+
+		job_cond.notify_all();
+	}
+
+	// the calling thread helps out too
+	RunJobs(func, priv_dat, count);
+
+	bool failed;
+	std::string error;
+
+	{
+		std::unique_lock<std::mutex> lock(job_mutex);
+
+		while (job_busy > 0)
+			done_cond.wait(lock);
+
+		failed = job_failed;
+		error.swap(job_error);
+
+		job_failed = false;
+	}
+
+	pool_lock.unlock();
+
+	if (failed)
+		Main_FatalError("%s", error.c_str());
+}
+
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
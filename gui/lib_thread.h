@@ -0,0 +1,69 @@
+//------------------------------------------------------------------------
+//  Worker Threads
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __LIB_THREAD_H__
+#define __LIB_THREAD_H__
+
+typedef void (* thread_job_f)(int index, void *priv_dat);
+
+void Thread_Init(int num_threads);
+// creates the pool of worker threads.  The number is the total
+// amount of threads which run jobs, including the main thread,
+// hence a value of 1 means everything runs serially.  A value
+// of zero (or less) picks the number of CPUs.
+
+void Thread_Shutdown();
+// stops and joins all the worker threads.
+
+int Thread_Count();
+// the number of threads which can run jobs (at least 1).
+
+int Thread_Index();
+// returns 0 for the main thread, 1..N-1 for the worker threads.
+// this is handy for picking a per-thread buffer inside a job.
+
+void Thread_ParallelFor(int count, thread_job_f func, void *priv_dat = NULL);
+// calls func(i, priv_dat) for every i in [0, count), spreading
+// the calls over the worker threads and the calling thread, and
+// returns once they have all finished.  Indices are handed out
+// one at a time, so jobs of uneven size still balance well.
+//
+// When called from inside a job (or by another thread while the
+// pool is busy), the calls are simply done serially.  Jobs must
+// not touch the Lua state or the GUI.
+//
+// A fatal error inside a job (see Thread_JobError) stops any more
+// jobs from starting, and once the others have finished, it is
+// reported here via Main_FatalError on the calling thread.
+
+bool Thread_InJob();
+// true when the calling thread is running a Thread_ParallelFor job.
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+void Thread_JobError(const char *msg);
+// used by Main_FatalError when called inside a job.  The message is
+// remembered (only the first one is kept) and the job is abandoned.
+
+#endif /* __LIB_THREAD_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
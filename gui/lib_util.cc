@@ -20,6 +20,7 @@
 
 #include "headers.h"
 
+#include "lib_crc.h"
 #include "lib_util.h"
 
 #ifdef UNIX
@@ -264,6 +265,181 @@ u32_t StringHash(const char *str)
 }
 
 
+//------------------------------------------------------------------------
+
+archive_index_c::archive_index_c() : names(), entries(), slots()
+{ }
+
+archive_index_c::~archive_index_c()
+{ }
+
+
+void archive_index_c::Clear()
+{
+	names.clear();
+	entries.clear();
+	slots.clear();
+}
+
+
+u32_t archive_index_c::NameHash(const char *name)
+{
+	// FNV-1a, ignoring case
+	u32_t hash = 2166136261u;
+
+	for ( ; *name ; name++)
+	{
+		hash ^= (byte) toupper((unsigned char) *name);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+void archive_index_c::Grow()
+{
+	unsigned int new_size = slots.empty() ? 64 : slots.size() * 2;
+
+	slots.assign(new_size, -1);
+
+	for (unsigned int i = 0 ; i < names.size() ; i++)
+	{
+		unsigned int pos = NameHash(names[i].c_str()) & (new_size - 1);
+
+		while (slots[pos] >= 0)
+			pos = (pos + 1) & (new_size - 1);
+
+		slots[pos] = (int)i;
+	}
+}
+
+
+void archive_index_c::Add(const char *name, int entry, int max_len)
+{
+	std::string upper;
+
+	for (int i = 0 ; name[i] && (max_len < 0 || i < max_len) ; i++)
+		upper += (char) toupper((unsigned char) name[i]);
+
+	if (Find(upper.c_str()) >= 0)
+		return;
+
+	names.push_back(upper);
+	entries.push_back(entry);
+
+	// keep the table at most half full
+	if (names.size() * 2 > slots.size())
+	{
+		Grow();
+		return;
+	}
+
+	unsigned int mask = slots.size() - 1;
+	unsigned int pos  = NameHash(upper.c_str()) & mask;
+
+	while (slots[pos] >= 0)
+		pos = (pos + 1) & mask;
+
+	slots[pos] = (int)names.size() - 1;
+}
+
+
+int archive_index_c::Find(const char *name) const
+{
+	if (slots.empty())
+		return -1;
+
+	// the stored names are upper case, so the hash and comparison
+	// simply upper-case the given name as they go.
+	unsigned int mask = slots.size() - 1;
+	unsigned int pos  = NameHash(name) & mask;
+
+	for ( ; slots[pos] >= 0 ; pos = (pos + 1) & mask)
+	{
+		const char *A = names[slots[pos]].c_str();
+		const char *B = name;
+
+		for ( ; *A && *A == (char) toupper((unsigned char) *B) ; A++, B++)
+		{ }
+
+		if (*A == 0 && *B == 0)
+			return entries[slots[pos]];
+	}
+
+	return -1;  // not found
+}
+
+
+//------------------------------------------------------------------------
+
+lump_dedupe_c::lump_dedupe_c(read_back_func_t _func) :
+	read_back(_func), lumps(), shared_lumps(0), shared_bytes(0)
+{ }
+
+lump_dedupe_c::~lump_dedupe_c()
+{ }
+
+
+void lump_dedupe_c::Clear()
+{
+	lumps.clear();
+
+	shared_lumps = 0;
+	shared_bytes = 0;
+}
+
+
+bool lump_dedupe_c::SameData(u32_t pos, const u8_t *data, int length)
+{
+	u8_t temp[4096];
+
+	for (int ofs = 0 ; ofs < length ; ofs += (int)sizeof(temp))
+	{
+		int count = MIN(length - ofs, (int)sizeof(temp));
+
+		if (! read_back(pos + ofs, temp, count))
+			return false;
+
+		if (memcmp(temp, data + ofs, count) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+
+bool lump_dedupe_c::Check(const u8_t *data, int length, u32_t *pos)
+{
+	crc32_c crc;
+	crc.AddBlock(data, length);
+
+	std::multimap< u32_t, std::pair<u32_t, int> >::iterator LI;
+
+	for (LI = lumps.find(crc.raw) ; LI != lumps.end() && LI->first == crc.raw ; LI++)
+	{
+		if (LI->second.second != length)
+			continue;
+
+		if (SameData(LI->second.first, data, length))
+		{
+			*pos = LI->second.first;
+
+			shared_lumps += 1;
+			shared_bytes += length;
+
+			return true;
+		}
+	}
+
+	lumps.insert(std::make_pair(crc.raw, std::make_pair(*pos, length)));
+
+	return false;
+}
+
+
+//------------------------------------------------------------------------
+
 double PerpDist(double x, double y,
                 double x1, double y1, double x2, double y2)
 {
@@ -38,6 +38,78 @@ void StringReplaceChar(char *str, char old_ch, char new_ch);
 
 char *mem_gets(char *buf, int size, const char ** str_ptr);
 
+/* archive directories */
+
+class archive_index_c
+{
+	// finds entries of an archive directory by name (ignoring case)
+	// using an open-addressing hash table, instead of a linear scan.
+	// when several entries have the same name, the first one wins.
+
+private:
+	std::vector<std::string> names;  // upper case
+	std::vector<int> entries;
+
+	// indices into names[], or -1 for an empty slot
+	std::vector<int> slots;
+
+public:
+	archive_index_c();
+	~archive_index_c();
+
+	void Clear();
+
+	// name does not need to be NUL terminated when max_len >= 0
+	void Add(const char *name, int entry, int max_len = -1);
+
+	// returns -1 if not found
+	int Find(const char *name) const;
+
+private:
+	static u32_t NameHash(const char *name);
+
+	void Grow();
+};
+
+
+class lump_dedupe_c
+{
+	// finds lumps of an output file whose data was already written,
+	// so the directory entry can simply point at the earlier copy.
+	// lumps are matched by checksum and length, and then by their
+	// contents which are read back from the file.
+
+public:
+	// reads 'length' bytes at 'pos' in the output file, returns false
+	// if they cannot be read.
+	typedef bool (* read_back_func_t)(u32_t pos, u8_t *buf, int length);
+
+private:
+	read_back_func_t read_back;
+
+	// checksum --> position and length
+	std::multimap< u32_t, std::pair<u32_t, int> > lumps;
+
+public:
+	int shared_lumps;
+	int shared_bytes;
+
+public:
+	lump_dedupe_c(read_back_func_t _func);
+	~lump_dedupe_c();
+
+	void Clear();
+
+	// returns true when the same data was written before, and 'pos'
+	// is updated to where it is.  Otherwise returns false and the
+	// data is remembered as being written at 'pos'.
+	bool Check(const u8_t *data, int length, u32_t *pos);
+
+private:
+	bool SameData(u32_t pos, const u8_t *data, int length);
+};
+
+
 /* time utilities */
 
 u32_t TimeGetMillies();
@@ -20,13 +20,27 @@
 
 #include "headers.h"
 #include "main.h"
+#include "m_addons.h"
 
 #include <list>
 
+#include <fcntl.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
+
 #ifdef HAVE_PHYSFS
 #include "physfs.h"
 #endif
 
+#include "lib_file.h"
 #include "lib_util.h"
 #include "lib_wad.h"
 
@@ -34,230 +48,328 @@
 
 
 //------------------------------------------------------------------------
-//  WAD READING
+//  WAD READER
 //------------------------------------------------------------------------
 
-#ifdef HAVE_PHYSFS
-static PHYSFS_File *wad_R_fp;
-#else
-static FILE *wad_R_fp;
-#endif
+wad_reader_c::wad_reader_c(bool _wad2) :
+	is_wad2(_wad2), fp(NULL), dir(), index(),
+	mem(NULL), mem_len(0), read_mutex()
+{ }
 
-static raw_wad_header_t  wad_R_header;
-static raw_wad_lump_t * wad_R_dir;
+wad_reader_c::~wad_reader_c()
+{
+	if (fp)
+		Close();
+}
 
-bool WAD_OpenRead(const char *filename)
+
+bool wad_reader_c::Open(const char *filename)
 {
+	const char *what = is_wad2 ? "WAD2" : "WAD";
+
+	SYS_ASSERT(! fp);
+
 #ifdef HAVE_PHYSFS
-	wad_R_fp = PHYSFS_openRead(filename);
+	fp = PHYSFS_openRead(filename);
 #else
-	wad_R_fp = fopen(filename, "rb");
+	fp = fopen(filename, "rb");
 #endif
 
-	if (! wad_R_fp)
+	if (! fp)
 	{
-		LogPrintf("WAD_OpenRead: no such file: %s\n", filename);
+		LogPrintf("%s_OpenRead: no such file: %s\n", what, filename);
 		return false;
 	}
 
-	LogPrintf("Opened WAD file: %s\n", filename);
+	LogPrintf("Opened %s file: %s\n", what, filename);
 
-#ifdef HAVE_PHYSFS
-	if (PHYSFS_read(wad_R_fp, &wad_R_header, sizeof(wad_R_header), 1) != 1)
-#else
-	if (fread(&wad_R_header, sizeof(wad_R_header), 1, wad_R_fp) != 1)
-#endif
+	if (! ReadDirectory())
 	{
-		LogPrintf("WAD_OpenRead: failed reading header\n");
+		dir.clear();
+
 #ifdef HAVE_PHYSFS
-		PHYSFS_close(wad_R_fp);
+		PHYSFS_close(fp);
 #else
-		fclose(wad_R_fp);
+		fclose(fp);
 #endif
+		fp = NULL;
 		return false;
 	}
 
-	if (0 != memcmp(wad_R_header.magic+1, "WAD", 3))
-	{
-		LogPrintf("WAD_OpenRead: not a WAD file!\n");
+	for (unsigned int i = 0 ; i < dir.size() ; i++)
+		index.Add(dir[i].name, (int)i);
+
+#ifdef HAVE_PHYSFS
+	mem = VFS_MapFile(filename, &mem_len);
+#else
+	mem = FileMap(filename, &mem_len);
+#endif
+
+	return true; // OK
+}
+
+
+bool wad_reader_c::ReadDirectory()
+{
+	const char *what = is_wad2 ? "WAD2" : "WAD";
+
+	// the WAD and WAD2 headers have the same layout
+	raw_wad_header_t header;
+
 #ifdef HAVE_PHYSFS
-		PHYSFS_close(wad_R_fp);
+	if (PHYSFS_read(fp, &header, sizeof(header), 1) != 1)
 #else
-		fclose(wad_R_fp);
+	if (fread(&header, sizeof(header), 1, fp) != 1)
 #endif
+	{
+		LogPrintf("%s_OpenRead: failed reading header\n", what);
+		return false;
+	}
+
+	if (is_wad2 ? (memcmp(header.magic, WAD2_MAGIC, 4) != 0) :
+	              (memcmp(header.magic+1, "WAD", 3) != 0))
+	{
+		LogPrintf("%s_OpenRead: not a %s file!\n", what, what);
 		return false;
 	}
 
-	wad_R_header.num_lumps = LE_U32(wad_R_header.num_lumps);
-	wad_R_header.dir_start = LE_U32(wad_R_header.dir_start);
+	header.num_lumps = LE_U32(header.num_lumps);
+	header.dir_start = LE_U32(header.dir_start);
 
 	/* read directory */
 
-	if (wad_R_header.num_lumps >= 5000)  // sanity check
+	if (header.num_lumps >= 5000)  // sanity check
 	{
-		LogPrintf("WAD_OpenRead: bad header (%d entries?)\n", wad_R_header.num_lumps);
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad_R_fp);
-#else
-		fclose(wad_R_fp);
-#endif
+		LogPrintf("%s_OpenRead: bad header (%d entries?)\n", what, header.num_lumps);
 		return false;
 	}
 
 #ifdef HAVE_PHYSFS
-	if (! PHYSFS_seek(wad_R_fp, wad_R_header.dir_start))
+	if (! PHYSFS_seek(fp, header.dir_start))
 #else
-	if (fseek(wad_R_fp, wad_R_header.dir_start, SEEK_SET) != 0)
+	if (fseek(fp, header.dir_start, SEEK_SET) != 0)
 #endif
 	{
-		LogPrintf("WAD_OpenRead: cannot seek to directory (at 0x%08x)\n", wad_R_header.dir_start);
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad_R_fp);
-#else
-		fclose(wad_R_fp);
-#endif
+		LogPrintf("%s_OpenRead: cannot seek to directory (at 0x%08x)\n", what, header.dir_start);
 		return false;
 	}
 
-	wad_R_dir = new raw_wad_lump_t[wad_R_header.num_lumps + 1];
+	size_t raw_size = is_wad2 ? sizeof(raw_wad2_lump_t) : sizeof(raw_wad_lump_t);
 
-	for (int i = 0; i < (int)wad_R_header.num_lumps; i++)
+	for (int i = 0; i < (int)header.num_lumps; i++)
 	{
-		raw_wad_lump_t *L = &wad_R_dir[i];
+		union
+		{
+			raw_wad_lump_t  doom;
+			raw_wad2_lump_t quake;
+		} raw;
 
 #ifdef HAVE_PHYSFS
-		size_t res = PHYSFS_read(wad_R_fp, L, sizeof(raw_wad_lump_t), 1);
+		size_t res = PHYSFS_read(fp, &raw, raw_size, 1);
 		if (res != 1)
 #else
-		int res = fread(L, sizeof(raw_wad_lump_t), 1, wad_R_fp);
-		if (res == EOF || res != 1 || ferror(wad_R_fp))
+		int res = fread(&raw, raw_size, 1, fp);
+		if (res == EOF || res != 1 || ferror(fp))
 #endif
 		{
 			if (i == 0)
 			{
-				LogPrintf("WAD_OpenRead: could not read any dir-entries!\n");
-				WAD_CloseRead();
+				LogPrintf("%s_OpenRead: could not read any dir-entries!\n", what);
 				return false;
 			}
 
-			LogPrintf("WAD_OpenRead: hit EOF reading dir-entry %d\n", i);
+			LogPrintf("%s_OpenRead: hit EOF reading dir-entry %d\n", what, i);
 
 			// truncate directory
-			wad_R_header.num_lumps = i;
 			break;
 		}
 
-		L->start  = LE_U32(L->start);
-		L->length = LE_U32(L->length);
+		entry_t E;
+
+		memset(&E, 0, sizeof(E));
+
+		if (is_wad2)
+		{
+			E.start  = LE_U32(raw.quake.start);
+			E.length = LE_U32(raw.quake.length);
+			E.u_len  = LE_U32(raw.quake.u_len);
+
+			E.type = (raw.quake.compression != 0) ? TYP_COMPRESSED : raw.quake.type;
+
+			// make sure name is NUL terminated.
+			memcpy(E.name, raw.quake.name, 15);
+		}
+		else
+		{
+			E.start  = LE_U32(raw.doom.start);
+			E.length = LE_U32(raw.doom.length);
+			E.u_len  = E.length;
+
+			// entries are often not NUL terminated
+			memcpy(E.name, raw.doom.name, 8);
+		}
+
+		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, E.start, E.length, E.name);
 
-		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, L->start, L->length, L->name);
+		dir.push_back(E);
 	}
 
-	return true; // OK
+	return true;
 }
 
 
-void WAD_CloseRead(void)
+void wad_reader_c::Close()
 {
+	SYS_ASSERT(fp);
+
+	if (mem)
+	{
 #ifdef HAVE_PHYSFS
-	PHYSFS_close(wad_R_fp);
+		VFS_UnmapFile(mem, mem_len);
 #else
-	fclose(wad_R_fp);
+		FileUnmap(mem, mem_len);
 #endif
+		mem = NULL;
+		mem_len = 0;
+	}
 
-	LogPrintf("Closed WAD file\n");
+#ifdef HAVE_PHYSFS
+	PHYSFS_close(fp);
+#else
+	fclose(fp);
+#endif
+
+	fp = NULL;
 
-	delete[] wad_R_dir;
-	wad_R_dir = NULL;
+	LogPrintf("Closed %s file\n", is_wad2 ? "WAD2" : "WAD");
+
+	dir.clear();
+	index.Clear();
 }
 
 
-int WAD_NumEntries(void)
+int wad_reader_c::NumEntries() const
 {
-	return (int)wad_R_header.num_lumps;
+	return (int)dir.size();
 }
 
 
-int WAD_FindEntry(const char *name)
+int wad_reader_c::FindEntry(const char *name) const
 {
-	for (unsigned int i = 0; i < wad_R_header.num_lumps; i++)
-	{
-		char buffer[16];
-		strncpy(buffer, wad_R_dir[i].name, 8);
-		buffer[8] = 0;
+	return index.Find(name);
+}
 
-		if (StringCaseCmp(name, buffer) == 0)
-			return i;
-	}
 
-	return -1; // not found
+int wad_reader_c::EntryLen(int entry) const
+{
+	SYS_ASSERT(entry >= 0 && entry < NumEntries());
+
+	return dir[entry].u_len;
 }
 
 
-int WAD_EntryLen(int entry)
+int wad_reader_c::EntryType(int entry) const
 {
-	SYS_ASSERT(entry >= 0 && entry < (int)wad_R_header.num_lumps);
+	SYS_ASSERT(entry >= 0 && entry < NumEntries());
 
-	return wad_R_dir[entry].length;
+	return dir[entry].type;
 }
 
 
-const char * WAD_EntryName(int entry)
+const char * wad_reader_c::EntryName(int entry) const
 {
-	static char name_buf[16];
+	SYS_ASSERT(entry >= 0 && entry < NumEntries());
+
+	return dir[entry].name;
+}
 
-	SYS_ASSERT(entry >= 0 && entry < (int)wad_R_header.num_lumps);
 
-	// entries are often not NUL terminated, hence return a static copy
-	strncpy(name_buf, wad_R_dir[entry].name, 8);
-	name_buf[8] = 0;
+const byte * wad_reader_c::EntryData(int entry) const
+{
+	SYS_ASSERT(entry >= 0 && entry < NumEntries());
 
-	return name_buf;
+	const entry_t& E = dir[entry];
+
+	// only possible when the file is memory-mapped
+	if (! mem || (u64_t)E.start + E.length > (u64_t)mem_len)
+		return NULL;
+
+	return mem + E.start;
 }
 
 
-bool WAD_ReadData(int entry, int offset, int length, void *buffer)
+bool wad_reader_c::ReadData(int entry, int offset, int length, void *buffer)
 {
-	SYS_ASSERT(entry >= 0 && entry < (int)wad_R_header.num_lumps);
+	SYS_ASSERT(entry >= 0 && entry < NumEntries());
 	SYS_ASSERT(offset >= 0);
 	SYS_ASSERT(length > 0);
 
-	raw_wad_lump_t *L = &wad_R_dir[entry];
+	const entry_t& E = dir[entry];
 
-	if ((u32_t)offset + (u32_t)length > L->length)  // EOF
+	if ((u32_t)offset + (u32_t)length > E.length)  // EOF
 		return false;
 
-#if HAVE_PHYSFS
-	if (! PHYSFS_seek(wad_R_fp, L->start + offset))
+	const byte *data = EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(read_mutex);
+
+#ifdef HAVE_PHYSFS
+	if (! PHYSFS_seek(fp, E.start + offset))
 		return false;
 
-	return (PHYSFS_read(wad_R_fp, buffer, length, 1) == 1);
+	return (PHYSFS_read(fp, buffer, length, 1) == 1);
 #else
-	if (fseek(wad_R_fp, L->start + offset, SEEK_SET) != 0)
+	if (fseek(fp, E.start + offset, SEEK_SET) != 0)
 		return false;
 
-	int res = fread(buffer, length, 1, wad_R_fp);
+	int res = fread(buffer, length, 1, fp);
 	return (res == 1);
 #endif
 }
 
 
-void WAD_ListEntries(void)
+static char LetterForType(int type)
+{
+	switch (type)
+	{
+		case TYP_NONE:    return 'x';
+		case TYP_LABEL:   return 'L';
+		case TYP_PALETTE: return 'C';
+		case TYP_QTEX:    return 'T';
+		case TYP_QPIC:    return 'P';
+		case TYP_SOUND:   return 'S';
+		case TYP_MIPTEX:  return 'M';
+
+		default: return '?';
+	}
+}
+
+
+void wad_reader_c::ListEntries() const
 {
 	printf("--------------------------------------------------\n");
 
-	if (wad_R_header.num_lumps == 0)
+	if (dir.empty())
 	{
-		printf("WAD file is empty\n");
+		printf("%s file is empty\n", is_wad2 ? "WAD2" : "WAD");
 	}
 	else
 	{
-		for (int i = 0; i < (int)wad_R_header.num_lumps; i++)
+		for (int i = 0; i < NumEntries(); i++)
 		{
-			raw_wad_lump_t *L = &wad_R_dir[i];
+			const entry_t& E = dir[i];
 
-			printf("%4d: +%08x %08x : %s\n", i+1, L->start, L->length,
-					WAD_EntryName(i));
+			if (is_wad2)
+				printf("%4d: +%08x %08x %c : %s\n", i+1, E.start, E.length,
+						LetterForType(E.type), E.name);
+			else
+				printf("%4d: +%08x %08x : %s\n", i+1, E.start, E.length, E.name);
 		}
 	}
 
@@ -266,382 +378,489 @@ void WAD_ListEntries(void)
 
 
 //------------------------------------------------------------------------
-//  WAD WRITING
+//  WAD READING
 //------------------------------------------------------------------------
 
-static FILE *wad_W_fp;
-
-static std::list<raw_wad_lump_t> wad_W_directory;
-
-static raw_wad_lump_t wad_W_lump;
+static wad_reader_c wad_R(false);
 
+bool WAD_OpenRead(const char *filename)
+{
+	return wad_R.Open(filename);
+}
 
-bool WAD_OpenWrite(const char *filename)
+void WAD_CloseRead(void)
 {
-	wad_W_fp = fopen(filename, "wb");
+	wad_R.Close();
+}
 
-	if (! wad_W_fp)
-	{
-		LogPrintf("WAD_OpenWrite: cannot create file: %s\n", filename);
-		return false;
-	}
+int WAD_NumEntries(void)
+{
+	return wad_R.NumEntries();
+}
 
-	LogPrintf("Created WAD file: %s\n", filename);
+int WAD_FindEntry(const char *name)
+{
+	return wad_R.FindEntry(name);
+}
 
-	// write out a dummy header
-	raw_wad_header_t header;
-	memset(&header, 0, sizeof(header));
+int WAD_EntryLen(int entry)
+{
+	return wad_R.EntryLen(entry);
+}
 
-	fwrite(&header, sizeof(raw_wad_header_t), 1, wad_W_fp);
-	fflush(wad_W_fp);
+const char * WAD_EntryName(int entry)
+{
+	return wad_R.EntryName(entry);
+}
 
-	return true;
+const byte * WAD_EntryData(int entry)
+{
+	return wad_R.EntryData(entry);
 }
 
+bool WAD_ReadData(int entry, int offset, int length, void *buffer)
+{
+	return wad_R.ReadData(entry, offset, length, buffer);
+}
 
-void WAD_CloseWrite(void)
+void WAD_ListEntries(void)
 {
-	fflush(wad_W_fp);
+	wad_R.ListEntries();
+}
 
-	// write the directory
 
-	LogPrintf("Writing WAD directory\n");
+//------------------------------------------------------------------------
+//  WAD WRITING
+//------------------------------------------------------------------------
 
-	raw_wad_header_t header;
+// The output is collected in a large buffer and written out in whole
+// chunks, and the header is patched at the end (in the buffer itself
+// when the file never grew past it).  With direct I/O the chunks skip
+// the page cache, which helps a lot on network storage.
+//
+// Each lump is kept in memory until finished, so that duplicates can
+// be found (see lump_dedupe_c).
 
-	memcpy(header.magic, "PWAD", sizeof(header.magic));
+#define WAD_DEFAULT_BUFFER  (1 << 20)
+#define WAD_DIRECT_ALIGN    4096
 
-	header.dir_start = (int)ftell(wad_W_fp);
-	header.num_lumps = 0;
+// enough for a full megawad, the vector still grows if needed
+#define WAD_DIR_RESERVE     4096
 
-	std::list<raw_wad_lump_t>::iterator WDI;
+static int  wad_W_buf_size = WAD_DEFAULT_BUFFER;
+static bool wad_W_want_direct = false;
 
-	for (WDI = wad_W_directory.begin(); WDI != wad_W_directory.end(); WDI++)
-	{
-		raw_wad_lump_t *L = & (*WDI);
+static int wad_W_fd = -1;
 
-		fwrite(L, sizeof(raw_wad_lump_t), 1, wad_W_fp);
+static u8_t * wad_W_buffer;
+static int    wad_W_buf_used;
 
-		header.num_lumps++;
-	}
+// bytes already written to the file, the logical position is this
+// plus the amount in the buffer.
+static u32_t wad_W_flushed;
 
-	fflush(wad_W_fp);
+static bool wad_W_direct;
+static bool wad_W_error;
 
-	// finally write the _real_ WAD header
+static std::vector<raw_wad_lump_t> wad_W_directory;
 
-	header.dir_start = LE_U32(header.dir_start);
-	header.num_lumps = LE_U32(header.num_lumps);
+static raw_wad_lump_t wad_W_lump;
 
-	fseek(wad_W_fp, 0, SEEK_SET);
+static std::vector<u8_t> wad_W_lump_data;
 
-	fwrite(&header, sizeof(header), 1, wad_W_fp);
+static const char *wad_W_filename;
 
-	fflush(wad_W_fp);
-	fclose(wad_W_fp);
+// used to read back earlier lumps, opened when first needed
+static FILE *wad_W_verify_fp;
 
-	LogPrintf("Closed WAD file\n");
+static bool WAD_ReadBack(u32_t pos, u8_t *buf, int length);
 
-	wad_W_directory.clear();
-}
+static lump_dedupe_c wad_W_dedupe(WAD_ReadBack);
 
 
-void WAD_NewLump(const char *name)
+void WAD_SetWriteBuffer(int size, bool direct_io)
 {
-	if (strlen(name) > 8)
-		Main_FatalError("WAD_NewLump: name too long: '%s'\n", name);
+	if (size < WAD_DIRECT_ALIGN)
+		size = WAD_DIRECT_ALIGN;
 
-	memset(&wad_W_lump, 0, sizeof(wad_W_lump));
+	// keep it a multiple of the block size (needed for direct I/O)
+	wad_W_buf_size = (size + WAD_DIRECT_ALIGN - 1) & ~(WAD_DIRECT_ALIGN - 1);
+
+	wad_W_want_direct = direct_io;
+}
 
-	strncpy(wad_W_lump.name, name, 8);
 
-	wad_W_lump.start = (u32_t)ftell(wad_W_fp);
+static inline u32_t WAD_WritePos(void)
+{
+	return wad_W_flushed + (u32_t)wad_W_buf_used;
 }
 
 
-bool WAD_AppendData(const void *data, int length)
+static bool WAD_RawWrite(const u8_t *data, int length)
 {
-	if (length == 0)
-		return true;
+	while (length > 0)
+	{
+		int actual = (int)write(wad_W_fd, data, length);
 
-	SYS_ASSERT(length > 0);
+		if (actual < 0 && errno == EINTR)
+			continue;
 
-	return (fwrite(data, length, 1, wad_W_fp) == 1);
-}
+		if (actual <= 0)
+		{
+			LogPrintf("WAD_WriteData: %s\n", strerror(errno));
+			wad_W_error = true;
+			return false;
+		}
 
+		data   += actual;
+		length -= actual;
 
-void WAD_FinishLump(void)
-{
-	int len = (int)ftell(wad_W_fp) - (int)wad_W_lump.start;
+		wad_W_flushed += actual;
+	}
 
-	// pad lumps to a multiple of four bytes
-	int padding = ALIGN_LEN(len) - len;
+	return true;
+}
 
-	if (padding > 0)
+
+static void WAD_StopDirect(void)
+{
+	// the last piece of a file is rarely a whole block, so it gets
+	// written the normal way.
+#ifdef O_DIRECT
+	if (wad_W_direct)
 	{
-		static u8_t zeros[4] = { 0,0,0,0 };
+		int flags = fcntl(wad_W_fd, F_GETFL);
+
+		fcntl(wad_W_fd, F_SETFL, flags & ~O_DIRECT);
 
-		fwrite(zeros, padding, 1, wad_W_fp);
+		wad_W_direct = false;
 	}
+#endif
+}
 
-	// fix endianness
-	wad_W_lump.start  = LE_U32(wad_W_lump.start);
-	wad_W_lump.length = LE_U32(len);
 
-	wad_W_directory.push_back(wad_W_lump);
-}
+static void WAD_FlushBuffer(void)
+{
+	if (wad_W_buf_used == 0)
+		return;
 
+	// a partial block can only be written when direct I/O is off
+	if (wad_W_buf_used & (WAD_DIRECT_ALIGN - 1))
+		WAD_StopDirect();
 
-//------------------------------------------------------------------------
-//  WAD2 READING
-//------------------------------------------------------------------------
+	WAD_RawWrite(wad_W_buffer, wad_W_buf_used);
 
-#ifdef HAVE_PHYSFS
-static PHYSFS_File *wad2_R_fp;
-#else
-static FILE *wad2_R_fp;
-#endif
+	wad_W_buf_used = 0;
+}
 
-static raw_wad2_header_t  wad2_R_header;
-static raw_wad2_lump_t * wad2_R_dir;
 
-bool WAD2_OpenRead(const char *filename)
+static bool WAD_WriteData(const void *data, int length)
 {
-#ifdef HAVE_PHYSFS
-	wad2_R_fp = PHYSFS_openRead(filename);
-#else
-	wad2_R_fp = fopen(filename, "rb");
-#endif
+	const u8_t *src = (const u8_t *)data;
 
-	if (! wad2_R_fp)
+	while (length > 0)
 	{
-		LogPrintf("WAD2_OpenRead: no such file: %s\n", filename);
-		return false;
-	}
+		int count = MIN(length, wad_W_buf_size - wad_W_buf_used);
 
-	LogPrintf("Opened WAD2 file: %s\n", filename);
+		memcpy(wad_W_buffer + wad_W_buf_used, src, count);
 
-#ifdef HAVE_PHYSFS
-	if (PHYSFS_read(wad2_R_fp, &wad2_R_header, sizeof(wad2_R_header), 1) != 1)
-#else
-	if (fread(&wad2_R_header, sizeof(wad2_R_header), 1, wad2_R_fp) != 1)
-#endif
-	{
-		LogPrintf("WAD2_OpenRead: failed reading header\n");
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad2_R_fp);
-#else
-		fclose(wad2_R_fp);
-#endif
-		return false;
+		wad_W_buf_used += count;
+
+		src    += count;
+		length -= count;
+
+		if (wad_W_buf_used >= wad_W_buf_size)
+			WAD_FlushBuffer();
 	}
 
-	if (memcmp(wad2_R_header.magic, WAD2_MAGIC, 4) != 0)
+	return ! wad_W_error;
+}
+
+
+static bool WAD_ReadBack(u32_t pos, u8_t *buf, int length)
+{
+	// the part already written to the file
+	if (pos < wad_W_flushed)
 	{
-		LogPrintf("WAD2_OpenRead: not a WAD2 file!\n");
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad2_R_fp);
-#else
-		fclose(wad2_R_fp);
-#endif
-		return false;
+		int count = MIN(length, (int)(wad_W_flushed - pos));
+
+		if (! wad_W_verify_fp)
+		{
+			wad_W_verify_fp = fopen(wad_W_filename, "rb");
+
+			if (! wad_W_verify_fp)
+				return false;
+		}
+
+		fseek(wad_W_verify_fp, pos, SEEK_SET);
+
+		if (fread(buf, count, 1, wad_W_verify_fp) != 1)
+			return false;
+
+		pos    += count;
+		buf    += count;
+		length -= count;
 	}
 
-	wad2_R_header.num_lumps = LE_U32(wad2_R_header.num_lumps);
-	wad2_R_header.dir_start = LE_U32(wad2_R_header.dir_start);
+	// the part still in the buffer
+	if (length > 0)
+		memcpy(buf, wad_W_buffer + (pos - wad_W_flushed), length);
 
-	/* read directory */
+	return true;
+}
+
+
+bool WAD_OpenWrite(const char *filename)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
 
-	if (wad2_R_header.num_lumps >= 5000)  // sanity check
+	wad_W_direct = false;
+
+#ifdef O_DIRECT
+	if (wad_W_want_direct)
 	{
-		LogPrintf("WAD2_OpenRead: bad header (%d entries?)\n", wad2_R_header.num_lumps);
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad2_R_fp);
-#else
-		fclose(wad2_R_fp);
-#endif
-		return false;
-	}
+		wad_W_fd = open(filename, flags | O_DIRECT, 0666);
 
-#ifdef HAVE_PHYSFS
-	if (! PHYSFS_seek(wad2_R_fp, wad2_R_header.dir_start))
-#else
-	if (fseek(wad2_R_fp, wad2_R_header.dir_start, SEEK_SET) != 0)
+		// some filesystems (e.g. tmpfs) do not support it
+		if (wad_W_fd >= 0)
+			wad_W_direct = true;
+		else
+			LogPrintf("WAD_OpenWrite: direct I/O not available\n");
+	}
 #endif
+
+	if (! wad_W_direct)
+		wad_W_fd = open(filename, flags, 0666);
+
+	if (wad_W_fd < 0)
 	{
-		LogPrintf("WAD2_OpenRead: cannot seek to directory (at 0x%08x)\n", wad2_R_header.dir_start);
-#ifdef HAVE_PHYSFS
-		PHYSFS_close(wad2_R_fp);
-#else
-		fclose(wad2_R_fp);
-#endif
+		LogPrintf("WAD_OpenWrite: cannot create file: %s\n", filename);
 		return false;
 	}
 
-	wad2_R_dir = new raw_wad2_lump_t[wad2_R_header.num_lumps + 1];
-
-	for (int i = 0; i < (int)wad2_R_header.num_lumps; i++)
-	{
-		raw_wad2_lump_t *L = &wad2_R_dir[i];
+	LogPrintf("Created WAD file: %s\n", filename);
 
-#ifdef HAVE_PHYSFS
-		size_t res = PHYSFS_read(wad2_R_fp, L, sizeof(raw_wad2_lump_t), 1);
-		if (res != 1)
+#ifdef WIN32
+	wad_W_buffer = (u8_t *) malloc(wad_W_buf_size);
 #else
-		int res = fread(L, sizeof(raw_wad2_lump_t), 1, wad2_R_fp);
-		if (res == EOF || res != 1 || ferror(wad2_R_fp))
+	if (posix_memalign((void **)&wad_W_buffer, WAD_DIRECT_ALIGN, wad_W_buf_size) != 0)
+		wad_W_buffer = NULL;
 #endif
-		{
-			if (i == 0)
-			{
-				LogPrintf("WAD2_OpenRead: could not read any dir-entries!\n");
-				WAD2_CloseRead();
-				return false;
-			}
 
-			LogPrintf("WAD2_OpenRead: hit EOF reading dir-entry %d\n", i);
+	if (! wad_W_buffer)
+		Main_FatalError("WAD_OpenWrite: out of memory\n");
 
-			// truncate directory
-			wad2_R_header.num_lumps = i;
-			break;
-		}
+	wad_W_buf_used = 0;
+	wad_W_flushed  = 0;
+	wad_W_error    = false;
 
-		// make sure name is NUL terminated.
-		L->name[15] = 0;
+	wad_W_directory.clear();
+	wad_W_directory.reserve(WAD_DIR_RESERVE);
 
-		L->start  = LE_U32(L->start);
-		L->length = LE_U32(L->length);
-		L->u_len  = LE_U32(L->u_len);
+	wad_W_dedupe.Clear();
 
-		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, L->start, L->length, L->name);
-	}
+	wad_W_filename = StringDup(filename);
+	wad_W_verify_fp = NULL;
 
-	return true; // OK
+	// write out a dummy header
+	raw_wad_header_t header;
+	memset(&header, 0, sizeof(header));
+
+	WAD_WriteData(&header, sizeof(raw_wad_header_t));
+
+	return true;
 }
 
 
-void WAD2_CloseRead(void)
+bool WAD_CloseWrite(void)
 {
-#ifdef HAVE_PHYSFS
-	PHYSFS_close(wad2_R_fp);
-#else
-	fclose(wad2_R_fp);
-#endif
+	// write the directory
 
-	LogPrintf("Closed WAD2 file\n");
+	LogPrintf("Writing WAD directory\n");
 
-	delete[] wad2_R_dir;
-	wad2_R_dir = NULL;
-}
+	raw_wad_header_t header;
 
+	memcpy(header.magic, "PWAD", sizeof(header.magic));
 
-int WAD2_NumEntries(void)
-{
-	return (int)wad2_R_header.num_lumps;
-}
+	header.dir_start = WAD_WritePos();
+	header.num_lumps = (u32_t)wad_W_directory.size();
 
+	if (! wad_W_directory.empty())
+		WAD_WriteData(&wad_W_directory[0], (int)(wad_W_directory.size() * sizeof(raw_wad_lump_t)));
 
-int WAD2_FindEntry(const char *name)
-{
-	for (unsigned int i = 0; i < wad2_R_header.num_lumps; i++)
+	// finally write the _real_ WAD header
+
+	header.dir_start = LE_U32(header.dir_start);
+	header.num_lumps = LE_U32(header.num_lumps);
+
+	if (wad_W_flushed == 0)
 	{
-		if (StringCaseCmp(name, wad2_R_dir[i].name) == 0)
-			return i;
+		// the whole file is still in the buffer
+		memcpy(wad_W_buffer, &header, sizeof(header));
+
+		WAD_FlushBuffer();
 	}
+	else
+	{
+		WAD_FlushBuffer();
+		WAD_StopDirect();
 
-	return -1; // not found
-}
+		if (lseek(wad_W_fd, 0, SEEK_SET) != 0)
+			wad_W_error = true;
+		else
+			WAD_RawWrite((const u8_t *)&header, sizeof(header));
+	}
 
+	if (close(wad_W_fd) != 0)
+		wad_W_error = true;
 
-int WAD2_EntryLen(int entry)
-{
-	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
+	wad_W_fd = -1;
+
+	free(wad_W_buffer);
+	wad_W_buffer = NULL;
 
-	return wad2_R_dir[entry].u_len;
+	if (wad_W_verify_fp)
+	{
+		fclose(wad_W_verify_fp);
+		wad_W_verify_fp = NULL;
+	}
+
+	StringFree(wad_W_filename);
+	wad_W_filename = NULL;
+
+	if (wad_W_dedupe.shared_lumps > 0)
+		LogPrintf("Shared %d duplicate lumps (%d bytes)\n",
+				  wad_W_dedupe.shared_lumps, wad_W_dedupe.shared_bytes);
+
+	LogPrintf("Closed WAD file\n");
+
+	wad_W_directory.clear();
+	wad_W_dedupe.Clear();
+
+	wad_W_lump_data.clear();
+
+	return ! wad_W_error;
 }
 
 
-const char * WAD2_EntryName(int entry)
+void WAD_NewLump(const char *name)
 {
-	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
+	if (strlen(name) > 8)
+		Main_FatalError("WAD_NewLump: name too long: '%s'\n", name);
+
+	memset(&wad_W_lump, 0, sizeof(wad_W_lump));
 
-	return wad2_R_dir[entry].name;
+	strncpy(wad_W_lump.name, name, 8);
+
+	wad_W_lump_data.clear();
 }
 
 
-int WAD2_EntryType(int entry)
+bool WAD_AppendData(const void *data, int length)
 {
-	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
+	if (length == 0)
+		return true;
+
+	SYS_ASSERT(length > 0);
+
+	const u8_t *src = (const u8_t *)data;
 
-	if (wad2_R_dir[entry].compression != 0)
-		return TYP_COMPRESSED;
+	wad_W_lump_data.insert(wad_W_lump_data.end(), src, src + length);
 
-	return wad2_R_dir[entry].type;
+	return ! wad_W_error;
 }
 
-bool WAD2_ReadData(int entry, int offset, int length, void *buffer)
+
+void WAD_FinishLump(void)
 {
-	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
-	SYS_ASSERT(offset >= 0);
-	SYS_ASSERT(length > 0);
+	int len = (int)wad_W_lump_data.size();
 
-	raw_wad2_lump_t *L = &wad2_R_dir[entry];
+	u32_t start = WAD_WritePos();
 
-	if ((u32_t)offset + (u32_t)length > L->length)  // EOF
-		return false;
+	if (len > 0)
+	{
+		const u8_t *data = &wad_W_lump_data[0];
 
-#ifdef HAVE_PHYSFS
-	if (! PHYSFS_seek(wad2_R_fp, L->start + offset))
-		return false;
+		if (! wad_W_dedupe.Check(data, len, &start))
+		{
+			WAD_WriteData(data, len);
 
-	size_t res = PHYSFS_read(wad2_R_fp, buffer, length, 1);
-#else
-	if (fseek(wad2_R_fp, L->start + offset, SEEK_SET) != 0)
-		return false;
+			// pad lumps to a multiple of four bytes
+			int padding = ALIGN_LEN(len) - len;
 
-	int res = fread(buffer, length, 1, wad2_R_fp);
-#endif
+			if (padding > 0)
+			{
+				static u8_t zeros[4] = { 0,0,0,0 };
 
-	return (res == 1);
+				WAD_WriteData(zeros, padding);
+			}
+		}
+	}
+
+	// fix endianness
+	wad_W_lump.start  = LE_U32(start);
+	wad_W_lump.length = LE_U32(len);
+
+	wad_W_directory.push_back(wad_W_lump);
+
+	wad_W_lump_data.clear();
 }
 
 
-static char LetterForType(u8_t type)
+//------------------------------------------------------------------------
+//  WAD2 READING
+//------------------------------------------------------------------------
+
+static wad_reader_c wad2_R(true);
+
+bool WAD2_OpenRead(const char *filename)
 {
-	switch (type)
-	{
-		case TYP_NONE:    return 'x';
-		case TYP_LABEL:   return 'L';
-		case TYP_PALETTE: return 'C';
-		case TYP_QTEX:    return 'T';
-		case TYP_QPIC:    return 'P';
-		case TYP_SOUND:   return 'S';
-		case TYP_MIPTEX:  return 'M';
+	return wad2_R.Open(filename);
+}
 
-		default: return '?';
-	}
+void WAD2_CloseRead(void)
+{
+	wad2_R.Close();
 }
 
+int WAD2_NumEntries(void)
+{
+	return wad2_R.NumEntries();
+}
 
-void WAD2_ListEntries(void)
+int WAD2_FindEntry(const char *name)
 {
-	printf("--------------------------------------------------\n");
+	return wad2_R.FindEntry(name);
+}
 
-	if (wad2_R_header.num_lumps == 0)
-	{
-		printf("WAD2 file is empty\n");
-	}
-	else
-	{
-		for (int i = 0; i < (int)wad2_R_header.num_lumps; i++)
-		{
-			raw_wad2_lump_t *L = &wad2_R_dir[i];
+int WAD2_EntryLen(int entry)
+{
+	return wad2_R.EntryLen(entry);
+}
 
-			printf("%4d: +%08x %08x %c : %s\n", i+1, L->start, L->length,
-					LetterForType(L->type), L->name);
-		}
-	}
+int WAD2_EntryType(int entry)
+{
+	return wad2_R.EntryType(entry);
+}
 
-	printf("--------------------------------------------------\n");
+const char * WAD2_EntryName(int entry)
+{
+	return wad2_R.EntryName(entry);
+}
+
+const byte * WAD2_EntryData(int entry)
+{
+	return wad2_R.EntryData(entry);
+}
+
+bool WAD2_ReadData(int entry, int offset, int length, void *buffer)
+{
+	return wad2_R.ReadData(entry, offset, length, buffer);
+}
+
+void WAD2_ListEntries(void)
+{
+	wad2_R.ListEntries();
 }
 
 
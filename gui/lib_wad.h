@@ -22,7 +22,81 @@
 #define __OBLIGE_LIB_WAD_H__
 
 
-/* WAD reading */
+#include <mutex>
+
+#ifdef HAVE_PHYSFS
+typedef struct PHYSFS_File PHYSFS_File;
+#endif
+
+
+/* WAD and WAD2 reading (several at once) */
+
+class wad_reader_c
+{
+	// an open WAD (or WAD2) file.  Any number of these can be open at
+	// the same time, and once opened all the methods are thread-safe.
+	// names are found through a hash table built when opening.
+
+private:
+	typedef struct
+	{
+		u32_t start;
+		u32_t length;  // compressed
+		u32_t u_len;   // uncompressed
+
+		int type;
+
+		char name[20];  // always NUL terminated
+
+	} entry_t;
+
+	bool is_wad2;
+
+#ifdef HAVE_PHYSFS
+	PHYSFS_File *fp;
+#else
+	FILE *fp;
+#endif
+
+	std::vector<entry_t> dir;
+
+	archive_index_c index;
+
+	// when the file is on disk, it is also memory-mapped
+	const byte * mem;
+	int mem_len;
+
+	// protects the file position when it is not mapped
+	std::mutex read_mutex;
+
+public:
+	wad_reader_c(bool _wad2 = false);
+	~wad_reader_c();
+
+	bool Open(const char *filename);
+	void Close();
+
+	bool isOpen() const { return fp != NULL; }
+
+	int  NumEntries() const;
+	int  FindEntry(const char *name) const;
+	int  EntryLen(int entry) const;
+	int  EntryType(int entry) const;  // WAD2 only
+	const char * EntryName(int entry) const;
+
+	// returns NULL when the file is not memory-mapped
+	const byte * EntryData(int entry) const;
+
+	bool ReadData(int entry, int offset, int length, void *buffer);
+
+	void ListEntries() const;
+
+private:
+	bool ReadDirectory();
+};
+
+
+/* WAD reading (global reader) */
 
 bool WAD_OpenRead(const char *filename);
 void WAD_CloseRead(void);
@@ -32,6 +106,9 @@ int  WAD_FindEntry(const char *name);
 int  WAD_EntryLen(int entry);
 const char * WAD_EntryName(int entry);
 
+// pointer to the whole lump, or NULL when the file is not mapped
+const byte * WAD_EntryData(int entry);
+
 bool WAD_ReadData(int entry, int offset, int length, void *buffer);
 
 void WAD_ListEntries(void);
@@ -39,8 +116,10 @@ void WAD_ListEntries(void);
 
 /* WAD writing */
 
+void WAD_SetWriteBuffer(int size, bool direct_io);
+
 bool WAD_OpenWrite(const char *filename);
-void WAD_CloseWrite(void);
+bool WAD_CloseWrite(void);
 
 void WAD_NewLump(const char *name);
 bool WAD_AppendData(const void *data, int length);
@@ -48,7 +127,7 @@ void WAD_FinishLump(void);
 
 
 
-/* WAD2 reading */
+/* WAD2 reading (global reader) */
 
 bool WAD2_OpenRead(const char *filename);
 void WAD2_CloseRead(void);
@@ -59,6 +138,9 @@ int  WAD2_EntryLen(int entry);
 int  WAD2_EntryType(int entry);
 const char * WAD2_EntryName(int entry);
 
+// pointer to the whole lump, or NULL when the file is not mapped
+const byte * WAD2_EntryData(int entry);
+
 bool WAD2_ReadData(int entry, int offset, int length, void *buffer);
 
 void WAD2_ListEntries(void);
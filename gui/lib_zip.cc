@@ -192,6 +192,8 @@ public:
 static raw_zip_end_of_directory_t  r_end_part;
 static zip_central_entry_t * r_directory;
 
+static archive_index_c r_zip_index;
+
 // IDEA: have a read_state per entry (E->read_state)
 static zip_read_state_c *r_read_state;
 
@@ -401,6 +403,8 @@ bool ZIPF_OpenRead(const char *filename)
 			delete[] r_directory;
 			r_directory = NULL;
 
+			r_zip_index.Clear();
+
 			fclose(r_zip_fp);
 			return false;
 		}
@@ -409,6 +413,8 @@ bool ZIPF_OpenRead(const char *filename)
 		E->data_offset = -1;
 
 		//  DebugPrintf(" %4d: +%08x %08x : %s\n", i+1, E->hdr.local_offset, E->hdr.full_size, E->name);
+
+		r_zip_index.Add(E->name, i);
 	}
 
 	return true; // OK
@@ -424,6 +430,8 @@ void ZIPF_CloseRead(void)
 	delete[] r_directory;
 	r_directory = NULL;
 
+	r_zip_index.Clear();
+
 	if (r_read_state)
 		destroy_read_state();
 }
@@ -437,13 +445,7 @@ int ZIPF_NumEntries(void)
 
 int ZIPF_FindEntry(const char *name)
 {
-	for (unsigned int i = 0 ; i < r_end_part.total_entries ; i++)
-	{
-		if (StringCaseCmp(name, r_directory[i].name) == 0)
-			return i;
-	}
-
-	return -1; // not found
+	return r_zip_index.Find(name);
 }
 
 
@@ -682,10 +684,16 @@ bool ZIPF_OpenWrite(const char *filename)
 
 	LogPrintf("Created ZIP file: %s\n", filename);
 
-	// grab the current date and time
+	// grab the current date and time.
+	// SOURCE_DATE_EPOCH overrides it, for reproducible output.
 	time_t cur_time = time(NULL);
 
-	struct tm *t = localtime(&cur_time);
+	const char *sde = getenv("SOURCE_DATE_EPOCH");
+
+	if (sde && sde[0])
+		cur_time = (time_t) strtol(sde, NULL, 10);
+
+	struct tm *t = (sde && sde[0]) ? gmtime(&cur_time) : localtime(&cur_time);
 
 	if (t)
 	{
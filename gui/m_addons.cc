@@ -311,6 +311,52 @@ void VFS_FreeFile(const byte *mem)
 }
 
 
+const byte * VFS_MapFile(const char *filename, int *length)
+{
+	*length = 0;
+
+	const char *real_dir = PHYSFS_getRealDir(filename);
+
+	// files inside a PK3 cannot be mapped
+	if (! real_dir || ! PathIsDirectory(real_dir))
+		return NULL;
+
+	// convert the virtual name to one relative to the mount point.
+	// PhysFS gives that as "/" or "name/".
+	const char *mount = PHYSFS_getMountPoint(real_dir);
+
+	while (*filename == '/')
+		filename++;
+
+	if (mount && strcmp(mount, "/") != 0)
+	{
+		int mount_len = strlen(mount);
+
+		if (strncmp(filename, mount, mount_len) != 0)
+			return NULL;
+
+		filename += mount_len;
+	}
+
+	char *real_name = StringPrintf("%s/%s", real_dir, filename);
+
+	const byte *mem = FileMap(real_name, length);
+
+	if (mem)
+		DebugPrintf("mapped file: %s\n", real_name);
+
+	StringFree(real_name);
+
+	return mem;
+}
+
+
+void VFS_UnmapFile(const byte *mem, int length)
+{
+	FileUnmap(mem, length);
+}
+
+
 //----------------------------------------------------------------------
 
 class UI_Addon : public Fl_Group
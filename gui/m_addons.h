@@ -33,6 +33,10 @@ bool   VFS_CopyFile(const char *src_name, const char *dest_name);
 byte * VFS_LoadFile(const char *filename, int *length);
 void   VFS_FreeFile(const byte *mem);
 
+// only files stored directly on disk can be mapped
+const byte * VFS_MapFile(const char *filename, int *length);
+void   VFS_UnmapFile(const byte *mem, int length);
+
 #endif /* __OBLIGE_ADDONS_H__ */
 
 //--- editor settings ---
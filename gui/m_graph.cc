@@ -0,0 +1,487 @@
+//------------------------------------------------------------------------
+//  ROOM GRAPH (for the Quest planner)
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  When dividing a quest, the planner needs to know how the rooms
+//  would be split by locking each connection.  Instead of flooding
+//  the rooms for every connection, the graph is built once and a
+//  single depth-first search finds the bridges (Tarjan's method),
+//  remembering the total size of every subtree.  A bridge splits
+//  its component into the child's subtree and the rest, so each
+//  split can then be examined in constant time.
+//
+//  Only "passable" connections (both rooms in the same quest) are
+//  followed.  Other connections are simply ignored.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+#include "hdr_lua.h"
+
+#include "lib_util.h"
+
+#include "main.h"
+
+
+class graph_room_c
+{
+public:
+	int id;
+
+	double weight;
+
+	// true if the room may hold a new goal (when it is a leaf)
+	bool leaf_ok;
+
+	// passable connections (indices into graph_conns)
+	std::vector<int> conns;
+
+	// number of passable connections, a self-loop counts twice
+	// (it appears twice in the room's list in the Lua code).
+	int exits;
+
+	int comp;
+
+	// the tree edge to the parent, -1 for the root of a component
+	int parent_conn;
+
+	// DFS visiting times.  the subtree of a room is the range
+	// [ tin, tout ) of visiting times.
+	int tin, tout;
+	int low;
+
+	double sub_weight;
+	int    sub_leafs;
+
+public:
+	graph_room_c(int _id, double _weight, bool _leaf_ok) :
+		id(_id), weight(_weight), leaf_ok(_leaf_ok),
+		conns(), exits(0), comp(-1), parent_conn(-1),
+		tin(-1), tout(-1), low(-1),
+		sub_weight(0), sub_leafs(0)
+	{ }
+
+	~graph_room_c()
+	{ }
+
+	bool IsLeaf() const
+	{
+		return leaf_ok && exits == 1;
+	}
+};
+
+
+class graph_conn_c
+{
+public:
+	int id;
+
+	// indices into graph_rooms
+	int r1, r2;
+
+	bool passable;
+
+	bool is_bridge;
+
+	// for a bridge, the room on the far side from the DFS root
+	int child;
+
+public:
+	graph_conn_c(int _id, int _r1, int _r2, bool _passable) :
+		id(_id), r1(_r1), r2(_r2), passable(_passable),
+		is_bridge(false), child(-1)
+	{ }
+
+	~graph_conn_c()
+	{ }
+
+	int Other(int r) const
+	{
+		return (r == r1) ? r2 : r1;
+	}
+};
+
+
+class graph_comp_c
+{
+public:
+	double weight;
+	int    leafs;
+
+public:
+	graph_comp_c() : weight(0), leafs(0)
+	{ }
+};
+
+
+static std::vector<graph_room_c> graph_rooms;
+static std::vector<graph_conn_c> graph_conns;
+static std::vector<graph_comp_c> graph_comps;
+
+// lookup from the Lua id numbers
+static std::map<int, int> graph_room_ids;
+static std::map<int, int> graph_conn_ids;
+
+static bool graph_solved;
+
+// visiting time for the depth-first search
+static int graph_timer;
+
+
+static void GRAPH_Clear()
+{
+	graph_rooms.clear();
+	graph_conns.clear();
+	graph_comps.clear();
+
+	graph_room_ids.clear();
+	graph_conn_ids.clear();
+
+	graph_solved = false;
+}
+
+
+static void GRAPH_VisitComponent(int root, int comp)
+{
+	// this is an iterative version of the usual recursive search,
+	// since large maps could nest quite deeply.
+
+	std::vector< std::pair<int, unsigned int> > stack;
+
+	stack.push_back(std::make_pair(root, 0u));
+
+	graph_room_c& R = graph_rooms[root];
+
+	R.comp = comp;
+	R.tin  = R.low = graph_timer++;
+
+	R.sub_weight = R.weight;
+	R.sub_leafs  = R.IsLeaf() ? 1 : 0;
+
+	while (! stack.empty())
+	{
+		int cur = stack.back().first;
+
+		graph_room_c& V = graph_rooms[cur];
+
+		if (stack.back().second < V.conns.size())
+		{
+			int ci = V.conns[stack.back().second];
+
+			stack.back().second += 1;
+
+			// never go back via the same connection (but another
+			// connection to the parent is fine, it forms a cycle).
+			if (ci == V.parent_conn)
+				continue;
+
+			int next = graph_conns[ci].Other(cur);
+
+			if (next == cur)
+				continue;
+
+			graph_room_c& N = graph_rooms[next];
+
+			if (N.tin >= 0)
+			{
+				V.low = MIN(V.low, N.tin);
+				continue;
+			}
+
+			N.comp = comp;
+			N.parent_conn = ci;
+			N.tin  = N.low = graph_timer++;
+
+			N.sub_weight = N.weight;
+			N.sub_leafs  = N.IsLeaf() ? 1 : 0;
+
+			stack.push_back(std::make_pair(next, 0u));
+			continue;
+		}
+
+		// finished with this room
+
+		stack.pop_back();
+
+		V.tout = graph_timer;
+
+		if (V.parent_conn < 0)
+			continue;
+
+		graph_conn_c& C = graph_conns[V.parent_conn];
+
+		graph_room_c& P = graph_rooms[C.Other(cur)];
+
+		P.low = MIN(P.low, V.low);
+
+		P.sub_weight += V.sub_weight;
+		P.sub_leafs  += V.sub_leafs;
+
+		if (V.low > P.tin)
+		{
+			C.is_bridge = true;
+			C.child = cur;
+		}
+	}
+
+	graph_comps[comp].weight = R.sub_weight;
+	graph_comps[comp].leafs  = R.sub_leafs;
+}
+
+
+static void GRAPH_Solve()
+{
+	graph_timer = 0;
+
+	for (unsigned int i = 0 ; i < graph_rooms.size() ; i++)
+	{
+		if (graph_rooms[i].tin >= 0)
+			continue;
+
+		int comp = (int)graph_comps.size();
+
+		graph_comps.push_back(graph_comp_c());
+
+		GRAPH_VisitComponent((int)i, comp);
+	}
+
+	graph_solved = true;
+}
+
+
+static inline bool GRAPH_InSubtree(int r, int top)
+{
+	const graph_room_c& R = graph_rooms[r];
+	const graph_room_c& T = graph_rooms[top];
+
+	return (T.tin <= R.tin && R.tin < T.tout);
+}
+
+
+// returns 1 if the room is on the R1 side of the connection, 2 if
+// on the R2 side, 3 for both (connection is not a bridge) and 0 if
+// the room is not connected to it at all.
+static int GRAPH_Side(const graph_conn_c& C, int r)
+{
+	if (graph_rooms[r].comp != graph_rooms[C.r1].comp)
+		return 0;
+
+	if (! C.is_bridge)
+		return 3;
+
+	bool below = GRAPH_InSubtree(r, C.child);
+
+	if (below == (C.child == C.r1))
+		return 1;
+	else
+		return 2;
+}
+
+
+static void GRAPH_CutSizes(const graph_conn_c& C, double *weights, int *leafs)
+{
+	const graph_room_c& R1 = graph_rooms[C.r1];
+	const graph_room_c& R2 = graph_rooms[C.r2];
+
+	const graph_comp_c& comp = graph_comps[R1.comp];
+
+	// rooms next to the connection are never counted as leafs
+	int leaf1 = R1.IsLeaf() ? 1 : 0;
+	int leaf2 = R2.IsLeaf() ? 1 : 0;
+
+	if (! C.is_bridge)
+	{
+		weights[0] = weights[1] = comp.weight;
+
+		leafs[0] = leafs[1] = comp.leafs - leaf1 - ((C.r2 != C.r1) ? leaf2 : 0);
+		return;
+	}
+
+	const graph_room_c& child = graph_rooms[C.child];
+
+	int k = (C.child == C.r1) ? 0 : 1;
+
+	weights[k]   = child.sub_weight;
+	weights[1-k] = comp.weight - child.sub_weight;
+
+	leafs[k]   = child.sub_leafs - (k == 0 ? leaf1 : leaf2);
+	leafs[1-k] = comp.leafs - child.sub_leafs - (k == 0 ? leaf2 : leaf1);
+}
+
+
+//------------------------------------------------------------------------
+//  LUA INTERFACE
+//------------------------------------------------------------------------
+
+
+static int graph_lookup(lua_State *L, std::map<int, int>& ids, int stack_pos, const char *what)
+{
+	int id = luaL_checkint(L, stack_pos);
+
+	std::map<int, int>::iterator IT = ids.find(id);
+
+	if (IT == ids.end())
+		return luaL_error(L, "gui.graph: unknown %s id: %d", what, id);
+
+	return IT->second;
+}
+
+
+// LUA: graph_begin()
+//
+int GRAPH_begin(lua_State *)
+{
+	GRAPH_Clear();
+
+	return 0;
+}
+
+
+// LUA: graph_add_room(id, weight, leaf_ok)
+//
+int GRAPH_add_room(lua_State *L)
+{
+	int id = luaL_checkint(L, 1);
+
+	double weight = luaL_checknumber(L, 2);
+
+	bool leaf_ok = lua_toboolean(L, 3) ? true : false;
+
+	if (graph_solved)
+		return luaL_error(L, "gui.graph_add_room: graph already in use");
+
+	if (graph_room_ids.find(id) != graph_room_ids.end())
+		return luaL_error(L, "gui.graph_add_room: duplicate room id: %d", id);
+
+	graph_room_ids[id] = (int)graph_rooms.size();
+
+	graph_rooms.push_back(graph_room_c(id, weight, leaf_ok));
+
+	return 0;
+}
+
+
+// LUA: graph_add_conn(id, room1, room2, passable)
+//
+int GRAPH_add_conn(lua_State *L)
+{
+	int id = luaL_checkint(L, 1);
+
+	int r1 = graph_lookup(L, graph_room_ids, 2, "room");
+	int r2 = graph_lookup(L, graph_room_ids, 3, "room");
+
+	bool passable = lua_toboolean(L, 4) ? true : false;
+
+	if (graph_solved)
+		return luaL_error(L, "gui.graph_add_conn: graph already in use");
+
+	if (graph_conn_ids.find(id) != graph_conn_ids.end())
+		return luaL_error(L, "gui.graph_add_conn: duplicate conn id: %d", id);
+
+	int ci = (int)graph_conns.size();
+
+	graph_conn_ids[id] = ci;
+
+	graph_conns.push_back(graph_conn_c(id, r1, r2, passable));
+
+	if (passable)
+	{
+		graph_rooms[r1].exits += 1;
+		graph_rooms[r2].exits += 1;
+
+		graph_rooms[r1].conns.push_back(ci);
+
+		if (r2 != r1)
+			graph_rooms[r2].conns.push_back(ci);
+	}
+
+	return 0;
+}
+
+
+// LUA: graph_cut(conn) --> weight1, weight2, leafs1, leafs2
+//
+// Returns the total weight of the rooms on each side of a passable
+// connection, when the connection is removed, and the number of
+// leaf rooms (rooms with a single exit which may hold a goal).
+// Side 1 contains R1 of the connection, side 2 contains R2.
+// When the connection is not a bridge, both sides are the same.
+//
+int GRAPH_cut(lua_State *L)
+{
+	int ci = graph_lookup(L, graph_conn_ids, 1, "conn");
+
+	if (! graph_solved)
+		GRAPH_Solve();
+
+	const graph_conn_c& C = graph_conns[ci];
+
+	if (! C.passable)
+		return luaL_error(L, "gui.graph_cut: connection is not passable");
+
+	double weights[2];
+	int    leafs[2];
+
+	GRAPH_CutSizes(C, weights, leafs);
+
+	lua_pushnumber(L, weights[0]);
+	lua_pushnumber(L, weights[1]);
+
+	lua_pushinteger(L, leafs[0]);
+	lua_pushinteger(L, leafs[1]);
+
+	return 4;
+}
+
+
+// LUA: graph_side(conn, room) --> integer
+//
+// Determines which side of a passable connection the room is on:
+// 1 for the R1 side, 2 for the R2 side, 3 for both (connection is
+// not a bridge), or 0 when the room cannot be reached at all.
+//
+int GRAPH_side(lua_State *L)
+{
+	int ci = graph_lookup(L, graph_conn_ids, 1, "conn");
+	int r  = graph_lookup(L, graph_room_ids, 2, "room");
+
+	if (! graph_solved)
+		GRAPH_Solve();
+
+	const graph_conn_c& C = graph_conns[ci];
+
+	if (! C.passable)
+		return luaL_error(L, "gui.graph_side: connection is not passable");
+
+	lua_pushinteger(L, GRAPH_Side(C, r));
+	return 1;
+}
+
+
+// LUA: graph_end()
+//
+int GRAPH_end(lua_State *)
+{
+	GRAPH_Clear();
+
+	return 0;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
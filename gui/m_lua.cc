@@ -29,6 +29,7 @@
 #include "physfs.h"
 
 #include "lib_file.h"
+#include "lib_mempool.h"
 #include "lib_signal.h"
 #include "lib_util.h"
 
@@ -99,6 +100,15 @@ int gui_raw_debug_print(lua_State *L)
 }
 
 
+// LUA: debug_enabled() --> boolean
+//
+int gui_debug_enabled(lua_State *L)
+{
+	lua_pushboolean(L, LogDebugEnabled() ? 1 : 0);
+	return 1;
+}
+
+
 // LUA: gettext(str)
 //
 int gui_gettext(lua_State *L)
@@ -678,6 +688,432 @@ int gui_random(lua_State *L)
 }
 
 
+//------------------------------------------------------------------------
+//  NATIVE HELPERS
+//------------------------------------------------------------------------
+
+// These replace the rand.xxx and geom.xxx functions in util.lua which
+// are called very often.  The arithmetic is done in the same order as
+// the Lua code, so the random sequences (and results) are identical.
+
+static inline int RNG_IRange(double low, double high)
+{
+	return (int)floor(low + GUI_RNG.Double() * (high - low + 0.9999));
+}
+
+
+// LUA: rand_odds(chance) --> boolean
+//
+int gui_rand_odds(lua_State *L)
+{
+	double chance = luaL_checknumber(L, 1);
+
+	lua_pushboolean(L, (GUI_RNG.Double() * 100) <= chance);
+	return 1;
+}
+
+// LUA: rand_range(low, high) --> number
+//
+int gui_rand_range(lua_State *L)
+{
+	double low  = luaL_checknumber(L, 1);
+	double high = luaL_checknumber(L, 2);
+
+	lua_pushnumber(L, low + GUI_RNG.Double() * (high - low));
+	return 1;
+}
+
+// LUA: rand_irange(low, high) --> integer
+//
+int gui_rand_irange(lua_State *L)
+{
+	double low  = luaL_checknumber(L, 1);
+	double high = luaL_checknumber(L, 2);
+
+	lua_pushnumber(L, floor(low + GUI_RNG.Double() * (high - low + 0.9999)));
+	return 1;
+}
+
+// LUA: rand_int(value) --> integer
+//
+int gui_rand_int(lua_State *L)
+{
+	double value = luaL_checknumber(L, 1);
+
+	lua_pushnumber(L, floor(value + GUI_RNG.Double()));
+	return 1;
+}
+
+// LUA: rand_skew([mid], [dist]) --> number
+//
+int gui_rand_skew(lua_State *L)
+{
+	double mid  = luaL_optnumber(L, 1, 0);
+	double dist = luaL_optnumber(L, 2, 1);
+
+	double A = GUI_RNG.Double();
+	double B = GUI_RNG.Double();
+
+	lua_pushnumber(L, mid + (A - B) * dist);
+	return 1;
+}
+
+// LUA: rand_pick(list) --> value
+//
+int gui_rand_pick(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	int count = (int)lua_objlen(L, 1);
+
+	if (count <= 0)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_rawgeti(L, 1, RNG_IRange(1, count));
+	return 1;
+}
+
+// LUA: rand_shuffle(list) --> list
+//
+// implements Knuth's random shuffle algorithm (in place).
+//
+int gui_rand_shuffle(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	int count = (int)lua_objlen(L, 1);
+
+	for (int i = 1 ; i < count ; i++)
+	{
+		int k = RNG_IRange(i, count);
+
+		// swap the pair of values
+		lua_rawgeti(L, 1, i);
+		lua_rawgeti(L, 1, k);
+
+		lua_rawseti(L, 1, i);
+		lua_rawseti(L, 1, k);
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// LUA: rand_index_by_probs(probs) --> index
+//
+// each element in the table is a probability.
+// returns a random index based on the probabilities
+// (e.g. the highest value is returned more often).
+//
+int gui_rand_index_by_probs(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	if (lua_objlen(L, 1) == 0)
+		return luaL_error(L, "rand.index_by_probs: empty table");
+
+	static std::vector<double> probs;
+
+	probs.clear();
+
+	double total = 0;
+
+	// this stops at the first nil, like ipairs()
+	for (int i = 1 ; ; i++)
+	{
+		lua_rawgeti(L, 1, i);
+
+		if (lua_isnil(L, -1))
+		{
+			lua_pop(L, 1);
+			break;
+		}
+
+		if (! lua_isnumber(L, -1))
+			return luaL_error(L, "rand.index_by_probs: bad probability");
+
+		probs.push_back(lua_tonumber(L, -1));
+		total += probs.back();
+
+		lua_pop(L, 1);
+	}
+
+	if (total > 0)
+	{
+		double value = GUI_RNG.Double() * total;
+
+		for (unsigned int k = 0 ; k < probs.size() ; k++)
+		{
+			value -= probs[k];
+
+			if (value <= 0)
+			{
+				lua_pushinteger(L, (int)k + 1);
+				return 1;
+			}
+		}
+	}
+
+	// should not get here, but if we do, return a valid index
+	lua_pushinteger(L, 1);
+	return 1;
+}
+
+// LUA: rand_key_by_probs(tab) --> key
+//
+// each element in the table has the form: KEY = PROB.
+// This function returns one of the keys.
+//
+int gui_rand_key_by_probs(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	double total = 0;
+
+	// visits the keys in the same order as pairs()
+	lua_pushnil(L);
+
+	while (lua_next(L, 1) != 0)
+	{
+		if (! lua_isnumber(L, -1))
+			return luaL_error(L, "rand.key_by_probs: bad probability");
+
+		total += lua_tonumber(L, -1);
+
+		lua_pop(L, 1);
+	}
+
+	double value = (total > 0) ? GUI_RNG.Double() * total : 0;
+
+	bool first = true;
+
+	lua_pushnil(L);
+
+	while (lua_next(L, 1) != 0)
+	{
+		value -= lua_tonumber(L, -1);
+
+		// result is the first key when the total is not positive
+		if (value <= 0 || (first && total <= 0))
+		{
+			lua_pop(L, 1);
+			return 1;
+		}
+
+		first = false;
+
+		lua_pop(L, 1);
+	}
+
+	if (first)
+		return luaL_error(L, "rand.key_by_probs: empty table");
+
+	// should not get here, but if we do, return the first key
+	lua_pushnil(L);
+	lua_next(L, 1);
+	lua_pop(L, 1);
+	return 1;
+}
+
+
+static double Geom_PerpDist(double x, double y, double sx, double sy, double ex, double ey,
+							double *len_out)
+{
+	x -= sx ; ex -= sx;
+	y -= sy ; ey -= sy;
+
+	*len_out = sqrt(ex*ex + ey*ey);
+
+	return (x * ey - y * ex);
+}
+
+
+// LUA: geom_dist(x1,y1, x2,y2) --> number
+//
+int gui_geom_dist(lua_State *L)
+{
+	double x1 = luaL_checknumber(L, 1);
+	double y1 = luaL_checknumber(L, 2);
+	double x2 = luaL_checknumber(L, 3);
+	double y2 = luaL_checknumber(L, 4);
+
+	lua_pushnumber(L, sqrt((x1-x2) * (x1-x2) + (y1-y2) * (y1-y2)));
+	return 1;
+}
+
+// LUA: geom_unit_vector(dx, dy) --> dx, dy
+//
+int gui_geom_unit_vector(lua_State *L)
+{
+	double dx = luaL_checknumber(L, 1);
+	double dy = luaL_checknumber(L, 2);
+
+	double len = sqrt(dx * dx + dy * dy);
+
+	if (len > 0.000001)
+	{
+		dx = dx / len;
+		dy = dy / len;
+	}
+	else
+	{
+		dx = dy = 0;
+	}
+
+	lua_pushnumber(L, dx);
+	lua_pushnumber(L, dy);
+	return 2;
+}
+
+// LUA: geom_perp_dist(x, y, sx,sy, ex,ey) --> number
+//
+int gui_geom_perp_dist(lua_State *L)
+{
+	double len;
+	double d = Geom_PerpDist(luaL_checknumber(L, 1), luaL_checknumber(L, 2),
+							 luaL_checknumber(L, 3), luaL_checknumber(L, 4),
+							 luaL_checknumber(L, 5), luaL_checknumber(L, 6), &len);
+
+	if (len < 0.001)
+		return luaL_error(L, "perp_dist: zero-length line");
+
+	lua_pushnumber(L, d / len);
+	return 1;
+}
+
+// LUA: geom_along_dist(x, y, sx,sy, ex,ey) --> number
+//
+int gui_geom_along_dist(lua_State *L)
+{
+	double x  = luaL_checknumber(L, 1) - luaL_checknumber(L, 3);
+	double y  = luaL_checknumber(L, 2) - luaL_checknumber(L, 4);
+	double ex = luaL_checknumber(L, 5) - luaL_checknumber(L, 3);
+	double ey = luaL_checknumber(L, 6) - luaL_checknumber(L, 4);
+
+	double len = sqrt(ex*ex + ey*ey);
+
+	if (len < 0.001)
+		return luaL_error(L, "perp_dist: zero-length line");
+
+	lua_pushnumber(L, (x * ex + y * ey) / len);
+	return 1;
+}
+
+// LUA: geom_intersect_lines(ax1,ay1, ax2,ay2, bx1,by1, bx2,by2) --> x, y
+//
+int gui_geom_intersect_lines(lua_State *L)
+{
+	double ax1 = luaL_checknumber(L, 1);
+	double ay1 = luaL_checknumber(L, 2);
+	double ax2 = luaL_checknumber(L, 3);
+	double ay2 = luaL_checknumber(L, 4);
+
+	double bx1 = luaL_checknumber(L, 5);
+	double by1 = luaL_checknumber(L, 6);
+	double bx2 = luaL_checknumber(L, 7);
+	double by2 = luaL_checknumber(L, 8);
+
+	double len;
+
+	double k1 = Geom_PerpDist(bx1, by1, ax1, ay1, ax2, ay2, &len);
+	double k2 = Geom_PerpDist(bx2, by2, ax1, ay1, ax2, ay2, &len);
+
+	if (len < 0.001)
+		return luaL_error(L, "perp_dist: zero-length line");
+
+	k1 = k1 / len;
+	k2 = k2 / len;
+
+	if (fabs(k1 - k2) < 0.01)
+		return luaL_error(L, "intersect_lines: lines are parallel!");
+
+	double d = k1 / (k1 - k2);
+
+	lua_pushnumber(L, bx1 + d * (bx2 - bx1));
+	lua_pushnumber(L, by1 + d * (by2 - by1));
+	return 2;
+}
+
+// LUA: geom_box_dist(ax1,ay1,ax2,ay2, bx1,by1,[bx2,by2]) --> number
+//
+int gui_geom_box_dist(lua_State *L)
+{
+	double ax1 = luaL_checknumber(L, 1);
+	double ay1 = luaL_checknumber(L, 2);
+	double ax2 = luaL_checknumber(L, 3);
+	double ay2 = luaL_checknumber(L, 4);
+
+	double bx1 = luaL_checknumber(L, 5);
+	double by1 = luaL_checknumber(L, 6);
+
+	// support 'B' being just a point
+	double bx2 = luaL_optnumber(L, 7, bx1);
+	double by2 = luaL_optnumber(L, 8, by1);
+
+	double x_dist = 0;
+	double y_dist = 0;
+
+	if (bx1 > ax2)
+		x_dist = bx1 - ax2;
+	else if (ax1 > bx2)
+		x_dist = ax1 - bx2;
+
+	if (by1 > ay2)
+		y_dist = by1 - ay2;
+	else if (ay1 > by2)
+		y_dist = ay1 - by2;
+
+	lua_pushnumber(L, sqrt(x_dist * x_dist + y_dist * y_dist));
+	return 1;
+}
+
+// LUA: geom_inside_box(x,y, bx1,by1, bx2,by2) --> boolean
+//
+int gui_geom_inside_box(lua_State *L)
+{
+	double x   = luaL_checknumber(L, 1);
+	double y   = luaL_checknumber(L, 2);
+	double bx1 = luaL_checknumber(L, 3);
+	double by1 = luaL_checknumber(L, 4);
+	double bx2 = luaL_checknumber(L, 5);
+	double by2 = luaL_checknumber(L, 6);
+
+	lua_pushboolean(L, (bx1 <= x) && (x <= bx2) && (by1 <= y) && (y <= by2));
+	return 1;
+}
+
+// LUA: geom_boxes_overlap(x1,y1,x2,y2, x3,y3,x4,y4) --> boolean
+//
+// NOTE: mere touching is not enough
+//
+int gui_geom_boxes_overlap(lua_State *L)
+{
+	double x1 = luaL_checknumber(L, 1);
+	double y1 = luaL_checknumber(L, 2);
+	double x2 = luaL_checknumber(L, 3);
+	double y2 = luaL_checknumber(L, 4);
+
+	double x3 = luaL_checknumber(L, 5);
+	double y3 = luaL_checknumber(L, 6);
+	double x4 = luaL_checknumber(L, 7);
+	double y4 = luaL_checknumber(L, 8);
+
+	if (! (x1 < x2 && y1 < y2 && x3 < x4 && y3 < y4))
+		return luaL_error(L, "boxes_overlap: bad box");
+
+	bool result = true;
+
+	if (x3 >= x2 || x4 <= x1) result = false;
+	if (y3 >= y2 || y4 <= y1) result = false;
+
+	lua_pushboolean(L, result);
+	return 1;
+}
+
+
 // LUA: bit_and(A, B) --> number
 //
 int gui_bit_and(lua_State *L)
@@ -811,6 +1247,170 @@ int gui_minimap_fill_box(lua_State *L)
 }
 
 
+//------------------------------------------------------------------------
+//  MEMORY ACCOUNTING
+//------------------------------------------------------------------------
+
+// the Lua state only lives on the main thread, so a single pool
+// without any locking is enough.
+static mem_pool_c * lua_pool;
+
+typedef struct
+{
+	size_t live;
+	size_t peak;
+
+	u64_t allocs;
+	u64_t frees;
+}
+lua_mem_stats_t;
+
+static lua_mem_stats_t mem_total;
+
+// counters for the current phase (see gui.mem_phase)
+static std::string mem_phase_name;
+
+static lua_mem_stats_t mem_phase;
+static size_t mem_phase_start;
+
+
+static void *Script_Alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	(void) ud;
+
+	// for a new block, Lua 5.1 passes zero as the old size
+	if (! ptr)
+		osize = 0;
+
+	if (nsize == 0)
+	{
+		if (ptr)
+		{
+			lua_pool->Free(ptr, osize);
+
+			mem_total.frees++;
+			mem_phase.frees++;
+			mem_total.live -= osize;
+		}
+		return NULL;
+	}
+
+	void *new_ptr = lua_pool->Realloc(ptr, osize, nsize);
+
+	// Lua treats a NULL result as an out-of-memory error, and it
+	// keeps the old block in that case.
+	if (! new_ptr)
+		return NULL;
+
+	if (! ptr)
+	{
+		mem_total.allocs++;
+		mem_phase.allocs++;
+	}
+
+	mem_total.live += nsize;
+	mem_total.live -= osize;
+
+	mem_total.peak = MAX(mem_total.peak, mem_total.live);
+	mem_phase.peak = MAX(mem_phase.peak, mem_total.live);
+
+	return new_ptr;
+}
+
+
+static int Script_Panic(lua_State *L)
+{
+	const char *msg = lua_tostring(L, -1);
+
+	Main_FatalError("Unprotected error in Lua:\n%s\n", msg ? msg : "(no message)");
+	return 0;  /* NOT REACHED */
+}
+
+
+static void Script_ResetMemStats()
+{
+	memset(&mem_total, 0, sizeof(mem_total));
+	memset(&mem_phase, 0, sizeof(mem_phase));
+
+	mem_phase_name  = "startup";
+	mem_phase_start = 0;
+}
+
+
+static void Script_LogPhase()
+{
+	long growth = (long)mem_total.live - (long)mem_phase_start;
+
+	LogPrintf("MEM PHASE: %-20s allocs %-9llu frees %-9llu peak %6d KB  growth %+6ld KB\n",
+			  mem_phase_name.c_str(),
+			  (unsigned long long) mem_phase.allocs,
+			  (unsigned long long) mem_phase.frees,
+			  (int)(mem_phase.peak / 1024), growth / 1024);
+}
+
+
+// LUA: mem_phase(name)
+//
+// Begins a new phase of memory accounting, and logs the numbers
+// for the previous phase.
+//
+int gui_mem_phase(lua_State *L)
+{
+	const char *name = luaL_checkstring(L, 1);
+
+	Script_LogPhase();
+
+	memset(&mem_phase, 0, sizeof(mem_phase));
+
+	mem_phase.peak  = mem_total.live;
+	mem_phase_name  = name;
+	mem_phase_start = mem_total.live;
+
+	return 0;
+}
+
+
+// LUA: mem_stats() --> table
+//
+// Returns a table with the memory used by the Lua state (in bytes),
+// the number of allocations, and the same things for the current
+// phase.
+//
+int gui_mem_stats(lua_State *L)
+{
+	lua_newtable(L);
+
+	lua_pushnumber(L, (lua_Number) mem_total.live);
+	lua_setfield(L, -2, "live");
+
+	lua_pushnumber(L, (lua_Number) mem_total.peak);
+	lua_setfield(L, -2, "peak");
+
+	lua_pushnumber(L, (lua_Number) mem_total.allocs);
+	lua_setfield(L, -2, "allocs");
+
+	lua_pushnumber(L, (lua_Number) mem_total.frees);
+	lua_setfield(L, -2, "frees");
+
+	lua_pushnumber(L, (lua_Number) lua_pool->Reserved());
+	lua_setfield(L, -2, "reserved");
+
+	lua_pushstring(L, mem_phase_name.c_str());
+	lua_setfield(L, -2, "phase");
+
+	lua_pushnumber(L, (lua_Number) mem_phase.allocs);
+	lua_setfield(L, -2, "phase_allocs");
+
+	lua_pushnumber(L, (lua_Number) mem_phase.peak);
+	lua_setfield(L, -2, "phase_peak");
+
+	lua_pushnumber(L, (lua_Number) mem_total.live - (lua_Number) mem_phase_start);
+	lua_setfield(L, -2, "phase_growth");
+
+	return 1;
+}
+
+
 //------------------------------------------------------------------------
 
 
@@ -831,6 +1431,7 @@ extern int CSG_tex_property(lua_State *L);
 extern int CSG_add_brush(lua_State *L);
 extern int CSG_add_entity(lua_State *L);
 extern int CSG_trace_ray(lua_State *L);
+extern int CSG_cave_lighting(lua_State *L);
 
 extern int WF_wolf_block(lua_State *L);
 extern int WF_wolf_read(lua_State *L);
@@ -874,6 +1475,13 @@ extern int wadfab_get_line(lua_State *L);
 extern int wadfab_get_3d_floor(lua_State *L);
 extern int wadfab_get_thing(lua_State *L);
 
+extern int GRAPH_begin(lua_State *L);
+extern int GRAPH_add_room(lua_State *L);
+extern int GRAPH_add_conn(lua_State *L);
+extern int GRAPH_cut(lua_State *L);
+extern int GRAPH_side(lua_State *L);
+extern int GRAPH_end(lua_State *L);
+
 extern int Q1_add_mapmodel(lua_State *L);
 extern int Q1_add_tex_wad(lua_State *L);
 
@@ -882,6 +1490,7 @@ static const luaL_Reg gui_script_funcs[] =
 {
 	{ "raw_log_print",     gui_raw_log_print },
 	{ "raw_debug_print",   gui_raw_debug_print },
+	{ "debug_enabled",     gui_debug_enabled },
 
 	{ "gettext",        gui_gettext },
 	{ "config_line",    gui_config_line },
@@ -906,6 +1515,29 @@ static const luaL_Reg gui_script_funcs[] =
 	{ "rand_seed",   gui_rand_seed },
 	{ "random",      gui_random },
 
+	{ "mem_stats",   gui_mem_stats },
+	{ "mem_phase",   gui_mem_phase },
+
+	// native helpers (used by util.lua)
+	{ "rand_odds",     gui_rand_odds },
+	{ "rand_range",    gui_rand_range },
+	{ "rand_irange",   gui_rand_irange },
+	{ "rand_int",      gui_rand_int },
+	{ "rand_skew",     gui_rand_skew },
+	{ "rand_pick",     gui_rand_pick },
+	{ "rand_shuffle",  gui_rand_shuffle },
+	{ "rand_index_by_probs", gui_rand_index_by_probs },
+	{ "rand_key_by_probs",   gui_rand_key_by_probs },
+
+	{ "geom_dist",        gui_geom_dist },
+	{ "geom_unit_vector", gui_geom_unit_vector },
+	{ "geom_perp_dist",   gui_geom_perp_dist },
+	{ "geom_along_dist",  gui_geom_along_dist },
+	{ "geom_intersect_lines", gui_geom_intersect_lines },
+	{ "geom_box_dist",    gui_geom_box_dist },
+	{ "geom_inside_box",  gui_geom_inside_box },
+	{ "geom_boxes_overlap", gui_geom_boxes_overlap },
+
 	// file & directory functions
 	{ "import",          gui_import },
 	{ "set_import_dir",  gui_set_import_dir },
@@ -921,6 +1553,7 @@ static const luaL_Reg gui_script_funcs[] =
 	{ "add_brush",   CSG_add_brush  },
 	{ "add_entity",  CSG_add_entity },
 	{ "trace_ray",   CSG_trace_ray },
+	{ "cave_lighting", CSG_cave_lighting },
 
 	// Mini-Map functions
 	{ "minimap_begin",     gui_minimap_begin },
@@ -987,6 +1620,14 @@ static const luaL_Reg gui_script_funcs[] =
 	{ "spots_get_items", SPOT_get_items },
 	{ "spots_end",       SPOT_end },
 
+	// room graph for the quest planner
+	{ "graph_begin",     GRAPH_begin },
+	{ "graph_add_room",  GRAPH_add_room },
+	{ "graph_add_conn",  GRAPH_add_conn },
+	{ "graph_cut",       GRAPH_cut },
+	{ "graph_side",      GRAPH_side },
+	{ "graph_end",       GRAPH_end },
+
 	{ NULL, NULL } // the end
 };
 
@@ -1211,6 +1852,69 @@ static int my_loadfile(lua_State *L, const char *filename)
 }
 
 
+// compiled scripts are kept in a registry table, so that scripts
+// imported for every build (the prefab definitions) are only parsed
+// once.  Each entry is { chunk, modtime } and the modification time
+// is checked again, hence edited files are still picked up.
+//
+// NOTE: the chunk is run again rather than copying the tables it
+//       made, since a copied table can iterate in a different order,
+//       and that would change the random choices in a build.
+
+#define CHUNK_CACHE_KEY  "oblige.chunk_cache"
+
+static int Script_LoadCached(lua_State *L, const char *filename)
+{
+	PHYSFS_sint64 mod_time = PHYSFS_getLastModTime(filename);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, CHUNK_CACHE_KEY);
+
+	int cache_idx = lua_gettop(L);
+
+	lua_getfield(L, cache_idx, filename);
+
+	if (mod_time >= 0 && lua_istable(L, -1))
+	{
+		lua_rawgeti(L, -1, 2);
+
+		bool same = (lua_tonumber(L, -1) == (lua_Number)mod_time);
+
+		lua_pop(L, 1);
+
+		if (same)
+		{
+			lua_rawgeti(L, -1, 1);
+
+			lua_replace(L, cache_idx);
+			lua_settop(L, cache_idx);
+			return 0;
+		}
+	}
+
+	lua_pop(L, 1);
+
+	int status = my_loadfile(L, filename);
+
+	if (status == 0 && mod_time >= 0)
+	{
+		lua_createtable(L, 2, 0);
+
+		lua_pushvalue(L, -2);
+		lua_rawseti(L, -2, 1);
+
+		lua_pushnumber(L, (lua_Number)mod_time);
+		lua_rawseti(L, -2, 2);
+
+		lua_setfield(L, cache_idx, filename);
+	}
+
+	// leave the chunk (or error message) where the cache was
+	lua_replace(L, cache_idx);
+
+	return status;
+}
+
+
 void Script_Load(const char *script_name)
 {
 	SYS_ASSERT(import_dir);
@@ -1226,7 +1930,7 @@ void Script_Load(const char *script_name)
 
 	DebugPrintf("  loading script: '%s'\n", filename);
 
-	int status = my_loadfile(LUA_ST, filename);
+	int status = Script_LoadCached(LUA_ST, filename);
 
 	if (status == 0)
 		status = lua_pcall(LUA_ST, 0, 0, 0);
@@ -1249,10 +1953,19 @@ void Script_Open()
 
 	// create Lua state
 
-	LUA_ST = luaL_newstate();
+	lua_pool = new mem_pool_c;
+
+	Script_ResetMemStats();
+
+	LUA_ST = lua_newstate(Script_Alloc, NULL);
 	if (! LUA_ST)
 		Main_FatalError("LUA Init failed: cannot create new state");
 
+	lua_atpanic(LUA_ST, &Script_Panic);
+
+	lua_newtable(LUA_ST);
+	lua_setfield(LUA_ST, LUA_REGISTRYINDEX, CHUNK_CACHE_KEY);
+
 	int status = lua_cpcall(LUA_ST, &p_init_lua, NULL);
 	if (status != 0)
 		Main_FatalError("LUA Init failed: cannot load standard libs (%d)", status);
@@ -1283,10 +1996,22 @@ void Script_Open()
 void Script_Close()
 {
 	if (LUA_ST)
+	{
 		lua_close(LUA_ST);
 
+		Script_LogPhase();
+
+		LogPrintf("MEM TOTAL: allocs %llu  peak %d KB  reserved %d KB\n",
+				  (unsigned long long) mem_total.allocs,
+				  (int)(mem_total.peak / 1024),
+				  (int)(lua_pool->Reserved() / 1024));
+	}
+
 	LUA_ST = NULL;
 
+	delete lua_pool;
+	lua_pool = NULL;
+
 	LogPrintf("\n--- CLOSED LUA VM ---\n\n");
 }
 
@@ -73,6 +73,15 @@ static void Parse_Option(const char *name, const char *value)
 	{
 		debug_messages = atoi(value) ? true : false;
 	}
+	else if (StringCaseCmp(name, "wad_buffer_kb") == 0)
+	{
+		wad_buffer_kb = atoi(value);
+		wad_buffer_kb = CLAMP(4, wad_buffer_kb, 65536);
+	}
+	else if (StringCaseCmp(name, "direct_io") == 0)
+	{
+		direct_io = atoi(value) ? true : false;
+	}
 	else if (StringCaseCmp(name, "last_directory") == 0)
 	{
 		last_directory = StringDup(value);
@@ -207,6 +216,10 @@ bool Options_Save(const char *filename)
 	fprintf(option_fp, "create_backups = %d\n", create_backups ? 1 : 0);
 	fprintf(option_fp, "overwrite_warning = %d\n", overwrite_warning ? 1 : 0);
 	fprintf(option_fp, "debug_messages = %d\n", debug_messages ? 1 : 0);
+	fprintf(option_fp, "\n");
+
+	fprintf(option_fp, "wad_buffer_kb = %d\n", wad_buffer_kb);
+	fprintf(option_fp, "direct_io = %d\n", direct_io ? 1 : 0);
 
 	if (last_directory)
 	{
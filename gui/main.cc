@@ -28,6 +28,7 @@
 #include "lib_argv.h"
 #include "lib_file.h"
 #include "lib_signal.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 
 #include "main.h"
@@ -38,6 +39,7 @@
 
 #include "csg_main.h"
 #include "g_nukem.h"
+#include "tx_forge.h"
 
 
 #define TICKER_TIME  50 /* ms */
@@ -69,6 +71,9 @@ bool create_backups = true;
 bool overwrite_warning = true;
 bool debug_messages = false;
 
+int  wad_buffer_kb = 1024;
+bool direct_io = false;
+
 
 game_interface_c * game_object = NULL;
 
@@ -99,6 +104,14 @@ static void ShowInfo()
 		"  -l --load     <file>     Load settings from a file\n"
 		"  -k --keep                Keep SEED from loaded settings\n"
 		"\n"
+		"  -j --threads  <num>      Number of threads to use\n"
+		"\n"
+		"     --snapshot <prefix>   Save the CSG brushes of each level\n"
+		"     --bench    <file>     Benchmark the back end on a snapshot\n"
+		"     --stage    <name>     Stage to benchmark (bsp, quake, tjunc, vis, light)\n"
+		"     --runs     <num>      Number of benchmark runs\n"
+		"     --warm                Keep the BSP chunk cache between runs\n"
+		"\n"
 		"  -d --debug               Enable debugging\n"
 		"  -v --verbose             Print log messages to stdout\n"
 		"  -h --help                Show this help message\n"
@@ -322,8 +335,10 @@ void Determine_LoggingFile()
 }
 
 
-bool Main_BackupFile(const char *filename, const char *ext)
+bool Main_BackupFile(const char *filename, const char *ext, bool copy)
 {
+	// when 'copy' is true the existing file is left in place
+
 	if (FileExists(filename))
 	{
 		char *backup_name = ReplaceExtension(filename, ext);
@@ -332,9 +347,11 @@ bool Main_BackupFile(const char *filename, const char *ext)
 
 		FileDelete(backup_name);
 
-		if (! FileRename(filename, backup_name))
+		bool ok = copy ? FileCopy(filename, backup_name) : FileRename(filename, backup_name);
+
+		if (! ok)
 		{
-			LogPrintf("WARNING: unable to rename file!\n");
+			LogPrintf("WARNING: unable to %s file!\n", copy ? "copy" : "rename");
 			StringFree(backup_name);
 			return false;
 		}
@@ -455,6 +472,8 @@ void Main_Shutdown(bool error)
 	}
 
 	Script_Close();
+	TX_FreeSynthCache();
+	Thread_Shutdown();
 	LogClose();
 	ArgvClose();
 }
@@ -462,7 +481,7 @@ void Main_Shutdown(bool error)
 
 void Main_FatalError(const char *msg, ...)
 {
-	static char buffer[MSG_BUF_LEN];
+	static thread_local char buffer[MSG_BUF_LEN];
 
 	va_list arg_pt;
 
@@ -472,6 +491,14 @@ void Main_FatalError(const char *msg, ...)
 
 	buffer[MSG_BUF_LEN-2] = 0;
 
+	// the GUI may only be used by the main thread, so inside a job
+	// the error is reported once all the jobs have finished.
+	if (Thread_InJob())
+		Thread_JobError(buffer);
+
+	// get the log onto disk, in case showing the error goes wrong
+	LogFlush();
+
 	DLG_ShowError("%s", buffer);
 
 	Main_Shutdown(true);
@@ -623,6 +650,8 @@ bool Build_Cool_Shit()
 
 	const char *def_filename = ob_default_filename();
 
+	CSG_BeginBuild();
+
 	// this will ask for output filename (among other things)
 	bool was_ok = game_object->Start(def_filename);
 
@@ -630,11 +659,15 @@ bool Build_Cool_Shit()
 	for (int r_loop = 0 ; r_loop < 6 ; r_loop++)
 		Fl::wait(0.06);
 
+	u32_t script_time = start_time;
+
 	if (was_ok)
 	{
 		// run the scripts Scotty!
 		was_ok = ob_build_cool_shit();
 
+		script_time = TimeGetMillies();
+
 		was_ok = game_object->Finish(was_ok);
 	}
 
@@ -645,6 +678,10 @@ bool Build_Cool_Shit()
 		u32_t end_time = TimeGetMillies();
 		u32_t total_time = end_time - start_time;
 
+		// these are parsed by misc/bench-it.sh, so keep the format
+		LogPrintf("\nSCRIPT TIME: %1.2f seconds\n", (script_time - start_time) / 1000.0);
+		LogPrintf("FINISH TIME: %1.2f seconds\n", (end_time - script_time) / 1000.0);
+
 		LogPrintf("\nTOTAL TIME: %1.2f seconds\n\n", total_time / 1000.0);
 	}
 	else
@@ -708,6 +745,34 @@ int main(int argc, char **argv)
 		batch_output_file = arg_list[batch_arg+1];
 	}
 
+	const char *bench_file = NULL;
+
+	int bench_arg = ArgvFind(0, "bench");
+	if (bench_arg >= 0)
+	{
+		if (bench_arg+1 >= arg_count || ArgvIsOption(bench_arg+1))
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing filename for --bench\n");
+			exit(9);
+		}
+
+		// benchmarking never uses the GUI
+		batch_mode = true;
+		bench_file = arg_list[bench_arg+1];
+	}
+
+	int snap_arg = ArgvFind(0, "snapshot");
+	if (snap_arg >= 0)
+	{
+		if (snap_arg+1 >= arg_count || ArgvIsOption(snap_arg+1))
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing prefix for --snapshot\n");
+			exit(9);
+		}
+
+		csg_snapshot_prefix = arg_list[snap_arg+1];
+	}
+
 
 	Determine_WorkingPath(argv[0]);
 	Determine_InstallDir(argv[0]);
@@ -743,6 +808,23 @@ int main(int argc, char **argv)
 
 	LogEnableDebug(debug_messages);
 
+
+	int num_threads = 0;  // AUTO
+
+	int thread_arg = ArgvFind('j', "threads");
+	if (thread_arg >= 0)
+	{
+		if (thread_arg+1 >= arg_count || ArgvIsOption(thread_arg+1))
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing number for --threads\n");
+			exit(9);
+		}
+
+		num_threads = atoi(arg_list[thread_arg+1]);
+	}
+
+	Thread_Init(num_threads);
+
 	Trans_Init();
 
 	if (! batch_mode)
@@ -751,6 +833,11 @@ int main(int argc, char **argv)
 
 		Trans_SetLanguage();
 	}
+	else if (ArgvFind(0, "options") >= 0)
+	{
+		// batch mode only reads an options file when given one
+		Options_Load(options_file);
+	}
 
 
 	if (! batch_mode)
@@ -779,6 +866,45 @@ int main(int argc, char **argv)
 	}
 
 
+	if (bench_file)
+	{
+		const char *stage = "bsp";
+		int runs = 5;
+
+		int stage_arg = ArgvFind(0, "stage");
+		if (stage_arg >= 0)
+		{
+			if (stage_arg+1 >= arg_count || ArgvIsOption(stage_arg+1))
+			{
+				fprintf(stderr, "OBLIGE ERROR: missing name for --stage\n");
+				exit(9);
+			}
+
+			stage = arg_list[stage_arg+1];
+		}
+
+		int runs_arg = ArgvFind(0, "runs");
+		if (runs_arg >= 0)
+		{
+			if (runs_arg+1 >= arg_count || ArgvIsOption(runs_arg+1))
+			{
+				fprintf(stderr, "OBLIGE ERROR: missing number for --runs\n");
+				exit(9);
+			}
+
+			runs = atoi(arg_list[runs_arg+1]);
+		}
+
+		bool warm = (ArgvFind(0, "warm") >= 0);
+
+		// the Lua scripts are not needed here
+		int result = CSG_Benchmark(bench_file, stage, runs, warm);
+
+		Main_Shutdown(false);
+		return result;
+	}
+
+
 	if (batch_mode)
 	{
 		VFS_ParseCommandLine();
@@ -67,6 +67,9 @@ extern bool create_backups;
 extern bool overwrite_warning;
 extern bool debug_messages;
 
+extern  int wad_buffer_kb;  // output buffer for WAD files
+extern bool direct_io;      // bypass the OS cache when writing
+
 extern const char *last_directory;
 
 
@@ -76,7 +79,7 @@ __attribute__((noreturn))
 void Main_FatalError(const char *msg, ...);
 
 void Main_ProgStatus(const char *msg, ...);
-bool Main_BackupFile(const char *filename, const char *ext);
+bool Main_BackupFile(const char *filename, const char *ext, bool copy = false);
 void Main_Ticker();
 
 
@@ -26,6 +26,9 @@
 //    -  for each edge of each face, find its line and see if any
 //       vertices would split the edge.
 //
+//  The line table only grows while the edges are being added.  After
+//  that it is read-only, so the faces can be fixed in parallel.
+//
 //------------------------------------------------------------------------
 
 #include "headers.h"
@@ -33,6 +36,7 @@
 #include <algorithm>
 
 #include "lib_file.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "main.h"
 
@@ -189,11 +193,16 @@ public:
 };
 
 
-#define INF_LINE_HASH_SIZE  1024
+// the line table uses open addressing (linear probing).  each slot
+// holds a line index (or -1) and the full hash value of that line.
+// the table is doubled when it becomes half full.
+
+#define INF_LINE_HASH_MIN  1024
 
 static std::vector<infinite_line_c> infinite_lines;
 
-static std::vector<int> * inf_line_hashtab[INF_LINE_HASH_SIZE];
+static std::vector<int> inf_line_slots;
+static std::vector<int> inf_line_hashes;
 
 static int tjunc_count;
 
@@ -202,7 +211,8 @@ static void TJ_InitHash()
 {
 	infinite_lines.clear();
 
-	memset(inf_line_hashtab, 0, sizeof(inf_line_hashtab));
+	inf_line_slots .assign(INF_LINE_HASH_MIN, -1);
+	inf_line_hashes.assign(INF_LINE_HASH_MIN,  0);
 
 	tjunc_count = 0;
 }
@@ -210,62 +220,99 @@ static void TJ_InitHash()
 
 static void TJ_FreeHash()
 {
-	infinite_lines.clear();
+	std::vector<infinite_line_c>().swap(infinite_lines);
+
+	std::vector<int>().swap(inf_line_slots);
+	std::vector<int>().swap(inf_line_hashes);
+}
+
+
+static void TJ_InsertHash(int index, int hash)
+{
+	unsigned int mask = inf_line_slots.size() - 1;
+	unsigned int pos  = (unsigned int)hash & mask;
 
-	for (unsigned int i = 0 ; i < INF_LINE_HASH_SIZE ; i++)
+	while (inf_line_slots[pos] >= 0)
+		pos = (pos + 1) & mask;
+
+	inf_line_slots [pos] = index;
+	inf_line_hashes[pos] = hash;
+}
+
+
+static void TJ_GrowHash()
+{
+	unsigned int new_size = inf_line_slots.size() * 2;
+
+	inf_line_slots .assign(new_size, -1);
+	inf_line_hashes.assign(new_size,  0);
+
+	// re-insert in order of creation, so that a lookup still finds
+	// the earliest matching line.
+	for (unsigned int i = 0 ; i < infinite_lines.size() ; i++)
 	{
-		delete inf_line_hashtab[i];
-		inf_line_hashtab[i] = NULL;
+		TJ_InsertHash((int)i, infinite_lines[i].CalcHash());
 	}
 }
 
 
 static infinite_line_c * TJ_HashLookup(const quake_vertex_c & A,
-                                       const quake_vertex_c & B)
+                                       const quake_vertex_c & B,
+                                       bool create)
 {
-	// this will create the infinite line when not already present
+	// when 'create' is true, this will create the infinite line when
+	// not already present.  otherwise it returns NULL for an unknown
+	// line, and never modifies anything (so it is thread-safe).
 
 	infinite_line_c IL;
 
 	IL.Set(A, B);
 	IL.MakeConsistent();
 
-	int hash = IL.CalcHash() & (INF_LINE_HASH_SIZE - 1);
+	int hash = IL.CalcHash();
 
-	if (! inf_line_hashtab[hash])
-		inf_line_hashtab[hash] = new std::vector<int>;
+	unsigned int mask = inf_line_slots.size() - 1;
+	unsigned int pos  = (unsigned int)hash & mask;
 
-	std::vector<int> * hashtab = inf_line_hashtab[hash];
+	for (;;)
+	{
+		int index = inf_line_slots[pos];
 
+		if (index < 0)
+			break;
 
-	for (unsigned int i = 0 ; i < hashtab->size() ; i++)
-	{
-		int index = (*hashtab)[i];
+		if (inf_line_hashes[pos] == hash)
+		{
+			infinite_line_c *test = &infinite_lines[index];
 
-		infinite_line_c *test = &infinite_lines[index];
+			if (test->Match(IL))
+				return test;
+		}
 
-		if (test->Match(IL))
-			return test;
+		pos = (pos + 1) & mask;
 	}
 
-	// not found, make new one
+	if (! create)
+		return NULL;
 
-/// fprintf(stderr, "INF HASH %04d: (%1.6f %1.6f %1.6f) + (%1.6f %1.6f %1.6f)\n",
-///         hash,  IL.x, IL.y, IL.z,  IL.nx, IL.ny, IL.nz);
+	// not found, make new one
 
 	int index = (int)infinite_lines.size();
 
 	infinite_lines.push_back(IL);
 
-	hashtab->push_back(index);
+	TJ_InsertHash(index, hash);
+
+	if (infinite_lines.size() * 2 > inf_line_slots.size())
+		TJ_GrowHash();
 
-	return &infinite_lines.back();
+	return &infinite_lines[index];
 }
 
 
 static void TJ_AddEdge(const quake_vertex_c & A, const quake_vertex_c & B)
 {
-	infinite_line_c * IL = TJ_HashLookup(A, B);
+	infinite_line_c * IL = TJ_HashLookup(A, B, true);
 
 	IL->AddVert(A);
 	IL->AddVert(B);
@@ -300,11 +347,20 @@ static void TJ_SortVertices()
 }
 
 
-static bool TJ_FixOneFace(quake_face_c *F)
+static inline bool TJ_BeforeAlong(float along_N, float limit)
+{
+	return along_N < limit + ALONG_EPSILON;
+}
+
+
+static bool TJ_FixOneFace(quake_face_c *F, int *count)
 {
 	// returns true if the face is OK, or false if it was modified.
 	// when it was modified we need to repeat the process again,
 	// since we can only fix one edge at a time.
+	//
+	// this only reads the line table, hence it can run in parallel
+	// (on different faces).
 
 	bool changed = false;
 
@@ -322,7 +378,12 @@ static bool TJ_FixOneFace(quake_face_c *F)
 
 		F->verts.push_back(A);
 
-		infinite_line_c * IL = TJ_HashLookup(A, B);
+		// a line which is not in the table can only come from an
+		// edge created by an earlier split, and it has no vertices.
+		const infinite_line_c * IL = TJ_HashLookup(A, B, false);
+
+		if (! IL)
+			continue;
 
 		float along_A = IL->CalcAlong(A);
 		float along_B = IL->CalcAlong(B);
@@ -332,49 +393,104 @@ static bool TJ_FixOneFace(quake_face_c *F)
 			std::swap(along_A, along_B);
 		}
 
-		for (unsigned int n = 0 ; n < IL->vertices.size() ; n++)
-		{
-			float along_N = IL->vertices[n];
+		// the vertices are sorted, so skip straight to the first one
+		// past the start of the edge.
+		std::vector<float>::const_iterator N_IT =
+			std::lower_bound(IL->vertices.begin(), IL->vertices.end(),
+							 along_A, TJ_BeforeAlong);
 
-			if (along_N < along_A + ALONG_EPSILON)
-				continue;
+		if (N_IT == IL->vertices.end())
+			continue;
 
-			if (along_N > along_B - ALONG_EPSILON)
-				break;
+		float along_N = *N_IT;
 
-			// we have found a T-junction folks!
-			tjunc_count++;
+		if (along_N > along_B - ALONG_EPSILON)
+			continue;
 
-			quake_vertex_c new_vert;
+		// we have found a T-junction folks!
+		*count += 1;
 
-			IL->GetCoord(new_vert, along_N);
+		quake_vertex_c new_vert;
 
-			F->verts.push_back(new_vert);
+		IL->GetCoord(new_vert, along_N);
 
-			// stop now, as the next intersecting vertex may be in the
-			// wrong order for the face's winding.
-			changed = true;
-			break;
-		}
+		F->verts.push_back(new_vert);
+
+		// only one vertex per edge, as the next intersecting vertex
+		// may be in the wrong order for the face's winding.
+		changed = true;
 	}
 
 	return !changed;  // OK if not changed
 }
 
 
-static void TJ_FixFaces(quake_node_c *node)
+static void TJ_CollectFaces(quake_node_c *node, std::vector<quake_face_c *>& list)
 {
 	for (unsigned int i = 0 ; i < node->faces.size() ; i++)
+		list.push_back(node->faces[i]);
+
+	if (node->front_N) TJ_CollectFaces(node->front_N, list);
+	if (node-> back_N) TJ_CollectFaces(node-> back_N, list);
+}
+
+
+// faces are handed to the worker threads in blocks, since fixing a
+// single face is usually very quick.
+#define TJ_FACE_BLOCK  64
+
+struct tjunc_job_t
+{
+	std::vector<quake_face_c *> * faces;
+
+	// number of T-junctions fixed in each block
+	std::vector<int> * counts;
+};
+
+
+static void TJ_FixFaceBlock(int block, void *priv)
+{
+	tjunc_job_t *job = (tjunc_job_t *)priv;
+
+	unsigned int first = block * TJ_FACE_BLOCK;
+	unsigned int last  = MIN(first + TJ_FACE_BLOCK, job->faces->size());
+
+	int count = 0;
+
+	for (unsigned int i = first ; i < last ; i++)
 	{
+		quake_face_c *F = (*job->faces)[i];
+
 		for (int loop = 0 ; loop < 16 ; loop++)
 		{
-			if (TJ_FixOneFace(node->faces[i]))
+			if (TJ_FixOneFace(F, &count))
 				break;
 		}
 	}
 
-	if (node->front_N) TJ_FixFaces(node->front_N);
-	if (node-> back_N) TJ_FixFaces(node-> back_N);
+	(*job->counts)[block] = count;
+}
+
+
+static void TJ_FixFaces(quake_node_c *root)
+{
+	std::vector<quake_face_c *> faces;
+
+	TJ_CollectFaces(root, faces);
+
+	int num_blocks = (faces.size() + TJ_FACE_BLOCK - 1) / TJ_FACE_BLOCK;
+
+	std::vector<int> counts(num_blocks, 0);
+
+	tjunc_job_t job;
+
+	job.faces  = &faces;
+	job.counts = &counts;
+
+	Thread_ParallelFor(num_blocks, TJ_FixFaceBlock, &job);
+
+	for (int b = 0 ; b < num_blocks ; b++)
+		tjunc_count += counts[b];
 }
 
 
@@ -384,9 +500,10 @@ void QCOM_Fix_T_Junctions()
 	TJ_AddFaces(qk_bsp_root);
 	TJ_SortVertices();
 	TJ_FixFaces(qk_bsp_root);
-	TJ_FreeHash();
 
-	LogPrintf("Fixed %d T-Junctions\n", tjunc_count);
+	LogPrintf("Fixed %d T-Junctions (%d lines)\n", tjunc_count, (int)infinite_lines.size());
+
+	TJ_FreeHash();
 }
 
 //--- editor settings ---
@@ -52,7 +52,7 @@ assert_fail_c& assert_fail_c::operator=(const assert_fail_c &other)
 
 void AssertFail(const char *msg, ...)
 {
-	static char buffer[MSG_BUF_LEN];
+	static thread_local char buffer[MSG_BUF_LEN];
 
 	va_list argptr;
 
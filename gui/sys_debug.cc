@@ -17,21 +17,249 @@
 //  GNU General Public License for more details.
 //
 //------------------------------------------------------------------------
+//
+//  Log messages are appended to a fixed in-memory buffer, and a
+//  background thread writes that buffer to the log file.  The thread
+//  wakes up when enough text is pending, or after a short time.
+//  Anything still in the buffer is written when the log is closed, at
+//  exit, and on a fatal error (via LogFlush).  A crash writes out the
+//  pending text too, followed by a marker.
+//
+//------------------------------------------------------------------------
 
 #include "headers.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <thread>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "main.h"
 #include "lib_util.h"
 
 
 #define DEBUG_BUF_LEN  20000
 
+// write the buffer when this much text is pending
+#define LOG_FLUSH_SIZE  (64 * 1024)
+
+// ... or when this many milliseconds have passed
+#define LOG_FLUSH_MILLIS  250
+
+// size of the pending text buffer (must be a power of two)
+#define LOG_RING_SIZE  (256 * 1024)
+
 
+// true between LogInit() and LogClose() when there is a log file
+static std::atomic<bool> log_active(false);
+
+// these are protected by log_file_mutex
 static FILE *log_file = NULL;
 static char *log_filename = NULL;
 
+// file descriptor of log_file (-1 when closed), for the crash handler
+static std::atomic<int> log_fd(-1);
+
 static bool debugging = false;
 static bool terminal  = false;
 
+// the pending text.  log_head is where new text goes, log_tail is how
+// far it has been written to the file.  Both only ever increase, and
+// are taken modulo the buffer size.  Nothing is allocated here, hence
+// the crash handler can write out the pending part.
+static char log_ring[LOG_RING_SIZE];
+
+static std::atomic<size_t> log_head(0);
+static std::atomic<size_t> log_tail(0);
+
+// held while adding text (only one thread may add at a time), and
+// for log_quit.  may be held when taking log_file_mutex, but never
+// the other way around.
+static std::mutex log_mutex;
+
+// held while writing to (or re-opening) the log file
+static std::mutex log_file_mutex;
+
+static std::condition_variable log_cond;
+
+static std::thread log_writer;
+static bool log_quit;
+
+
+static inline size_t Log_PendingSize()
+{
+	return log_head.load() - log_tail.load();
+}
+
+
+static void Log_WriteRange(int fd, size_t start, size_t end)
+{
+	// only uses write(), so the crash handler can use it too
+
+	while (start != end)
+	{
+		size_t pos = start & (LOG_RING_SIZE - 1);
+		size_t len = end - start;
+
+		if (len > LOG_RING_SIZE - pos)
+			len = LOG_RING_SIZE - pos;
+
+		int got = (int) write(fd, log_ring + pos, len);
+
+		if (got <= 0)
+			return;
+
+		start += got;
+	}
+}
+
+
+static void Log_WriteOut()
+{
+	// the log_file_mutex must be held by the caller
+
+	size_t end = log_head.load();
+
+	int fd = log_fd;
+
+	// if the log file could not be re-opened, the text is dropped
+	if (fd >= 0)
+		Log_WriteRange(fd, log_tail.load(), end);
+
+	log_tail.store(end);
+}
+
+
+static void Log_WriterLoop()
+{
+	for (;;)
+	{
+		bool quit;
+
+		{
+			std::unique_lock<std::mutex> lock(log_mutex);
+
+			log_cond.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MILLIS), []
+			{
+				return log_quit || Log_PendingSize() >= LOG_FLUSH_SIZE;
+			});
+
+			quit = log_quit;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(log_file_mutex);
+
+			Log_WriteOut();
+		}
+
+		if (quit)
+			break;
+	}
+}
+
+
+static void Log_StopWriter()
+{
+	if (! log_writer.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(log_mutex);
+		log_quit = true;
+	}
+
+	log_cond.notify_one();
+
+	log_writer.join();
+}
+
+
+static void Log_Append(const char *text, size_t len)
+{
+	bool wake;
+
+	{
+		std::lock_guard<std::mutex> lock(log_mutex);
+
+		// when the writer has stopped (or never started), it will
+		// be written by the next LogFlush().
+		while (len > 0)
+		{
+			size_t head = log_head.load();
+			size_t room = LOG_RING_SIZE - (head - log_tail.load());
+
+			if (room == 0)
+			{
+				// buffer is full, write it out now
+				std::lock_guard<std::mutex> file_lock(log_file_mutex);
+
+				Log_WriteOut();
+				continue;
+			}
+
+			size_t pos   = head & (LOG_RING_SIZE - 1);
+			size_t count = len;
+
+			if (count > room)
+				count = room;
+
+			if (count > LOG_RING_SIZE - pos)
+				count = LOG_RING_SIZE - pos;
+
+			memcpy(log_ring + pos, text, count);
+
+			log_head.store(head + count);
+
+			text += count;
+			len  -= count;
+		}
+
+		wake = (Log_PendingSize() >= LOG_FLUSH_SIZE) && log_writer.joinable();
+	}
+
+	if (wake)
+		log_cond.notify_one();
+}
+
+
+static void Log_AtExit()
+{
+	Log_StopWriter();
+
+	LogFlush();
+}
+
+
+static void Log_CrashHandler(int sig)
+{
+	// only async-signal-safe calls are allowed here.  text which a
+	// thread was in the middle of adding is lost, and text the writer
+	// thread was in the middle of writing may appear twice.
+	static const char marker[] = "\n====== CRASHED ======\n";
+
+	int fd = log_fd;
+
+	if (fd >= 0)
+	{
+		Log_WriteRange(fd, log_tail.load(), log_head.load());
+
+		if (write(fd, marker, sizeof(marker) - 1) < 0)
+		{ /* nothing we can do */ }
+	}
+
+	std::signal(sig, SIG_DFL);
+	std::raise(sig);
+}
+
 
 bool LogInit(const char *filename)
 {
@@ -43,6 +271,27 @@ bool LogInit(const char *filename)
 
 		if (! log_file)
 			return false;
+
+		log_fd = fileno(log_file);
+
+		log_active = true;
+
+		log_quit = false;
+		log_writer = std::thread(Log_WriterLoop);
+
+		static bool handlers_set = false;
+
+		if (! handlers_set)
+		{
+			handlers_set = true;
+
+			atexit(Log_AtExit);
+
+			std::signal(SIGSEGV, Log_CrashHandler);
+			std::signal(SIGABRT, Log_CrashHandler);
+			std::signal(SIGFPE,  Log_CrashHandler);
+			std::signal(SIGILL,  Log_CrashHandler);
+		}
 	}
 
 	LogPrintf("====== START OF OBLIGE LOGS ======\n");
@@ -64,18 +313,41 @@ void LogEnableDebug(bool enable)
 		LogPrintf("===  DEBUGGING DISABLED  ===\n\n");
 }
 
+bool LogDebugEnabled(void)
+{
+	return debugging;
+}
+
 void LogEnableTerminal(bool enable)
 {
 	terminal = enable;
 }
 
 
+void LogFlush(void)
+{
+	std::lock_guard<std::mutex> lock(log_file_mutex);
+
+	Log_WriteOut();
+}
+
+
 void LogClose(void)
 {
 	LogPrintf("\n====== END OF OBLIGE LOGS ======\n\n");
 
+	log_active = false;
+
+	Log_StopWriter();
+
+	LogFlush();
+
+	std::lock_guard<std::mutex> lock(log_file_mutex);
+
 	if (log_file)
 	{
+		log_fd = -1;
+
 		fclose(log_file);
 		log_file = NULL;
 
@@ -87,15 +359,31 @@ void LogClose(void)
 
 void LogPrintf(const char *str, ...)
 {
-	if (log_file)
+	if (log_active)
 	{
+		static thread_local char buffer[MSG_BUF_LEN];
+
 		va_list args;
 
 		va_start(args, str);
-		vfprintf(log_file, str, args);
+		int len = vsnprintf(buffer, MSG_BUF_LEN, str, args);
 		va_end(args);
 
-		fflush(log_file);
+		if (len >= MSG_BUF_LEN)
+		{
+			// rare, so simply format it again into a larger buffer
+			std::string big(len + 1, 0);
+
+			va_start(args, str);
+			vsnprintf(&big[0], len + 1, str, args);
+			va_end(args);
+
+			Log_Append(big.data(), len);
+		}
+		else if (len > 0)
+		{
+			Log_Append(buffer, len);
+		}
 	}
 
 	// show on the Linux terminal too
@@ -114,7 +402,7 @@ void DebugPrintf(const char *str, ...)
 {
 	if (debugging)
 	{
-		static char buffer[DEBUG_BUF_LEN];
+		static thread_local char buffer[DEBUG_BUF_LEN];
 
 		va_list args;
 
@@ -145,6 +433,14 @@ void DebugPrintf(const char *str, ...)
 
 void LogReadLines(log_display_func_t display_func, void *priv_data)
 {
+	// Note: display_func must not log anything, since the lock below
+	// is needed to add text when the buffer is full.
+
+	LogFlush();
+
+	// keep the writer thread away while the file is re-opened
+	std::lock_guard<std::mutex> lock(log_file_mutex);
+
 	if (! log_file)
 		return;
 
@@ -153,6 +449,8 @@ void LogReadLines(log_display_func_t display_func, void *priv_data)
 	// fussy about opening already open files (in Linux it would
 	// not be an issue).
 
+	log_fd = -1;
+
 	fclose(log_file);
 
 	log_file = fopen(log_filename, "r");
@@ -177,6 +475,9 @@ void LogReadLines(log_display_func_t display_func, void *priv_data)
 	// open the log file for writing again
 	// [ it is unlikely to fail, but if it does then no biggie ]
 	log_file = fopen(log_filename, "a");
+
+	if (log_file)
+		log_fd = fileno(log_file);
 }
 
 //--- editor settings ---
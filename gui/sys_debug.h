@@ -27,6 +27,13 @@ void LogClose(void);
 void LogEnableDebug(bool enable);
 void LogEnableTerminal(bool enable);
 
+// true when DebugPrintf() messages are wanted.  callers can use this
+// to skip building expensive debugging messages.
+bool LogDebugEnabled(void);
+
+// writes all pending log messages to the log file now.
+void LogFlush(void);
+
 void   LogPrintf(const char *str, ...);
 void DebugPrintf(const char *str, ...);
 
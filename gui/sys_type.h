@@ -26,10 +26,12 @@
 typedef char  s8_t;
 typedef short s16_t;
 typedef int   s32_t;
+typedef long long s64_t;
  
 typedef unsigned char  u8_t;
 typedef unsigned short u16_t;
 typedef unsigned int   u32_t;
+typedef unsigned long long u64_t;
 
 typedef u8_t byte;
 
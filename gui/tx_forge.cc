@@ -39,6 +39,8 @@
 #include "lib_util.h"
 #include "aj_random.h"
 
+#include "lib_thread.h"
+
 #include "main.h"
 #include "tx_forge.h"
 
@@ -48,21 +50,21 @@
 static aj_Random_c ss_twist;
 
 
-/* Definitions used to address real and imaginary parts in a two-dimensional
-   array of complex numbers as stored by fourn(). */
+/* The synthesized field is real, so its spectrum is Hermitian and
+   only the columns 0..n/2 need to be stored, the others being complex
+   conjugates of these.  Frequency (i, j) lives at the float pair
+   mesh_a[(i * half_w + j) * 2]. */
 
 static float *mesh_a;
 static int meshsize;
-
-#define Real(x, y)  mesh_a[1 + (((x) * meshsize) + (y)) * 2]
-#define Imag(x, y)  mesh_a[2 + (((x) * meshsize) + (y)) * 2]
-
+static int half_w;
 
 static void create_mesh(int width)
 {
 	meshsize = width;
+	half_w   = width / 2 + 1;
 
-	int total_elem = (meshsize * meshsize + 1) * 2;
+	int total_elem = meshsize * half_w * 2;
 
 	mesh_a = new float[total_elem];
 
@@ -75,100 +77,249 @@ static void free_mesh(void)
 	delete[] mesh_a ; mesh_a = NULL;
 }
 
+static inline void set_freq(int i, int j, double re, double im)
+{
+	// the other half is implied by the symmetry
+	if (j >= half_w)
+		return;
 
-/*  FOURN  --  Multi-dimensional fast Fourier transform
-
-    Called with arguments:
-
-       data   A  one-dimensional  array  of  floats  (NOTE!!!  NOT
-              DOUBLES!!), indexed from one (NOTE!!! NOT  ZERO!!),
-              containing  pairs of numbers representing the complex
-              valued samples.  The Fourier transformed results  are
-              returned in the same array.
+	float *p = &mesh_a[(i * half_w + j) * 2];
 
-       nn     An  array specifying the edge size in each dimension.
-              THIS ARRAY IS INDEXED FROM  ONE,  AND  ALL  THE  EDGE
-              SIZES MUST BE POWERS OF TWO!!!
+	p[0] = re;
+	p[1] = im;
+}
 
-       ndim   Number of dimensions of FFT to perform.  Set to 2 for
-              two dimensional FFT.
+static inline void clear_imag(int i, int j)
+{
+	mesh_a[(i * half_w + j) * 2 + 1] = 0;
+}
 
-       isign  If 1, a Fourier transform is done; if -1 the  inverse
-              transformation is performed.
 
-    This function is essentially as given in Press et al., "Numerical
-    Recipes In C", Section 12.11, pp. 467-470.
+/*  FFT_PLAN  --  Tables for an in-place radix-2 complex FFT of size n
+                  (a power of two), using the exp(-2 PI i / n) sign
+                  convention of the inverse transform done by the
+                  original fourn() code.  The bit reversal
+                  permutation and the twiddle factors are computed
+                  once here, rather than by recurrences in the loops.
 */
 
-static void fourn(float data[], int nn[], int ndim, int isign)
+class fft_plan_c
 {
-	int i1, i2, i3;
-	int i2rev, i3rev, ip1, ip2, ip3, ifp1, ifp2;
-	int ibit, idim, k1, k2, n, nprev, nrem, ntot;
-	float tempi, tempr;
-	double theta, wi, wpi, wpr, wr, wtemp;
-
-#define FN_SWAP(a,b) tempr=(a); (a) = (b); (b) = tempr
-
-	ntot = 1;
-	for (idim = 1; idim <= ndim; idim++)
-		ntot *= nn[idim];
-	nprev = 1;
-	for (idim = ndim; idim >= 1; idim--) {
-		n = nn[idim];
-		nrem = ntot / (n * nprev);
-		ip1 = nprev << 1;
-		ip2 = ip1 * n;
-		ip3 = ip2 * nrem;
-		i2rev = 1;
-		for (i2 = 1; i2 <= ip2; i2 += ip1) {
-			if (i2 < i2rev) {
-				for (i1 = i2; i1 <= i2 + ip1 - 2; i1 += 2) {
-					for (i3 = i1; i3 <= ip3; i3 += ip2) {
-						i3rev = i2rev + i3 - i2;
-						FN_SWAP(data[i3], data[i3rev]);
-						FN_SWAP(data[i3 + 1], data[i3rev + 1]);
-					}
-				}
-			}
-			ibit = ip2 >> 1;
-			while (ibit >= ip1 && i2rev > ibit) {
-				i2rev -= ibit;
-				ibit >>= 1;
+public:
+	int n;
+
+	std::vector<int> rev;
+
+	std::vector<float> tw_re;
+	std::vector<float> tw_im;
+
+public:
+	fft_plan_c(int _n) : n(_n), rev(_n), tw_re(_n / 2 + 1), tw_im(_n / 2 + 1)
+	{
+		int bits = 0;
+
+		while ((1 << bits) < n)
+			bits++;
+
+		for (int k = 0 ; k < n ; k++)
+		{
+			int r = 0;
+
+			for (int b = 0 ; b < bits ; b++)
+				if (k & (1 << b))
+					r |= 1 << (bits - 1 - b);
+
+			rev[k] = r;
+		}
+
+		for (int k = 0 ; k < n / 2 ; k++)
+		{
+			double theta = -2.0 * M_PI * k / n;
+
+			tw_re[k] = cos(theta);
+			tw_im[k] = sin(theta);
+		}
+	}
+
+	~fft_plan_c()
+	{ }
+
+	// data is n complex values, as (real, imag) pairs
+	void Transform(float *data) const
+	{
+		for (int k = 0 ; k < n ; k++)
+		{
+			int r = rev[k];
+
+			if (k < r)
+			{
+				std::swap(data[k*2],   data[r*2]);
+				std::swap(data[k*2+1], data[r*2+1]);
 			}
-			i2rev += ibit;
 		}
-		ifp1 = ip1;
-		while (ifp1 < ip2) {
-			ifp2 = ifp1 << 1;
-			theta = isign * (M_PI * 2) / (ifp2 / ip1);
-			wtemp = sin(0.5 * theta);
-			wpr = -2.0 * wtemp * wtemp;
-			wpi = sin(theta);
-			wr = 1.0;
-			wi = 0.0;
-			for (i3 = 1; i3 <= ifp1; i3 += ip1) {
-				for (i1 = i3; i1 <= i3 + ip1 - 2; i1 += 2) {
-					for (i2 = i1; i2 <= ip3; i2 += ifp2) {
-						k1 = i2;
-						k2 = k1 + ifp1;
-						tempr = wr * data[k2] - wi * data[k2 + 1];
-						tempi = wr * data[k2 + 1] + wi * data[k2];
-						data[k2] = data[k1] - tempr;
-						data[k2 + 1] = data[k1 + 1] - tempi;
-						data[k1] += tempr;
-						data[k1 + 1] += tempi;
-					}
+
+		for (int len = 2 ; len <= n ; len <<= 1)
+		{
+			int half = len >> 1;
+			int step = n / len;
+
+			for (int base = 0 ; base < n ; base += len)
+			{
+				float *A = &data[base * 2];
+				float *B = &data[(base + half) * 2];
+
+				for (int k = 0 ; k < half ; k++)
+				{
+					float wr = tw_re[k * step];
+					float wi = tw_im[k * step];
+
+					float tr = wr * B[k*2]   - wi * B[k*2+1];
+					float ti = wr * B[k*2+1] + wi * B[k*2];
+
+					B[k*2]   = A[k*2]   - tr;
+					B[k*2+1] = A[k*2+1] - ti;
+
+					A[k*2]   += tr;
+					A[k*2+1] += ti;
 				}
-				wr = (wtemp = wr) * wpr - wi * wpi + wr;
-				wi = wi * wpr + wtemp * wpi + wi;
 			}
-			ifp1 = ifp2;
 		}
-		nprev *= n;
 	}
+};
+
+
+/*  INVERSE_FFT  --  Inverse 2D transform of the half spectrum in mesh_a
+                     into a real n x n field.  First the columns are
+                     transformed, a block at a time so that the mesh is
+                     read a row at a time.  Then each row is turned
+                     back into n real values using a complex transform
+                     of half the size.  Rows and column blocks are
+                     spread over the worker threads.
+*/
+
+#define FFT_COL_BLOCK  8
+#define FFT_ROW_BLOCK  8
+
+typedef struct
+{
+	int n;
+
+	const fft_plan_c *col_plan;
+	const fft_plan_c *row_plan;
+
+	float *out;
+
+} fft_job_t;
+
+
+static void fft_column_job(int index, void *priv_dat)
+{
+	const fft_job_t *job = (const fft_job_t *) priv_dat;
+
+	int n = job->n;
+
+	int j1 = index * FFT_COL_BLOCK;
+	int j2 = MIN(j1 + FFT_COL_BLOCK, half_w);
+
+	int cols = j2 - j1;
+
+	std::vector<float> scratch(cols * n * 2);
+
+	for (int i = 0 ; i < n ; i++)
+	{
+		const float *src = &mesh_a[(i * half_w + j1) * 2];
+
+		for (int c = 0 ; c < cols ; c++)
+		{
+			scratch[(c * n + i) * 2]     = src[c * 2];
+			scratch[(c * n + i) * 2 + 1] = src[c * 2 + 1];
+		}
+	}
+
+	for (int c = 0 ; c < cols ; c++)
+		job->col_plan->Transform(&scratch[c * n * 2]);
+
+	for (int i = 0 ; i < n ; i++)
+	{
+		float *dest = &mesh_a[(i * half_w + j1) * 2];
+
+		for (int c = 0 ; c < cols ; c++)
+		{
+			dest[c * 2]     = scratch[(c * n + i) * 2];
+			dest[c * 2 + 1] = scratch[(c * n + i) * 2 + 1];
+		}
+	}
+}
+
+
+static void fft_row_job(int index, void *priv_dat)
+{
+	const fft_job_t *job = (const fft_job_t *) priv_dat;
+
+	int n = job->n;
+	int m = n / 2;
+
+	// the column plan holds exp(-2 PI i k / n) for k < m
+	const fft_plan_c *W = job->col_plan;
+
+	std::vector<float> tmp(m * 2);
+
+	int a1 = index * FFT_ROW_BLOCK;
+	int a2 = MIN(a1 + FFT_ROW_BLOCK, n);
+
+	for (int a = a1 ; a < a2 ; a++)
+	{
+		const float *Z = &mesh_a[a * half_w * 2];
+
+		// split into the spectra of the even and odd samples, and
+		// pack them as real and imaginary parts of one transform.
+		for (int k = 0 ; k < m ; k++)
+		{
+			float zr = Z[k*2];
+			float zi = Z[k*2+1];
+
+			// Z[k + m] is the conjugate of Z[m - k]
+			float yr =   Z[(m-k)*2];
+			float yi = - Z[(m-k)*2+1];
+
+			float er = zr + yr;
+			float ei = zi + yi;
+
+			float dr = zr - yr;
+			float di = zi - yi;
+
+			float or_ = dr * W->tw_re[k] - di * W->tw_im[k];
+			float oi  = dr * W->tw_im[k] + di * W->tw_re[k];
+
+			tmp[k*2]   = er - oi;
+			tmp[k*2+1] = ei + or_;
+		}
+
+		job->row_plan->Transform(&tmp[0]);
+
+		float *dest = &job->out[a * n];
+
+		for (int k = 0 ; k < m * 2 ; k++)
+			dest[k] = tmp[k];
+	}
+}
+
+
+static void inverse_fft(int n, float *out)
+{
+	fft_plan_c col_plan(n);
+	fft_plan_c row_plan(n / 2);
+
+	fft_job_t job;
+
+	job.n = n;
+	job.col_plan = &col_plan;
+	job.row_plan = &row_plan;
+	job.out = out;
+
+	Thread_ParallelFor((half_w + FFT_COL_BLOCK - 1) / FFT_COL_BLOCK, fft_column_job, &job);
+	Thread_ParallelFor((n + FFT_ROW_BLOCK - 1) / FFT_ROW_BLOCK, fft_row_job, &job);
 }
-#undef FN_SWAP
 
 
 /*  INITGAUSS  --  Initialize random number generators.  As given in
@@ -208,7 +359,7 @@ static double rand_phase(void)
                        name   SpectralSynthesisFM2D  on  page  108  of
                        Peitgen & Saupe.
 */
-static void spectral_synth(int n, double h)
+static void spectral_synth(int n, double h, float *out)
 {
 	int i, j;
 
@@ -229,15 +380,13 @@ static void spectral_synth(int n, double h)
 		int i0 = (i == 0) ? 0 : n - i;
 		int j0 = (j == 0) ? 0 : n - j;
 
-		Real(i, j) = rcos;
-		Imag(i, j) = rsin;
-		Real(i0, j0) = rcos;
-		Imag(i0, j0) = - rsin;
+		set_freq(i,  j,  rcos,   rsin);
+		set_freq(i0, j0, rcos, - rsin);
 	}
 
-	Imag(n / 2, 0) = 0;
-	Imag(0, n / 2) = 0;
-	Imag(n / 2, n / 2) = 0;
+	clear_imag(n / 2, 0);
+	clear_imag(0, n / 2);
+	clear_imag(n / 2, n / 2);
 
 	for (i = 1; i <= n / 2 - 1; i++)
 	for (j = 1; j <= n / 2 - 1; j++)
@@ -248,33 +397,27 @@ static void spectral_synth(int n, double h)
 		double rcos = rad * cos(phase);
 		double rsin = rad * sin(phase);
 
-		Real(i, n - j) = rcos;
-		Imag(i, n - j) = rsin;
-		Real(n - i, j) = rcos;
-		Imag(n - i, j) = - rsin;
+		set_freq(i, n - j, rcos,   rsin);
+		set_freq(n - i, j, rcos, - rsin);
 	}
 
-	int nsize[3];
-
-	nsize[0] = 0;
-	nsize[1] = nsize[2] = n;   /* Dimension of frequency domain array */
-
-	fourn(mesh_a, nsize, 2, -1);     /* Take inverse 2D Fourier transform */
+	inverse_fft(n, out);  /* Take inverse 2D Fourier transform */
 }
 
 
-static void copy_and_scale(float *buf)
+static void autoscale(float *buf)
 {
 	/* Compute extrema for autoscaling. */
 	double rmin =  1e30;
 	double rmax = -1e30;
 
-	int i, j;
+	int total = meshsize * meshsize;
+
+	int i;
 
-	for (i = 0; i < meshsize; i++)
-	for (j = 0; j < meshsize; j++)
+	for (i = 0; i < total; i++)
 	{
-		double r = Real(i, j);
+		double r = buf[i];
 
 		rmin = MIN(rmin, r);
 		rmax = MAX(rmax, r);
@@ -287,10 +430,9 @@ static void copy_and_scale(float *buf)
 	if (fabs(range) < 0.0001)
 		range = 0.0001;
 
-	for (i = 0; i < meshsize; i++)
-	for (j = 0; j < meshsize; j++)
+	for (i = 0; i < total; i++)
 	{
-		*buf++ = (Real(i, j) - rmin) / range;
+		buf[i] = (buf[i] - rmin) / range;
 	}
 }
 
@@ -308,6 +450,78 @@ static void power_law_scale(float *buf, double powscale)
 }
 
 
+/* The same fields tend to be requested more than once while building
+   a set of levels (e.g. the sky and title graphics), so the last few
+   are remembered. */
+
+#define SYNTH_CACHE_SIZE  4
+
+class synth_cache_entry_c
+{
+public:
+	int seed;
+	int width;
+
+	double fracdim;
+	double powscale;
+
+	std::vector<float> data;
+
+public:
+	synth_cache_entry_c(int _seed, int _width, double _fracdim, double _powscale) :
+		seed(_seed), width(_width), fracdim(_fracdim), powscale(_powscale),
+		data(_width * _width)
+	{ }
+
+	~synth_cache_entry_c()
+	{ }
+
+	bool Match(int _seed, int _width, double _fracdim, double _powscale) const
+	{
+		return (seed == _seed && width == _width &&
+		        fracdim == _fracdim && powscale == _powscale);
+	}
+};
+
+// most recently used is at the front
+static std::list<synth_cache_entry_c *> synth_cache;
+
+
+static synth_cache_entry_c * SynthCache_Find(int seed, int width,
+                                             double fracdim, double powscale)
+{
+	std::list<synth_cache_entry_c *>::iterator IT;
+
+	for (IT = synth_cache.begin() ; IT != synth_cache.end() ; IT++)
+	{
+		synth_cache_entry_c *E = *IT;
+
+		if (E->Match(seed, width, fracdim, powscale))
+		{
+			synth_cache.erase(IT);
+			synth_cache.push_front(E);
+
+			return E;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void SynthCache_Add(synth_cache_entry_c *E)
+{
+	synth_cache.push_front(E);
+
+	while (synth_cache.size() > SYNTH_CACHE_SIZE)
+	{
+		delete synth_cache.back();
+
+		synth_cache.pop_back();
+	}
+}
+
+
 void TX_SpectralSynth(int seed, float *buf, int width,
                       double fracdim, double powscale)
 {
@@ -322,20 +536,42 @@ void TX_SpectralSynth(int seed, float *buf, int width,
 			Main_FatalError("TX_SpectralSynth: width '%d' is not a power of two\n", width);
 	}
 
-	ss_twist.Seed(seed);
+	synth_cache_entry_c *E = SynthCache_Find(seed, width, fracdim, powscale);
+
+	if (! E)
+	{
+		E = new synth_cache_entry_c(seed, width, fracdim, powscale);
+
+		ss_twist.Seed(seed);
+
+		init_gauss();
 
-	init_gauss();
+		create_mesh(width);
 
-	create_mesh(width);
+		spectral_synth(width, 3.0 - fracdim, &E->data[0]);
 
-	spectral_synth(width, 3.0 - fracdim);
+		free_mesh();
 
-	copy_and_scale(buf);
+		autoscale(&E->data[0]);
+
+		if (fabs(powscale - 1.0) > 0.01)
+			power_law_scale(&E->data[0], powscale);
+
+		SynthCache_Add(E);
+	}
+
+	memcpy(buf, &E->data[0], width * width * sizeof(float));
+}
+
+
+void TX_FreeSynthCache(void)
+{
+	std::list<synth_cache_entry_c *>::iterator IT;
 
-	if (fabs(powscale - 1.0) > 0.01)
-		power_law_scale(buf, powscale);
+	for (IT = synth_cache.begin() ; IT != synth_cache.end() ; IT++)
+		delete *IT;
 
-	free_mesh();
+	synth_cache.clear();
 }
 
 
@@ -8,6 +8,9 @@
 void TX_SpectralSynth(int seed, float *buf, int width,
                       double fracdim = 2.4, double powscale = 1.2);
 
+// the last few synthesized fields are cached, this frees them
+void TX_FreeSynthCache(void);
+
 #endif /* __OBLIGE_TX_FORGE_H__ */
 
 //--- editor settings ---
@@ -0,0 +1,230 @@
+#!/bin/bash
+#
+# Runs a fixed set of batch builds and records how long they take,
+# the peak memory used and a checksum of each output file.  Results
+# are compared against a saved baseline, and any build which became
+# slower (or larger) than the threshold, or whose output changed,
+# is reported and makes the script exit with status 1.
+#
+
+if [ "$1" == "--help" ]
+then
+	echo "USAGE: bench-it  [options]  oblige_options..."
+	echo ""
+	echo "Options:"
+	echo "   --save              save the results as the new baseline"
+	echo "   --baseline <file>   baseline file (default: bench/baseline.txt)"
+	echo "   --threshold <pct>   allowed slow-down in percent (default: 10)"
+	echo "   --runs <num>        builds per entry, fastest is kept (default: 1)"
+	echo "   --only <pattern>    only run entries whose name matches"
+	exit
+fi
+
+if [ ! -d lua_src ]
+then
+	echo "Run this script from the top level."
+	exit 1
+fi
+
+if [ ! -x ./Oblige ]
+then
+	echo "Oblige executable is missing (run make first)."
+	exit 1
+fi
+
+bench_dir=bench
+baseline=${bench_dir}/baseline.txt
+threshold=10
+runs=1
+only=""
+save=0
+
+while [ $# -gt 0 ]
+do
+	case "$1" in
+		--save)      save=1 ; shift ;;
+		--baseline)  baseline="$2" ; shift 2 ;;
+		--threshold) threshold="$2" ; shift 2 ;;
+		--runs)      runs="$2" ; shift 2 ;;
+		--only)      only="$2" ; shift 2 ;;
+		*)           break ;;
+	esac
+done
+
+# the remaining arguments are passed to Oblige (e.g. -j 4)
+extra_args="$@"
+
+# builds to run: name, then key=value settings (seed is always fixed).
+# quake and hexen are still UNFINISHED games, hence are not listed.
+declare -a MATRIX
+MATRIX=(
+	"doom2_small      game=doom2    engine=nolimit  length=few     size=small    seed=1001"
+	"doom2_regular    game=doom2    engine=boom     length=few     size=regular  seed=1002"
+	"doom2_large      game=doom2    engine=zdoom    length=few     size=large    seed=1003"
+	"doom2_episode    game=doom2    engine=boom     length=episode size=prog     seed=1004"
+	"ultdoom_regular  game=ultdoom  engine=nolimit  length=few     size=regular  seed=1005"
+	"tnt_large        game=tnt      engine=boom     length=few     size=large    seed=1006"
+	"heretic_small    game=heretic  engine=nolimit  length=few     size=small    seed=1007"
+	"heretic_large    game=heretic  engine=nolimit  length=few     size=large    seed=1008"
+)
+
+mkdir -p ${bench_dir}
+
+results=${bench_dir}/results.txt
+
+# keep timestamps in the output files fixed, so checksums can match
+export SOURCE_DATE_EPOCH=1500000000
+
+have_time=0
+if [ -x /usr/bin/time ]
+then
+	have_time=1
+fi
+
+# sum all "<KEY> TIME: N seconds" lines in a log file
+log_time()
+{
+	awk -v key="$1" '$1 == key && $2 == "TIME:" { t += $3 } END { printf "%.2f", t }' "$2"
+}
+
+echo "# name	wall	script	level	finish	rss_kb	size	sha1" > ${results}
+
+for entry in "${MATRIX[@]}"
+do
+	set -- ${entry}
+
+	name=$1
+	shift
+	settings="$@"
+
+	if [ -n "${only}" ] && [[ ! "${name}" == *${only}* ]]
+	then
+		continue
+	fi
+
+	out=${bench_dir}/${name}.wad
+	log=${bench_dir}/${name}.log
+	tfile=${bench_dir}/${name}.time
+
+	best_wall=""
+
+	for (( run = 1 ; run <= runs ; run++ ))
+	do
+		echo "Building ${name} (run ${run}/${runs}) ..."
+
+		rm -f ${out} ${log} ${tfile}
+
+		start=$(date +%s.%N)
+
+		if [ ${have_time} == 1 ]
+		then
+			/usr/bin/time -f "%M" -o ${tfile} \
+				./Oblige ${settings} ${extra_args} -b ${out} --log ${log} > /dev/null 2>&1
+		else
+			./Oblige ${settings} ${extra_args} -b ${out} --log ${log} > /dev/null 2>&1
+		fi
+
+		status=$?
+		end=$(date +%s.%N)
+
+		if [ ${status} != 0 ]
+		then
+			echo "FAILED: ${name} (see ${log})"
+			break
+		fi
+
+		wall=$(awk -v a=${start} -v b=${end} 'BEGIN { printf "%.2f", b - a }')
+
+		if [ -z "${best_wall}" ] || awk -v a=${wall} -v b=${best_wall} 'BEGIN { exit !(a < b) }'
+		then
+			best_wall=${wall}
+
+			script=$(log_time SCRIPT ${log})
+			level=$(log_time LEVEL ${log})
+			finish=$(log_time FINISH ${log})
+
+			rss="?"
+			if [ ${have_time} == 1 ]
+			then
+				rss=$(tail -n 1 ${tfile})
+			fi
+		fi
+	done
+
+	if [ ${status} != 0 ]
+	then
+		echo "${name}	FAILED" >> ${results}
+		continue
+	fi
+
+	size=$(stat -c %s ${out})
+	sum=$(sha1sum ${out} | cut -d ' ' -f 1)
+
+	echo "${name}	${best_wall}	${script}	${level}	${finish}	${rss}	${size}	${sum}" >> ${results}
+done
+
+echo ""
+awk 'BEGIN { FS = "\t" } { printf "%-18s %7s %7s %7s %7s %8s %10s  %s\n", $1, $2, $3, $4, $5, $6, $7, $8 }' ${results}
+echo ""
+
+if [ ${save} == 1 ]
+then
+	cp ${results} ${baseline}
+	echo "Saved baseline: ${baseline}"
+	exit 0
+fi
+
+if [ ! -f ${baseline} ]
+then
+	echo "No baseline found (use --save to create one)."
+	exit 0
+fi
+
+# compare with the baseline.  times below half a second are too noisy
+# to judge, so slow-downs smaller than that are not reported.
+awk -v thr=${threshold} '
+	BEGIN { FS = "\t"; bad = 0 }
+
+	FNR == NR {
+		if ($1 !~ /^#/) { b_wall[$1] = $2; b_rss[$1] = $6; b_sum[$1] = $8 }
+		next
+	}
+
+	$1 ~ /^#/ { next }
+
+	{
+		name = $1
+
+		if ($2 == "FAILED") { print "FAILED:   " name; bad = 1; next }
+
+		if (! (name in b_wall)) { print "NEW:      " name; next }
+
+		limit = 1.0 + thr / 100.0
+
+		if ($2 > b_wall[name] * limit && $2 - b_wall[name] > 0.5)
+		{
+			printf "SLOWER:   %s  %.2f -> %.2f seconds\n", name, b_wall[name], $2
+			bad = 1
+		}
+
+		if ($6 != "?" && b_rss[name] != "?" && $6 > b_rss[name] * limit)
+		{
+			printf "MEMORY:   %s  %d -> %d KB\n", name, b_rss[name], $6
+			bad = 1
+		}
+
+		if ($8 != b_sum[name])
+		{
+			print "CHANGED:  " name "  (output differs from baseline)"
+			bad = 1
+		}
+	}
+
+	END {
+		if (! bad) print "No regressions."
+		exit bad
+	}
+' ${baseline} ${results}
+
+# --- editor settings ---
+# vi:ts=4:sw=4:noexpandtab
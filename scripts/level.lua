@@ -2204,18 +2204,23 @@ function Level_build_it()
 
   Seed_init()
 
+  gui.mem_phase("areas")
   Area_create_rooms()
     if gui.abort() then return "abort" end
 
+  gui.mem_phase("quests")
   Quest_make_quests()
     if gui.abort() then return "abort" end
 
+  gui.mem_phase("rooms")
   Room_build_all()
     if gui.abort() then return "abort" end
 
+  gui.mem_phase("monsters")
   Monster_make_battles()
     if gui.abort() then return "abort" end
 
+  gui.mem_phase("items")
   Item_add_pickups()
     if gui.abort() then return "abort" end
 
@@ -2314,6 +2319,8 @@ function Level_make_level(LEV)
   gui.begin_level()
   gui.property("level_name", LEVEL.name);
 
+  gui.mem_phase("setup")
+
   gui.rand_seed(LEVEL.seed + 1)
 
   Level_do_styles()
@@ -2343,6 +2350,8 @@ function Level_make_level(LEV)
 
   ob_invoke_hook("end_level")
 
+  gui.mem_phase("finish")
+
   gui.end_level()
 
 
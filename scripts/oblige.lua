@@ -764,8 +764,11 @@ function ob_init()
     if fmt then gui.raw_log_print(string.format(fmt, ...)) end
   end
 
+  -- skip the formatting when debugging messages are off
   gui.debugf = function (fmt, ...)
-    if fmt then gui.raw_debug_print(string.format(fmt, ...)) end
+    if fmt and gui.debug_enabled() then
+      gui.raw_debug_print(string.format(fmt, ...))
+    end
   end
 
 
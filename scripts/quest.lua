@@ -479,19 +479,7 @@ function Quest_eval_divide_at_conn(C, goal, info)
   end
 
 
-  local function check_has_goal(rooms)
-    if goal.room and rooms[goal.room.id] then
-      return true
-    end
-
-    return false
-  end
-
-
-  local function eval_split_possibility(C, before, after, before_R, after_R)
-    local before_size = Quest_size_of_room_set(before)
-    local  after_size = Quest_size_of_room_set(after)
-
+  local function eval_split_possibility(C, before_size, after_size, after_R)
     local score = 200
 
     if C.prefer_locked then
@@ -541,24 +529,21 @@ gui.debugf("  quest : %s\n", quest.name)
     return
   end
 
-  -- collect rooms on each side of the connection
-  local before = collect_rooms(C.R1, {})
-  local  after = collect_rooms(C.R2, {})
-
---[[
-stderrf("BEFORE =\n  ")
-each id,_ in before do stderrf("%d ", id) end stderrf("\n\n")
-stderrf("AFTER =\n  ")
-each id,_ in after do stderrf("%d ", id) end stderrf("\n\n")
---]]
+  -- the room graph (see Quest_scan_all_conns) knows the size of
+  -- each side of the connection, the actual room sets are only
+  -- collected when this becomes the best division so far.
+  local before_size, after_size, before_leafs, after_leafs = gui.graph_cut(C.id)
 
   local before_R = C.R1
   local  after_R = C.R2
 
-  if check_has_goal(after) then
+  local goal_side = gui.graph_side(C.id, goal.room.id)
+
+  if goal_side == 2 or goal_side == 3 then
     -- OK
-  elseif check_has_goal(before) then
-    before, after = after, before
+  elseif goal_side == 1 then
+    before_size, after_size = after_size, before_size
+    before_leafs, after_leafs = after_leafs, before_leafs
     before_R, after_R = after_R, before_R
   else
     error("Cannot find goal inside quest")
@@ -566,8 +551,11 @@ each id,_ in after do stderrf("%d ", id) end stderrf("\n\n")
 
   -- entry of quest MUST be in first half
   if quest.entry then
-    if not before[quest.entry.id] then
-      assert(after[quest.entry.id])
+    local entry_side  = gui.graph_side(C.id, quest.entry.id)
+    local before_side = sel(before_R == C.R1, 1, 2)
+
+    if not (entry_side == 3 or entry_side == before_side) then
+      assert(entry_side != 0)
       return
     end
   end
@@ -580,15 +568,21 @@ each id,_ in after do stderrf("%d ", id) end stderrf("\n\n")
     if after_R.is_secret   then return end
   end
 
-  local leafs = unused_rooms_in_set(before)
+  if before_leafs < #info.new_goals then return end
 
-  if #leafs < #info.new_goals then return end
-
-  local score = eval_split_possibility(C, before, after, before_R, after_R)
+  local score = eval_split_possibility(C, before_size, after_size, after_R)
 
 gui.debugf("--> possible @ %s : score %1.1f\n", C.name, score)
 
   if score > info.score then
+    -- collect rooms on each side of the connection
+    local before = collect_rooms(before_R, {})
+    local  after = collect_rooms( after_R, {})
+
+    local leafs = unused_rooms_in_set(before)
+
+    assert(#leafs == before_leafs)
+
     info.score  = score
 
     info.conn   = C
@@ -794,6 +788,31 @@ function Quest_scan_all_conns(new_goals, do_quest)
   local need_joiner = (#new_goals >= 2 or new_goals[1].kind == "SWITCH")
 
 
+  -- build the room graph, only connections inside a quest are passable.
+  -- rooms which could hold a new goal are marked too.
+
+  local function can_hold_goal(R)
+    if R.is_secret  then return false end
+    if R.is_hallway then return false end
+
+    if #R.goals > 0 then return false end
+
+    if R.quest and R.quest.entry == R then return false end
+
+    return true
+  end
+
+  gui.graph_begin()
+
+  each R in LEVEL.rooms do
+    gui.graph_add_room(R.id, R.svolume, can_hold_goal(R))
+  end
+
+  each C in LEVEL.conns do
+    gui.graph_add_conn(C.id, C.R1.id, C.R2.id, C.R1.quest == C.R2.quest)
+  end
+
+
   each C in LEVEL.conns do
     local quest = C.R1.quest
     assert(quest)
@@ -817,6 +836,8 @@ function Quest_scan_all_conns(new_goals, do_quest)
   end
 
 
+  gui.graph_end()
+
   -- nothing possible?
   if not info.conn then
 
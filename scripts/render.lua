@@ -2839,6 +2839,9 @@ function Render_cells(area)
   local delta_x_map
   local delta_y_map
 
+  -- torch light level of each cell (when area.cave_lighting is set)
+  local light_grid
+
 
   local function grab_cell(x, y)
     -- Produce a string representing the cell, or NIL for invalid cells.
@@ -2995,54 +2998,13 @@ function Render_cells(area)
   end
 
 
-  local function dist_to_light_level(d)
-    if d >= 312 then return 0  end
-    if d >= 208 then return 16 end
-    if d >= 104 then return 32 end
-    return 48
-  end
-
---[[
-  local function OLD__dist_to_light_level(d)
-    if d >  276 then return 0  end
-    if d >  104 then return 16 end
-    if d >   40 then return 32 end
-    if R.light_level != "verydark" then return 32 end
-    return 48
-  end
---]]
-
-
-  local function calc_lighting_for_cell(x, y, B)
-    if not B then return 0 end
-    if not B.floor_h then return 0 end
-
-    local cell_x, cell_y = cell_middle(x, y)
-    local cell_z = B.floor_h + 80
-
-    local result = 0
+  local function calc_all_lighting()
+    -- this computes the torch lighting of every cell in one go.
+    -- [ it traces rays, hence solid cells must be in the CSG system ]
+    -- the levels drop in steps, from 48 near a light to 0 at 312 units.
 
-    each L in area.cave_lights do
-      -- compute distance
-      local dx = L.x - cell_x
-      local dy = L.y - cell_y
-
-      local dist = math.sqrt(dx * dx + dy * dy)
-
-      local val = dist_to_light_level(dist)
-
-      -- check if result would be updated.
-      -- this does a distance check too (val is zero for far away lights)
-      if val <= result then continue end
-
-      -- check if line of sight is blocked
-      -- [ this is expensive, so call it AFTER distance test ]
-      if not gui.trace_ray(L.x, L.y, L.z, cell_x, cell_y, cell_z, "v") then
-        result = val
-      end
-    end
-
-    return result
+    light_grid = gui.cave_lighting(area.blobs, area.cw, area.ch,
+                                   area.base_x, area.base_y, area.cave_lights)
   end
 
 
@@ -3131,8 +3093,8 @@ function Render_cells(area)
   local function render_lit_cell(x, y, B)
     local bump_light
 
-    if area.cave_lighting then
-      bump_light = calc_lighting_for_cell(x, y, B)
+    if light_grid then
+      bump_light = light_grid[x][y]
 
       if bump_light <= 0 then bump_light = nil end
     end
@@ -3193,6 +3155,10 @@ function Render_cells(area)
 ---    do_torch_lighting()
   end
 
+  if area.cave_lighting then
+    calc_all_lighting()
+  end
+
   render_all_cells(2)
 end
 
@@ -565,30 +565,14 @@ end
 
 rand = {}
 
-function rand.odds(chance)
-  return (gui.random() * 100) <= chance
-end
-
-function rand.range(L,H)
-  return L + gui.random() * (H-L)
-end
-
-function rand.irange(L,H)
-  return math.floor(L + gui.random() * (H-L+0.9999))
-end
-
-function rand.int(val)
-  return math.floor(val + gui.random())
-end
-
-function rand.skew(mid, dist)
-  if not mid  then mid  = 0 end
-  if not dist then dist = 1 end
-
-  local raw = gui.random() - gui.random()
+-- these are implemented natively (in m_lua.cc), producing the
+-- same sequences as the original Lua code.
 
-  return mid + raw * dist
-end
+rand.odds   = gui.rand_odds
+rand.range  = gui.rand_range
+rand.irange = gui.rand_irange
+rand.int    = gui.rand_int
+rand.skew   = gui.rand_skew
 
 function rand.dir()
   return rand.irange(1, 4) * 2
@@ -608,67 +592,15 @@ function rand.sel(chance, yes_val, no_val)
   end
 end
 
-function rand.pick(list)
-  if #list > 0 then
-    return list[rand.irange(1, #list)]
-  else
-    return nil
-  end
-end
+rand.pick    = gui.rand_pick
+rand.shuffle = gui.rand_shuffle
 
-function rand.shuffle(t)
-  -- implements Knuth's random shuffle algorithm.
+-- each element in the table is a probability, returns a random index
+-- based on the probabilities (the highest value is returned more often).
+rand.index_by_probs = gui.rand_index_by_probs
 
-  if #t > 1 then
-    for i = 1,(#t-1) do
-      local k = rand.irange(i,#t)
-      -- swap the pair of values
-      t[i], t[k] = t[k], t[i]
-    end
-  end
-
-  return t
-end
-
-function rand.index_by_probs(p)
-  -- each element in the table is a probability.
-  -- returns a random index based on the probabilities
-  -- (e.g. the highest value is returned more often).
-  assert(#p > 0)
-
-  local total = 0
-  for _,prob in ipairs(p) do
-    total = total + prob
-  end
-
-  if total > 0 then
-    local value = gui.random() * total
-
-    for idx, prob in ipairs(p) do
-      value = value - prob
-      if (value <= 0) then return idx end
-    end
-  end
-
-  -- should not get here, but if we do, return a valid index
-  return 1
-end
-
-function rand.key_by_probs(tab)
-  -- each element in the table has the form: KEY = PROB.
-  -- This function returns one of the keys.
-  local key_list  = {}
-  local prob_list = {}
-
-  for key,prob in pairs(tab) do
-    table.insert(key_list,  key)
-    table.insert(prob_list, prob)
-  end
-
-  local idx = rand.index_by_probs(prob_list)
-
-  return key_list[idx]
-end
+-- each element in the table has the form: KEY = PROB, returns one of the keys.
+rand.key_by_probs = gui.rand_key_by_probs
 
 
 
@@ -709,69 +641,16 @@ geom.CORNERS  = { 1,3,7,9 }
 geom.ALL_DIRS = { 1,2,3, 4,6, 7,8,9 }
 
 
-function geom.dist(x1,y1, x2,y2)
-  return math.sqrt((x1-x2) * (x1-x2) + (y1-y2) * (y1-y2))
-end
+-- these are implemented natively (in m_lua.cc)
+geom.dist        = gui.geom_dist
+geom.unit_vector = gui.geom_unit_vector
+geom.perp_dist   = gui.geom_perp_dist
+geom.along_dist  = gui.geom_along_dist
 
-function geom.unit_vector(dx, dy)
-  local len = math.sqrt(dx * dx + dy * dy)
-
-  if len > 0.000001 then
-    dx = dx / len
-    dy = dy / len
-  else
-    dx = 0
-    dy = 0
-  end
-
-  return dx, dy
-end
-
-function geom.perp_dist(x, y, sx,sy, ex,ey)
-  x = x - sx ; ex = ex - sx
-  y = y - sy ; ey = ey - sy
-
-  local len = math.sqrt(ex*ex + ey*ey)
-
-  if len < 0.001 then
-    error("perp_dist: zero-length line")
-  end
-
-  return (x * ey - y * ex) / len
-end
-
-function geom.along_dist(x, y, sx,sy, ex,ey)
-  x = x - sx ; ex = ex - sx
-  y = y - sy ; ey = ey - sy
-
-  local len = math.sqrt(ex*ex + ey*ey)
-
-  if len < 0.001 then
-    error("perp_dist: zero-length line")
-  end
-
-  return (x * ex + y * ey) / len;
-end
-
-function geom.intersect_lines(ax1,ay1, ax2,ay2,  bx1,by1,bx2,by2)
-  -- calling function must ensure lines are NOT parallel.
-  -- if one of the lines tend to be very short, pass them as 'B' parameter
-  -- and the longer one as 'A' parameter.
-
-  local k1 = geom.perp_dist(bx1, by1, ax1,ay1,ax2,ay2)
-  local k2 = geom.perp_dist(bx2, by2, ax1,ay1,ax2,ay2)
-
-  if math.abs(k1 - k2) < 0.01 then
-    error("intersect_lines: lines are parallel!")
-  end
-
-  local d = k1 / (k1 - k2)
-
-  local ix = bx1 + d * (bx2 - bx1)
-  local iy = by1 + d * (by2 - by1)
-
-  return ix, iy
-end
+-- calling function must ensure lines are NOT parallel.
+-- if one of the lines tend to be very short, pass them as 'B' parameter
+-- and the longer one as 'A' parameter.
+geom.intersect_lines = gui.geom_intersect_lines
 
 
 function geom.delta(dir)
@@ -928,34 +807,9 @@ function geom.group_size(x1,y1, x2,y2)
   return x2 - x1 + 1, y2 - y1 + 1
 end
 
-function geom.box_dist(ax1,ay1,ax2,ay2, bx1,by1,bx2,by2)
-  -- support 'B' being just a point
-  if not bx2 then
-    bx2, by2 = bx1, by1
-  end
-
-  local x_dist = 0
-  local y_dist = 0
-
-  if bx1 > ax2 then
-    x_dist = bx1 - ax2
-  elseif ax1 > bx2 then
-    x_dist = ax1 - bx2
-  end
-
-  if by1 > ay2 then
-    y_dist = by1 - ay2
-  elseif ay1 > by2 then
-    y_dist = ay1 - by2
-  end
-
-  return math.hypot(x_dist, y_dist)
-end
-
-function geom.inside_box(x,y, bx1,by1, bx2,by2)
-  return (bx1 <= x) and (x <= bx2) and
-         (by1 <= y) and (y <= by2)
-end
+-- 'B' may be just a point
+geom.box_dist   = gui.geom_box_dist
+geom.inside_box = gui.geom_inside_box
 
 function geom.box_inside_box(x1,y1,x2,y2, x3,y3,x4,y4)
   assert(x1 < x2 and y1  < y2)
@@ -967,17 +821,8 @@ function geom.box_inside_box(x1,y1,x2,y2, x3,y3,x4,y4)
   return true
 end
 
-function geom.boxes_overlap(x1,y1,x2,y2, x3,y3,x4,y4)
-  -- NOTE: mere touching is not enough
-
-  assert(x1 < x2 and y1 < y2)
-  assert(x3 < x4 and y3 < y4)
-
-  if x3 >= x2 or x4 <= x1 then return false end
-  if y3 >= y2 or y4 <= y1 then return false end
-
-  return true
-end
+-- NOTE: mere touching is not enough
+geom.boxes_overlap = gui.geom_boxes_overlap
 
 
 function geom.bbox_new()